@@ -0,0 +1,201 @@
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include "codec.hpp"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+namespace codec {
+
+namespace {
+
+class PacketCollector : public EncodedDataProcessor {
+public:
+  void ProcessEncodedData(AVPacket* packet) override {
+    data.assign(reinterpret_cast<const char*>(packet->data), packet->size);
+  }
+
+  std::string data;
+};
+
+class FrameDiscarder : public DecodedDataProcessor {
+public:
+  void ProcessDecodedData(AVFrame* frame) override {
+    benchmark::DoNotOptimize(frame->data[0]);
+  }
+};
+
+class FilteredFrameDiscarder : public FilteredDataProcessor {
+public:
+  void ProcessFilteredData(AVFrame* frame) override {
+    benchmark::DoNotOptimize(frame->data[0]);
+  }
+};
+
+constexpr const char* fontfile = "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf";
+
+std::string BuildJpegFrame(int width, int height) {
+  EncoderOptions options;
+  options.codec = "mjpeg";
+  options.pixfmt = "YUVJ422";
+  options.width = width;
+  options.height = height;
+  options.framerate = 30;
+  options.bitrate = 8000000;
+  Encoder encoder{options};
+  AVFrame* frame = av_frame_alloc();
+  frame->format = AV_PIX_FMT_YUVJ422P;
+  frame->width = width;
+  frame->height = height;
+  av_frame_get_buffer(frame, 0);
+  for (int plane = 0; plane < 3; plane++) {
+    const int planeWidth = plane == 0 ? width : width / 2;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < planeWidth; x++) {
+        frame->data[plane][y * frame->linesize[plane] + x] = static_cast<std::uint8_t>(x ^ y);
+      }
+    }
+  }
+  PacketCollector collector;
+  encoder.Encode(frame, collector);
+  encoder.Flush(collector);
+  av_frame_free(&frame);
+  return collector.data;
+}
+
+void RunFilter(benchmark::State& state, const FilterOptions& options) {
+  Filter filter{options};
+  FilteredFrameDiscarder discarder;
+  AVFrame* source = av_frame_alloc();
+  source->format = AV_PIX_FMT_NV12;
+  source->width = options.width;
+  source->height = options.height;
+  av_frame_get_buffer(source, 0);
+  std::memset(source->data[0], 128, source->linesize[0] * options.height);
+  std::memset(source->data[1], 128, source->linesize[1] * options.height / 2);
+  AVFrame* frame = av_frame_alloc();
+  std::int64_t pts = 0;
+  for (auto _ : state) {
+    av_frame_ref(frame, source);
+    frame->pts = pts++;
+    filter.Process(frame, discarder);
+  }
+  av_frame_free(&frame);
+  av_frame_free(&source);
+  state.SetItemsProcessed(state.iterations());
+}
+
+AVFrame* AllocateFrame(AVPixelFormat format, int width, int height) {
+  AVFrame* frame = av_frame_alloc();
+  frame->format = format;
+  frame->width = width;
+  frame->height = height;
+  av_frame_get_buffer(frame, 0);
+  return frame;
+}
+
+FilterOptions BuildFilterOptions() {
+  FilterOptions options;
+  options.width = 1280;
+  options.height = 720;
+  options.framerate = 30;
+  options.inFormat = "NV12";
+  options.outFormat = "NV12";
+  return options;
+}
+
+}  // namespace
+
+void BM_DecodeUnpaddedBuffer(benchmark::State& state) {
+  DisableCodecLogs();
+  const auto jpeg = BuildJpegFrame(1280, 720);
+  Decoder decoder{DecoderOptions{"mjpeg"}};
+  FrameDiscarder discarder;
+  for (auto _ : state) {
+    decoder.Decode(std::string_view{jpeg}, discarder);
+  }
+  state.SetBytesProcessed(state.iterations() * jpeg.size());
+}
+
+void BM_DecodePacketBuffer(benchmark::State& state) {
+  DisableCodecLogs();
+  PacketBufferPool pool;
+  const auto jpeg = pool.Copy(BuildJpegFrame(1280, 720));
+  Decoder decoder{DecoderOptions{"mjpeg"}};
+  FrameDiscarder discarder;
+  for (auto _ : state) {
+    decoder.Decode(jpeg, discarder);
+  }
+  state.SetBytesProcessed(state.iterations() * jpeg.View().size());
+}
+
+void BM_DecodeLowres(benchmark::State& state) {
+  DisableCodecLogs();
+  PacketBufferPool pool;
+  const auto jpeg = pool.Copy(BuildJpegFrame(1280, 720));
+  DecoderOptions options{"mjpeg"};
+  options.lowres = static_cast<int>(state.range(0));
+  Decoder decoder{options};
+  FrameDiscarder discarder;
+  for (auto _ : state) {
+    decoder.Decode(jpeg, discarder);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_FilterDrawtext(benchmark::State& state) {
+  DisableCodecLogs();
+  auto options = BuildFilterOptions();
+  options.description =
+      std::string{"drawtext=fontfile="} + fontfile + ":text='%{localtime}':fontcolor=yellow:x=10:y=10";
+  RunFilter(state, options);
+}
+
+void BM_FilterTimestampOverlay(benchmark::State& state) {
+  DisableCodecLogs();
+  auto options = BuildFilterOptions();
+  options.description = "null";
+  options.overlay = OverlayOptions{fontfile};
+  RunFilter(state, options);
+}
+
+void BM_Convert(benchmark::State& state, AVPixelFormat in, AVPixelFormat out, ConvertFunction convert) {
+  AVFrame* source = AllocateFrame(in, 1280, 720);
+  AVFrame* converted = AllocateFrame(out, 1280, 720);
+  for (auto _ : state) {
+    convert(source->data, source->linesize, converted->data, converted->linesize, 1280, 720);
+    benchmark::DoNotOptimize(converted->data[0]);
+  }
+  av_frame_free(&converted);
+  av_frame_free(&source);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Swscale(benchmark::State& state, AVPixelFormat in, AVPixelFormat out) {
+  AVFrame* source = AllocateFrame(in, 1280, 720);
+  AVFrame* converted = AllocateFrame(out, 1280, 720);
+  SwsContext* context = sws_getContext(1280, 720, in, 1280, 720, out, SWS_BICUBIC, nullptr, nullptr, nullptr);
+  for (auto _ : state) {
+    sws_scale(context, source->data, source->linesize, 0, 720, converted->data, converted->linesize);
+    benchmark::DoNotOptimize(converted->data[0]);
+  }
+  sws_freeContext(context);
+  av_frame_free(&converted);
+  av_frame_free(&source);
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_DecodeUnpaddedBuffer);
+BENCHMARK(BM_DecodePacketBuffer);
+BENCHMARK(BM_DecodeLowres)->DenseRange(0, 3);
+BENCHMARK(BM_FilterDrawtext);
+BENCHMARK(BM_FilterTimestampOverlay);
+BENCHMARK_CAPTURE(BM_Convert, Yuv422pToYuv420p, AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV420P, ConvertYuv422pToYuv420p);
+BENCHMARK_CAPTURE(BM_Convert, Yuv422pToNv12, AV_PIX_FMT_YUV422P, AV_PIX_FMT_NV12, ConvertYuv422pToNv12);
+BENCHMARK_CAPTURE(BM_Convert, Yuv420pToNv12, AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, ConvertYuv420pToNv12);
+BENCHMARK_CAPTURE(BM_Swscale, Yuv422pToYuv420p, AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV420P);
+BENCHMARK_CAPTURE(BM_Swscale, Yuv422pToNv12, AV_PIX_FMT_YUV422P, AV_PIX_FMT_NV12);
+BENCHMARK_CAPTURE(BM_Swscale, Yuv420pToNv12, AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12);
+
+}  // namespace codec
@@ -0,0 +1,35 @@
+#include <benchmark/benchmark.h>
+#include "websocket.hpp"
+
+namespace network {
+
+std::string BuildMaskedWebsocketFrame(size_t len) {
+  const std::uint8_t maskKey[4] = {0x12, 0x34, 0x56, 0x78};
+  std::string frame;
+  frame += static_cast<char>(0x80 | 0x2);
+  frame += static_cast<char>(0x80 | 127);
+  for (int i = 7; i >= 0; i--) {
+    frame += static_cast<char>(len >> (8 * i));
+  }
+  frame.append(reinterpret_cast<const char*>(maskKey), 4);
+  for (size_t i = 0; i < len; i++) {
+    frame += static_cast<char>(i ^ maskKey[i % 4]);
+  }
+  return frame;
+}
+
+void BM_WebsocketParse(benchmark::State& state) {
+  const auto frame = BuildMaskedWebsocketFrame(state.range(0));
+  ConcreteWebsocketParser parser;
+  std::string buffer;
+  for (auto _ : state) {
+    buffer = frame;
+    auto parsed = parser.Parse(buffer);
+    benchmark::DoNotOptimize(parsed);
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_WebsocketParse)->Arg(1024)->Arg(1024 * 1024);
+
+}  // namespace network
@@ -0,0 +1,334 @@
+#include "asset.hpp"
+#include <brotli/encode.h>
+#include <poll.h>
+#include <spdlog/spdlog.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <filesystem>
+#include <optional>
+#include <vector>
+#include "common.hpp"
+#include "file.hpp"
+
+namespace {
+
+std::string Trim(std::string_view s) {
+  const auto begin = s.find_first_not_of(" \t");
+  if (begin == s.npos) {
+    return "";
+  }
+  const auto end = s.find_last_not_of(" \t");
+  return std::string{s.substr(begin, end - begin + 1)};
+}
+
+std::vector<std::string> SplitList(std::string_view s) {
+  std::vector<std::string> result;
+  while (not s.empty()) {
+    const auto n = s.find(',');
+    auto item = Trim(s.substr(0, n));
+    if (not item.empty()) {
+      result.emplace_back(std::move(item));
+    }
+    if (n == s.npos) {
+      break;
+    }
+    s.remove_prefix(n + 1);
+  }
+  return result;
+}
+
+bool AcceptsEncoding(const network::HttpHeaders& headers, std::string_view coding) {
+  const auto it = headers.find("accept-encoding");
+  if (it == headers.end()) {
+    return false;
+  }
+  std::optional<bool> explicitly;
+  std::optional<bool> wildcard;
+  for (auto& item : SplitList(it->second)) {
+    common::ToLower(item);
+    const auto n = item.find(';');
+    const auto name = Trim(std::string_view{item}.substr(0, n));
+    bool accepted = true;
+    if (n != item.npos) {
+      const auto q = item.find("q=", n);
+      if (q != item.npos) {
+        accepted = std::strtod(item.c_str() + q + 2, nullptr) > 0;
+      }
+    }
+    if (name == coding) {
+      explicitly = accepted;
+    }
+    if (name == "*") {
+      wildcard = accepted;
+    }
+  }
+  return explicitly.value_or(wildcard.value_or(false));
+}
+
+std::string EntityTag(const network::StaticAsset& asset, std::string_view coding) {
+  std::string tag = "\"" + asset.etag;
+  if (not coding.empty()) {
+    tag += "-";
+    tag += coding;
+  }
+  return tag + "\"";
+}
+
+bool MatchesEntityTag(std::string_view value, const network::StaticAsset& asset) {
+  for (auto& tag : SplitList(value)) {
+    if (tag == "*") {
+      return true;
+    }
+    if (tag.starts_with("W/")) {
+      tag.erase(0, 2);
+    }
+    if (tag == EntityTag(asset, "") or tag == EntityTag(asset, "gzip") or tag == EntityTag(asset, "br")) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsNotModified(const network::HttpHeaders& headers, const network::StaticAsset& asset) {
+  const auto etagIt = headers.find("if-none-match");
+  if (etagIt != headers.end()) {
+    return MatchesEntityTag(etagIt->second, asset);
+  }
+  const auto dateIt = headers.find("if-modified-since");
+  if (dateIt != headers.end()) {
+    const auto since = common::ParseHttpDate(dateIt->second);
+    return since and asset.modifiedTime <= *since;
+  }
+  return false;
+}
+
+std::string HashContent(std::string_view content) {
+  std::uint64_t h = 0xcbf29ce484222325;
+  for (const char c : content) {
+    h ^= static_cast<std::uint8_t>(c);
+    h *= 0x100000001b3;
+  }
+  char buf[17];
+  std::snprintf(buf, sizeof buf, "%016llx", static_cast<unsigned long long>(h));
+  return buf;
+}
+
+std::string CompressGzip(std::string_view content) {
+  z_stream stream;
+  memset(&stream, 0, sizeof stream);
+  constexpr int gzipWindowBits = 15 + 16;
+  if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, gzipWindowBits, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+    spdlog::error("asset deflateInit2()");
+    return "";
+  }
+  std::string result(deflateBound(&stream, content.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(content.data()));
+  stream.avail_in = content.size();
+  stream.next_out = reinterpret_cast<Bytef*>(result.data());
+  stream.avail_out = result.size();
+  const int r = deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  if (r != Z_STREAM_END) {
+    spdlog::error("asset deflate(): {}", r);
+    return "";
+  }
+  result.resize(stream.total_out);
+  return result;
+}
+
+std::string CompressBrotli(std::string_view content) {
+  size_t size = BrotliEncoderMaxCompressedSize(content.size());
+  std::string result(size, '\0');
+  if (not BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, content.size(),
+          reinterpret_cast<const std::uint8_t*>(content.data()), &size,
+          reinterpret_cast<std::uint8_t*>(result.data()))) {
+    spdlog::error("asset BrotliEncoderCompress()");
+    return "";
+  }
+  result.resize(size);
+  return result;
+}
+
+std::string ReadFile(const os::File& file) {
+  std::string content(file.Size(), '\0');
+  size_t offset = 0;
+  while (offset < content.size()) {
+    const ssize_t n = pread(file.Fd(), content.data() + offset, content.size() - offset, offset);
+    if (n <= 0) {
+      break;
+    }
+    offset += n;
+  }
+  content.resize(offset);
+  return content;
+}
+
+std::string DirectoryOf(const std::string& path) {
+  const auto parent = std::filesystem::path{path}.parent_path();
+  return parent.empty() ? "." : parent.string();
+}
+
+std::string FilenameOf(const std::string& path) {
+  return std::filesystem::path{path}.filename().string();
+}
+
+}  // namespace
+
+namespace network {
+
+StaticAssetCache::~StaticAssetCache() {
+  if (stopDescriptor != -1) {
+    const std::uint64_t one = 1;
+    if (write(stopDescriptor, &one, sizeof one) < 0) {
+      spdlog::error("asset write(): {}", strerror(errno));
+    }
+  }
+  if (watcherThread.joinable()) {
+    watcherThread.join();
+  }
+  if (inotifyDescriptor != -1) {
+    close(inotifyDescriptor);
+  }
+  if (stopDescriptor != -1) {
+    close(stopDescriptor);
+  }
+}
+
+void StaticAssetCache::Add(const std::string& path, const std::string& contentType) {
+  contentTypes.insert_or_assign(path, contentType);
+  Load(path);
+}
+
+void StaticAssetCache::Load(const std::string& path) {
+  os::File file{path};
+  if (not file.Ok()) {
+    spdlog::error("asset open(\"{}\"): {}", path, strerror(errno));
+    return;
+  }
+  auto asset = std::make_shared<StaticAsset>();
+  asset->contentType = contentTypes.at(path);
+  asset->identity = ReadFile(file);
+  asset->etag = HashContent(asset->identity);
+  asset->modifiedTime = file.ModifiedTime();
+  asset->lastModified = common::FormatHttpDate(asset->modifiedTime);
+  asset->gzip = CompressGzip(asset->identity);
+  if (asset->gzip.size() >= asset->identity.size()) {
+    asset->gzip.clear();
+  }
+  asset->brotli = CompressBrotli(asset->identity);
+  if (asset->brotli.size() >= asset->identity.size()) {
+    asset->brotli.clear();
+  }
+  spdlog::info("asset loaded {}: identity = {}, gzip = {}, br = {}", path, asset->identity.size(), asset->gzip.size(),
+      asset->brotli.size());
+  std::lock_guard lock{assetsMut};
+  assets.insert_or_assign(path, std::move(asset));
+}
+
+std::shared_ptr<const StaticAsset> StaticAssetCache::Get(const std::string& path) const {
+  std::lock_guard lock{assetsMut};
+  const auto it = assets.find(path);
+  if (it == assets.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+HttpResponse StaticAssetCache::BuildResponse(const std::string& path, const HttpRequest& request) const {
+  HttpResponse resp;
+  const auto asset = Get(path);
+  if (not asset) {
+    resp.status = HttpStatus::NotFound;
+    return resp;
+  }
+  std::string_view coding;
+  const std::string* body = &asset->identity;
+  if (not asset->brotli.empty() and AcceptsEncoding(request.headers, "br")) {
+    coding = "br";
+    body = &asset->brotli;
+  } else if (not asset->gzip.empty() and AcceptsEncoding(request.headers, "gzip")) {
+    coding = "gzip";
+    body = &asset->gzip;
+  }
+  resp.headers.emplace("ETag", EntityTag(*asset, coding));
+  resp.headers.emplace("Last-Modified", asset->lastModified);
+  resp.headers.emplace("Cache-Control", "no-cache");
+  resp.headers.emplace("Vary", "Accept-Encoding");
+  if (IsNotModified(request.headers, *asset)) {
+    resp.status = HttpStatus::NotModified;
+    return resp;
+  }
+  resp.status = HttpStatus::OK;
+  resp.headers.emplace("Content-Type", asset->contentType);
+  if (not coding.empty()) {
+    resp.headers.emplace("Content-Encoding", coding);
+  }
+  resp.body = *body;
+  return resp;
+}
+
+void StaticAssetCache::Watch() {
+  inotifyDescriptor = inotify_init1(IN_CLOEXEC);
+  if (inotifyDescriptor < 0) {
+    spdlog::error("asset inotify_init1(): {}", strerror(errno));
+    return;
+  }
+  stopDescriptor = eventfd(0, EFD_CLOEXEC);
+  if (stopDescriptor < 0) {
+    spdlog::error("asset eventfd(): {}", strerror(errno));
+    return;
+  }
+  for (const auto& [path, _] : contentTypes) {
+    const auto dir = DirectoryOf(path);
+    const int wd = inotify_add_watch(inotifyDescriptor, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+      spdlog::error("asset inotify_add_watch(\"{}\"): {}", dir, strerror(errno));
+      continue;
+    }
+    watchedDirectories.insert_or_assign(wd, dir);
+  }
+  watcherThread = std::thread([this] { RunWatcher(); });
+}
+
+void StaticAssetCache::RunWatcher() {
+  while (true) {
+    pollfd fds[2];
+    fds[0].fd = inotifyDescriptor;
+    fds[0].events = POLLIN;
+    fds[1].fd = stopDescriptor;
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      spdlog::error("asset poll(): {}", strerror(errno));
+      return;
+    }
+    if (fds[1].revents & POLLIN) {
+      return;
+    }
+    alignas(inotify_event) char buf[4096];
+    const ssize_t n = read(inotifyDescriptor, buf, sizeof buf);
+    if (n <= 0) {
+      continue;
+    }
+    for (ssize_t i = 0; i < n;) {
+      const auto* event = reinterpret_cast<const inotify_event*>(buf + i);
+      i += sizeof(inotify_event) + event->len;
+      const auto it = watchedDirectories.find(event->wd);
+      if (it == watchedDirectories.end() or event->len == 0) {
+        continue;
+      }
+      for (const auto& [path, _] : contentTypes) {
+        if (DirectoryOf(path) == it->second and FilenameOf(path) == event->name) {
+          Load(path);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace network
@@ -0,0 +1,49 @@
+#pragma once
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "network.hpp"
+
+namespace network {
+
+struct StaticAsset {
+  std::string contentType;
+  std::string etag;
+  std::time_t modifiedTime;
+  std::string lastModified;
+  std::string identity;
+  std::string gzip;
+  std::string brotli;
+};
+
+class StaticAssetCache {
+public:
+  StaticAssetCache() = default;
+  StaticAssetCache(const StaticAssetCache&) = delete;
+  StaticAssetCache(StaticAssetCache&&) = delete;
+  StaticAssetCache& operator=(const StaticAssetCache&) = delete;
+  StaticAssetCache& operator=(StaticAssetCache&&) = delete;
+  ~StaticAssetCache();
+
+  void Add(const std::string&, const std::string&);
+  void Watch();
+  HttpResponse BuildResponse(const std::string&, const HttpRequest&) const;
+
+private:
+  std::shared_ptr<const StaticAsset> Get(const std::string&) const;
+  void Load(const std::string&);
+  void RunWatcher();
+
+  std::unordered_map<std::string, std::string> contentTypes;
+  std::unordered_map<std::string, std::shared_ptr<const StaticAsset>> assets;
+  mutable std::mutex assetsMut;
+  std::unordered_map<int, std::string> watchedDirectories;
+  int inotifyDescriptor{-1};
+  int stopDescriptor{-1};
+  std::thread watcherThread;
+};
+
+}  // namespace network
@@ -1,12 +1,19 @@
 #include "codec.hpp"
+#include <fcntl.h>
 #include <spdlog/spdlog.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
+#include <utility>
 
 extern "C" {
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/log.h>
 #include <libavutil/opt.h>
+#include <libavutil/time.h>
 }
 
 namespace {
@@ -27,13 +34,77 @@ AVPixelFormat ConvertPixFormat(std::string_view fmt) {
   throw std::invalid_argument("PIX_FMT not supported");
 }
 
-int WriterCallbackHelper(void* writer_, std::uint8_t* buffer, int size) {
+void SetThreading(AVCodecContext* context, int threadCount, std::string_view threadType) {
+  context->thread_count = threadCount;
+  if (threadType == "frame") {
+    context->thread_type = FF_THREAD_FRAME;
+  } else if (threadType == "slice") {
+    context->thread_type = FF_THREAD_SLICE;
+  } else if (threadType == "lowlatency") {
+    // slice threads split each frame, frame threads would hold back one frame per thread
+    context->thread_type = FF_THREAD_SLICE;
+    context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+  } else if (threadType != "auto") {
+    spdlog::error("codec thread type {} not supported", threadType);
+  }
+}
+
+AVDictionary* BuildEncoderDict(const codec::EncoderOptions& options) {
+  AVDictionary* dict = nullptr;
+  int r;
+  if ((r = av_dict_parse_string(&dict, options.codecOptions.c_str(), "=", ":", 0)) < 0) {
+    spdlog::error("codec av_dict_parse_string(): {}", r);
+  }
+  av_dict_set(&dict, "preset", options.preset.c_str(), AV_DICT_DONT_OVERWRITE);
+  if (not options.tune.empty()) {
+    av_dict_set(&dict, "tune", options.tune.c_str(), AV_DICT_DONT_OVERWRITE);
+  }
+  if (options.crf >= 0) {
+    av_dict_set(&dict, "crf", std::to_string(options.crf).c_str(), AV_DICT_DONT_OVERWRITE);
+  }
+  if (options.intraRefresh) {
+    av_dict_set(&dict, "intra-refresh", "1", AV_DICT_DONT_OVERWRITE);
+  }
+  // libx264 and qsv spell it differently, the one the encoder does not know is left over
+  av_dict_set(&dict, "forced-idr", "1", AV_DICT_DONT_OVERWRITE);
+  av_dict_set(&dict, "forced_idr", "1", AV_DICT_DONT_OVERWRITE);
+  return dict;
+}
+
+int WriterCallbackHelper(void* writer_, std::uint8_t* buffer, int size, AVIODataMarkerType type, std::int64_t) {
   codec::BufferWriter* writer = reinterpret_cast<codec::BufferWriter*>(writer_);
   const char* p = reinterpret_cast<char*>(buffer);
-  writer->WriterCallback({p, p + size});
+  writer->WriterCallback({p, p + size}, type);
+  return size;
+}
+
+int FileWriteHelper(void* writer_, std::uint8_t* buffer, int size, AVIODataMarkerType, std::int64_t) {
+  codec::FileWriter* writer = reinterpret_cast<codec::FileWriter*>(writer_);
+  const char* p = reinterpret_cast<char*>(buffer);
+  writer->File().Write({p, p + size});
   return size;
 }
 
+std::int64_t FileSeekHelper(void* writer_, std::int64_t offset, int whence) {
+  auto& file = reinterpret_cast<codec::FileWriter*>(writer_)->File();
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return file.Size();
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += file.Position();
+      break;
+    case SEEK_END:
+      offset += file.Size();
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  file.Seek(offset);
+  return offset;
+}
+
 }  // namespace
 
 namespace codec {
@@ -42,6 +113,25 @@ void DisableCodecLogs() {
   av_log_set_level(AV_LOG_QUIET);
 }
 
+// milliseconds of media in a file, nullopt when the container cannot be read, as with an mp4 cut before its moov
+std::optional<std::int64_t> ProbeDuration(std::string_view filename) {
+  const std::string s{filename};
+  AVFormatContext* context = nullptr;
+  int r;
+  if ((r = avformat_open_input(&context, s.c_str(), nullptr, nullptr)) < 0) {
+    spdlog::error("codec avformat_open_input({}): {}", s, r);
+    return std::nullopt;
+  }
+  std::optional<std::int64_t> duration;
+  if ((r = avformat_find_stream_info(context, nullptr)) < 0) {
+    spdlog::error("codec avformat_find_stream_info({}): {}", s, r);
+  } else if (context->duration != AV_NOPTS_VALUE) {
+    duration = context->duration / (AV_TIME_BASE / 1000);
+  }
+  avformat_close_input(&context);
+  return duration;
+}
+
 class PacketRefGuard {
 public:
   explicit PacketRefGuard(AVPacket* packet) : packet{packet} {
@@ -72,6 +162,108 @@ private:
   AVFrame* frame;
 };
 
+PacketBuffer::PacketBuffer(AVBufferRef* buffer, size_t size, std::int64_t timestamp)
+    : buffer{buffer}, size{size}, timestamp{timestamp} {
+}
+
+PacketBuffer::PacketBuffer(const PacketBuffer& other) : size{other.size}, timestamp{other.timestamp} {
+  if (other.buffer) {
+    buffer = av_buffer_ref(other.buffer);
+  }
+}
+
+PacketBuffer::PacketBuffer(PacketBuffer&& other) noexcept
+    : buffer{other.buffer}, size{other.size}, timestamp{other.timestamp} {
+  other.buffer = nullptr;
+  other.size = 0;
+}
+
+PacketBuffer& PacketBuffer::operator=(PacketBuffer&& other) noexcept {
+  std::swap(buffer, other.buffer);
+  std::swap(size, other.size);
+  std::swap(timestamp, other.timestamp);
+  return *this;
+}
+
+PacketBuffer::~PacketBuffer() {
+  av_buffer_unref(&buffer);
+}
+
+AVBufferRef* PacketBuffer::Ref() const {
+  return buffer;
+}
+
+std::string_view PacketBuffer::View() const {
+  if (buffer == nullptr) {
+    return {};
+  }
+  return {reinterpret_cast<const char*>(buffer->data), size};
+}
+
+bool PacketBuffer::Empty() const {
+  return size == 0;
+}
+
+std::int64_t PacketBuffer::Timestamp() const {
+  return timestamp;
+}
+
+PacketBufferPool::~PacketBufferPool() {
+  av_buffer_pool_uninit(&pool);
+}
+
+PacketBuffer PacketBufferPool::Copy(std::string_view buf) {
+  AVBufferRef* ref;
+  {
+    std::lock_guard lock{poolMut};
+    if (pool == nullptr or buf.size() + AV_INPUT_BUFFER_PADDING_SIZE > bufferSize) {
+      // buffers still referenced keep the old pool alive until they are released
+      av_buffer_pool_uninit(&pool);
+      bufferSize = (buf.size() + AV_INPUT_BUFFER_PADDING_SIZE) * 5 / 4;
+      pool = av_buffer_pool_init(bufferSize, nullptr);
+      if (pool == nullptr) {
+        spdlog::error("codec av_buffer_pool_init()");
+        return {};
+      }
+    }
+    ref = av_buffer_pool_get(pool);
+  }
+  if (ref == nullptr) {
+    spdlog::error("codec av_buffer_pool_get()");
+    return {};
+  }
+  std::memcpy(ref->data, buf.data(), buf.size());
+  std::memset(ref->data + buf.size(), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  return PacketBuffer{ref, buf.size(), av_gettime_relative()};
+}
+
+PacketBufferRing::PacketBufferRing(std::int64_t maxDuration, size_t maxBytes)
+    : maxDuration{maxDuration}, maxBytes{maxBytes} {
+}
+
+// keeps the newest buffers spanning at most maxDuration microseconds, counting the pooled allocation against maxBytes
+void PacketBufferRing::Push(const PacketBuffer& buf) {
+  if (maxDuration <= 0 or maxBytes == 0 or buf.Empty()) {
+    return;
+  }
+  buffers.emplace_back(buf);
+  bytes += buf.Ref()->size;
+  while (not buffers.empty() and
+         (bytes > maxBytes or buffers.back().Timestamp() - buffers.front().Timestamp() > maxDuration)) {
+    bytes -= buffers.front().Ref()->size;
+    buffers.pop_front();
+  }
+}
+
+std::deque<PacketBuffer> PacketBufferRing::Drain() {
+  bytes = 0;
+  return std::exchange(buffers, {});
+}
+
+size_t PacketBufferRing::Bytes() const {
+  return bytes;
+}
+
 Decoder::Decoder(const DecoderOptions& options) {
   const auto* codec = avcodec_find_decoder_by_name(options.codec.c_str());
   if (codec == nullptr) {
@@ -87,6 +279,12 @@ Decoder::Decoder(const DecoderOptions& options) {
   int r;
   context->framerate.num = 0;
   context->framerate.den = 1;
+  SetThreading(context, options.threadCount, options.threadType);
+  if (options.lowres > codec->max_lowres) {
+    spdlog::error("codec {} lowres {} not supported, using {}", options.codec, options.lowres, codec->max_lowres);
+  }
+  // the decoder skips the high frequency DCT coefficients and outputs at 1/2^lowres of the coded size
+  context->lowres = std::clamp(options.lowres, 0, static_cast<int>(codec->max_lowres));
   if ((r = avcodec_open2(context, codec, nullptr)) < 0) {
     spdlog::error("codec avcodec_open2(): {}", r);
     return;
@@ -125,10 +323,20 @@ void Decoder::GetDecodedFrame(DecodedDataProcessor& processor) const {
 }
 
 void Decoder::Decode(std::string_view buf, DecodedDataProcessor& processor) const {
+  Decode(pool.Copy(buf), processor);
+}
+
+void Decoder::Decode(const PacketBuffer& buf, DecodedDataProcessor& processor) const {
   int r;
-  std::string bufCopy{buf};
-  packet->data = reinterpret_cast<std::uint8_t*>(bufCopy.data());
-  packet->size = static_cast<int>(bufCopy.size());
+  if (buf.Empty()) {
+    return;
+  }
+  packet->buf = av_buffer_ref(buf.Ref());
+  packet->data = packet->buf->data;
+  packet->size = static_cast<int>(buf.View().size());
+  // the capture time rides along in pts through the filter until the encoder renumbers the frame
+  packet->pts = buf.Timestamp();
+  const PacketRefGuard packetRef{packet};
   if ((r = avcodec_send_packet(context, packet)) < 0) {
     spdlog::error("codec avcodec_send_packet(): {}", r);
     return;
@@ -145,16 +353,46 @@ void Decoder::Flush(DecodedDataProcessor& processor) const {
   GetDecodedFrame(processor);
 }
 
-Filter::Filter(const FilterOptions& options) {
+void Decoder::Reset() {
+  if (context) {
+    avcodec_flush_buffers(context);
+  }
+}
+
+Filter::Filter(const FilterOptions& options)
+    : width{options.width}, height{options.height}, outFormat{ConvertPixFormat(options.outFormat)} {
   int r;
+  frame = av_frame_alloc();
+  if (frame == nullptr) {
+    spdlog::error("codec av_frame_alloc()");
+    return;
+  }
+  if (options.overlay) {
+    overlay = std::make_unique<TimestampOverlay>(*options.overlay);
+  }
+  const auto inFormat = ConvertPixFormat(options.inFormat);
+  if (options.description == "null" and
+      (SameLayout(inFormat, outFormat) or FindConversion(inFormat, outFormat) != nullptr)) {
+    bypassGraph = true;
+    av_image_fill_linesizes(outLinesize, outFormat, width);
+    for (auto& linesize : outLinesize) {
+      linesize = (linesize + frameAlign - 1) & ~(frameAlign - 1);
+    }
+    framePool = av_buffer_pool_init(av_image_get_buffer_size(outFormat, width, height, frameAlign), nullptr);
+    if (framePool == nullptr) {
+      spdlog::error("codec av_buffer_pool_init()");
+    }
+    return;
+  }
   const AVFilter* bufferIn = avfilter_get_by_name("buffer");
   const AVFilter* bufferOut = avfilter_get_by_name("buffersink");
   filterIn = avfilter_inout_alloc();
   filterOut = avfilter_inout_alloc();
   graph = avfilter_graph_alloc();
+  graph->nb_threads = options.threadCount;
   char args[512];
   std::snprintf(args, sizeof args, "video_size=%dx%d:pix_fmt=%d:time_base=1/%d:pixel_aspect=1/1", options.width,
-      options.height, ConvertPixFormat(options.inFormat), options.framerate);
+      options.height, inFormat, options.framerate);
   if ((r = avfilter_graph_create_filter(&contextIn, bufferIn, "in", args, nullptr, graph)) < 0) {
     spdlog::error("codec avfilter_graph_create_filter(in): {}", r);
     return;
@@ -163,8 +401,7 @@ Filter::Filter(const FilterOptions& options) {
     spdlog::error("codec avfilter_graph_create_filter(out): {}", r);
     return;
   }
-  const auto outFmt = ConvertPixFormat(options.outFormat);
-  if ((r = av_opt_set_bin(contextOut, "pix_fmts", reinterpret_cast<const std::uint8_t*>(&outFmt), sizeof outFmt,
+  if ((r = av_opt_set_bin(contextOut, "pix_fmts", reinterpret_cast<const std::uint8_t*>(&outFormat), sizeof outFormat,
            AV_OPT_SEARCH_CHILDREN)) < 0) {
     spdlog::error("codec av_opt_set_bin(): {}", r);
     return;
@@ -188,20 +425,20 @@ Filter::Filter(const FilterOptions& options) {
     spdlog::error("codec avfilter_graph_config(): {}", r);
     return;
   }
-  frame = av_frame_alloc();
-  if (frame == nullptr) {
-    spdlog::error("codec av_frame_alloc()");
-    return;
-  }
 }
 
 Filter::~Filter() {
+  av_buffer_pool_uninit(&framePool);
+  av_frame_free(&frame);
   avfilter_graph_free(&graph);
   avfilter_inout_free(&filterIn);
   avfilter_inout_free(&filterOut);
 }
 
 void Filter::Process(AVFrame* in, FilteredDataProcessor& processor) {
+  if (bypassGraph) {
+    return Convert(in, processor);
+  }
   int r;
   if ((r = av_buffersrc_add_frame(contextIn, in)) < 0) {
     spdlog::error("codec av_buffersrc_add_frame(): {}", r);
@@ -217,8 +454,55 @@ void Filter::Process(AVFrame* in, FilteredDataProcessor& processor) {
       return;
     }
     FrameRefGuard frameRef{frame};
-    processor.ProcessFilteredData(frame);
+    ApplyOverlay(processor);
+  }
+}
+
+void Filter::Convert(AVFrame* in, FilteredDataProcessor& processor) {
+  int r;
+  FrameRefGuard frameRef{frame};
+  if (in->width != width or in->height != height) {
+    spdlog::error("codec filter input {}x{} does not match {}x{}", in->width, in->height, width, height);
+    return;
+  }
+  const auto inFormat = static_cast<AVPixelFormat>(in->format);
+  if (SameLayout(inFormat, outFormat)) {
+    av_frame_move_ref(frame, in);
+    frame->format = outFormat;
+    return ApplyOverlay(processor);
+  }
+  const auto convert = FindConversion(inFormat, outFormat);
+  if (convert == nullptr) {
+    spdlog::error("codec conversion from pixel format {} not supported", in->format);
+    return;
+  }
+  if ((frame->buf[0] = av_buffer_pool_get(framePool)) == nullptr) {
+    spdlog::error("codec av_buffer_pool_get()");
+    return;
   }
+  if ((r = av_frame_copy_props(frame, in)) < 0) {
+    spdlog::error("codec av_frame_copy_props(): {}", r);
+    return;
+  }
+  frame->format = outFormat;
+  frame->width = width;
+  frame->height = height;
+  std::copy(std::begin(outLinesize), std::end(outLinesize), frame->linesize);
+  av_image_fill_pointers(frame->data, outFormat, height, frame->buf[0]->data, frame->linesize);
+  convert(in->data, in->linesize, frame->data, frame->linesize, width, height);
+  ApplyOverlay(processor);
+}
+
+void Filter::ApplyOverlay(FilteredDataProcessor& processor) {
+  int r;
+  if (overlay) {
+    if ((r = av_frame_make_writable(frame)) < 0) {
+      spdlog::error("codec av_frame_make_writable(): {}", r);
+      return;
+    }
+    overlay->Apply(frame);
+  }
+  processor.ProcessFilteredData(frame);
 }
 
 Encoder::Encoder(const EncoderOptions& options) {
@@ -239,13 +523,32 @@ Encoder::Encoder(const EncoderOptions& options) {
   context->time_base.den = options.framerate;
   context->framerate.num = options.framerate;
   context->framerate.den = 1;
-  context->gop_size = 12;
+  context->gop_size = options.gopSize;
   context->pix_fmt = ConvertPixFormat(options.pixfmt);
   context->color_range = AVCOL_RANGE_JPEG;
-  context->bit_rate = options.bitrate;
-  context->bit_rate_tolerance = options.bitrate / 2;
-  av_opt_set(context->priv_data, "preset", "fast", 0);
-  if ((r = avcodec_open2(context, codec, nullptr)) < 0) {
+  context->max_b_frames = options.maxBFrames;
+  if (options.crf < 0) {
+    context->bit_rate = options.bitrate;
+    context->bit_rate_tolerance = static_cast<int>(options.bitrate * options.bitrateTolerance);
+  } else if (std::strcmp(codec->name, "libx264") != 0) {
+    context->global_quality = static_cast<int>(options.crf);
+  }
+  if (options.qscale > 0) {
+    // fixed quantizer, the mpegvideo encoders read it from every frame
+    context->flags |= AV_CODEC_FLAG_QSCALE;
+    context->global_quality = FF_QP2LAMBDA * options.qscale;
+  }
+  context->rc_max_rate = options.maxBitrate;
+  context->rc_buffer_size = options.bufferSize;
+  SetThreading(context, options.threadCount, options.threadType);
+  AVDictionary* dict = BuildEncoderDict(options);
+  r = avcodec_open2(context, codec, &dict);
+  const AVDictionaryEntry* entry = nullptr;
+  while ((entry = av_dict_get(dict, "", entry, AV_DICT_IGNORE_SUFFIX)) != nullptr) {
+    spdlog::debug("codec {} ignored option {}={}", codec->name, entry->key, entry->value);
+  }
+  av_dict_free(&dict);
+  if (r < 0) {
     spdlog::error("codec avcodec_open2(): {}", r);
     return;
   }
@@ -296,6 +599,11 @@ void Encoder::GetEncodedPacket(EncodedDataProcessor& processor) const {
 void Encoder::Encode(AVFrame* frame, EncodedDataProcessor& processor) {
   int r;
   frame->pts = pts++;
+  if (context->flags & AV_CODEC_FLAG_QSCALE) {
+    frame->quality = context->global_quality;
+  }
+  // decoded frames come in tagged as I pictures, which encoders take as a request for a keyframe
+  frame->pict_type = keyframeRequested.exchange(false) ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
   if ((r = avcodec_send_frame(context, frame)) < 0) {
     spdlog::error("codec avcodec_send_frame(): {}", r);
     return;
@@ -303,6 +611,14 @@ void Encoder::Encode(AVFrame* frame, EncodedDataProcessor& processor) {
   GetEncodedPacket(processor);
 }
 
+void Encoder::Skip() {
+  pts++;
+}
+
+void Encoder::ForceKeyframe() {
+  keyframeRequested = true;
+}
+
 void Encoder::Flush(EncodedDataProcessor& processor) const {
   int r;
   if ((r = avcodec_send_frame(context, nullptr)) < 0) {
@@ -312,6 +628,88 @@ void Encoder::Flush(EncodedDataProcessor& processor) const {
   GetEncodedPacket(processor);
 }
 
+// drops whatever the encoder still holds and starts the timeline over, not every encoder can be reopened this way
+bool Encoder::Reset() {
+  if (context == nullptr or not(context->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH)) {
+    return false;
+  }
+  avcodec_flush_buffers(context);
+  pts = 0;
+  keyframeRequested = true;
+  return true;
+}
+
+// libx264 reconfigures on the next frame when the targets change, other encoders keep their initial rate. Tolerance
+// and vbv max rate are scaled along so they stay in proportion, a crf encode has no bitrate to adjust
+void Encoder::SetBitrate(int bitrate) {
+  if (context == nullptr or context->bit_rate <= 0 or bitrate <= 0) {
+    return;
+  }
+  const double scale = static_cast<double>(bitrate) / context->bit_rate;
+  context->bit_rate = bitrate;
+  context->bit_rate_tolerance = static_cast<int>(context->bit_rate_tolerance * scale);
+  context->rc_max_rate = static_cast<std::int64_t>(context->rc_max_rate * scale);
+}
+
+RateController::RateController(const RateControlOptions& options)
+    : options{options}, bitrate{options.maxBitrate} {
+}
+
+// a backlog above the high watermark that is not draining cuts the bitrate by a quarter, and once the bitrate is at
+// its floor halves the frame rate. Only a long run below the low watermark steps back up, by a tenth at a time, and
+// anything in between holds, so the rate settles instead of oscillating. Returns true when the bitrate changed.
+bool RateController::Update(size_t buffered) {
+  const bool growing = buffered >= lastBuffered;
+  lastBuffered = buffered;
+  if (buffered > options.highWatermark and growing) {
+    clear = 0;
+    if (++congested < options.decreaseFrames) {
+      return false;
+    }
+    congested = 0;
+    if (bitrate > options.minBitrate) {
+      bitrate = std::max(options.minBitrate, bitrate - bitrate / 4);
+      return true;
+    }
+    frameInterval = std::min(options.maxFrameInterval, frameInterval * 2);
+    return false;
+  }
+  congested = 0;
+  if (buffered >= options.lowWatermark) {
+    clear = 0;
+    return false;
+  }
+  if (++clear < options.increaseFrames) {
+    return false;
+  }
+  clear = 0;
+  if (frameInterval > 1) {
+    frameInterval /= 2;
+    return false;
+  }
+  if (bitrate < options.maxBitrate) {
+    bitrate = std::min(options.maxBitrate, bitrate + std::max(bitrate / 10, 1));
+    return true;
+  }
+  return false;
+}
+
+void RateController::Reset() {
+  bitrate = options.maxBitrate;
+  frameInterval = 1;
+  congested = 0;
+  clear = 0;
+  lastBuffered = 0;
+}
+
+int RateController::Bitrate() const {
+  return bitrate;
+}
+
+int RateController::FrameInterval() const {
+  return frameInterval;
+}
+
 class TranscoderHelper : public DecodedDataProcessor, public FilteredDataProcessor {
 public:
   TranscoderHelper(Filter& filter, Encoder& encoder, EncodedDataProcessor& processor)
@@ -341,15 +739,56 @@ void Transcoder::Process(std::string_view buf, EncodedDataProcessor& processor)
   decoder.Decode(buf, helper);
 }
 
+void Transcoder::Process(const PacketBuffer& buf, EncodedDataProcessor& processor) {
+  TranscoderHelper helper{filter, encoder, processor};
+  decoder.Decode(buf, helper);
+}
+
 void Transcoder::Flush(EncodedDataProcessor& processor) {
   TranscoderHelper helper{filter, encoder, processor};
   decoder.Flush(helper);
   encoder.Flush(processor);
 }
 
+StreamCopier::StreamCopier(int framerate) : framerate{framerate} {
+  packet = av_packet_alloc();
+  if (packet == nullptr) {
+    spdlog::error("codec av_packet_alloc()");
+    return;
+  }
+}
+
+StreamCopier::~StreamCopier() {
+  av_packet_free(&packet);
+}
+
+void StreamCopier::Process(const PacketBuffer& buf, EncodedDataProcessor& processor) {
+  if (buf.Empty()) {
+    return;
+  }
+  if (not startTimestamp) {
+    startTimestamp = buf.Timestamp();
+  }
+  // capture time in frame intervals keeps dropped frames as gaps instead of speeding the recording up
+  const auto pts = av_rescale_q(buf.Timestamp() - *startTimestamp, {1, 1000000}, {1, framerate});
+  lastPts = std::max(pts, lastPts + 1);
+  packet->buf = av_buffer_ref(buf.Ref());
+  packet->data = packet->buf->data;
+  packet->size = static_cast<int>(buf.View().size());
+  packet->pts = lastPts;
+  packet->dts = lastPts;
+  packet->duration = 1;
+  packet->flags |= AV_PKT_FLAG_KEY;
+  const PacketRefGuard packetRef{packet};
+  processor.ProcessEncodedData(packet);
+}
+
 Writer::Writer(const WriterOptions& options) : options{options} {
   int r;
-  if ((r = avformat_alloc_output_context2(&formatContext, nullptr, options.format.c_str(), nullptr)) < 0) {
+  // accepts muxer names as well as file extensions such as mkv
+  const std::string filename = "file." + options.format;
+  const auto* format = av_guess_format(options.format.c_str(), filename.c_str(), nullptr);
+  if ((r = avformat_alloc_output_context2(&formatContext, format, options.format.c_str(), nullptr)) < 0) {
     spdlog::error("codec avformat_alloc_output_context2(): {}", r);
     return;
   }
@@ -384,13 +823,85 @@ Writer::~Writer() {
   formatContext = nullptr;
 }
 
+int Writer::WriteHeader() {
+  AVDictionary* formatDict = nullptr;
+  int r;
+  if ((r = av_dict_parse_string(&formatDict, options.formatOptions.c_str(), "=", ":", 0)) < 0) {
+    spdlog::error("codec av_dict_parse_string(): {}", r);
+  }
+  if (options.fragment != WriterFragment::None) {
+    av_dict_set(&formatDict, "movflags", "empty_moov+delay_moov+default_base_moof+frag_custom+cmaf",
+        AV_DICT_DONT_OVERWRITE);
+  }
+  r = avformat_write_header(formatContext, &formatDict);
+  av_dict_free(&formatDict);
+  return r;
+}
+
 void Writer::Process(AVPacket* packet) {
   int r;
+  const bool keyframe = packet->flags & AV_PKT_FLAG_KEY;
+  if (options.fragment == WriterFragment::Gop and keyframe and fragmentPending) {
+    FlushFragment();
+  }
+  if (packet->duration == 0) {
+    packet->duration = 1;
+  }
+  if (packet->pts != AV_NOPTS_VALUE) {
+    packet->pts -= timestampOffset;
+  }
+  if (packet->dts != AV_NOPTS_VALUE) {
+    packet->dts -= timestampOffset;
+  }
+  const auto pts = packet->pts;
+  if (pts != AV_NOPTS_VALUE) {
+    endPts = std::max(endPts, pts + packet->duration);
+  }
   av_packet_rescale_ts(packet, {1, options.framerate}, stream->time_base);
   if ((r = av_interleaved_write_frame(formatContext, packet)) < 0) {
     spdlog::error("codec av_interleaved_write_frame(): {}", r);
     return;
   }
+  if (not fragmentPending) {
+    pendingFragment.keyframe = keyframe;
+    pendingFragment.pts = pts;
+  }
+  fragmentPending = true;
+  if (options.fragment == WriterFragment::Frame) {
+    FlushFragment();
+  }
+}
+
+void Writer::SetTimestampOffset(std::int64_t offset) {
+  timestampOffset = offset;
+}
+
+std::int64_t Writer::Duration() const {
+  return av_rescale_q(endPts, {1, options.framerate}, {1, 1000});
+}
+
+void Writer::FlushFragment() {
+  int r;
+  if (not initFlushed) {
+    // with delay_moov the first flush only emits ftyp and moov
+    av_write_frame(formatContext, nullptr);
+    initFlushed = true;
+  }
+  pendingFragment.offset = avio_tell(formatContext->pb);
+  if ((r = av_write_frame(formatContext, nullptr)) < 0) {
+    spdlog::error("codec av_write_frame(): {}", r);
+    return;
+  }
+  avio_flush(formatContext->pb);
+  pendingFragment.size = avio_tell(formatContext->pb) - pendingFragment.offset;
+  fragmentPending = false;
+  FragmentFlushed(pendingFragment);
+}
+
+void Writer::FlushPendingFragment() {
+  if (options.fragment != WriterFragment::None and fragmentPending) {
+    FlushFragment();
+  }
 }
 
 BufferWriter::BufferWriter(const WriterOptions& options, WriterProcessor& processor)
@@ -400,15 +911,17 @@ BufferWriter::BufferWriter(const WriterOptions& options, WriterProcessor& proces
 void BufferWriter::Begin() {
   constexpr int writable = 1;
   buffer = static_cast<std::uint8_t*>(av_malloc(bufferSize));
-  formatContext->pb = avio_alloc_context(buffer, bufferSize, writable, this, nullptr, WriterCallbackHelper, nullptr);
+  formatContext->pb = avio_alloc_context(buffer, bufferSize, writable, this, nullptr, nullptr, nullptr);
   if (formatContext->pb == nullptr) {
     spdlog::error("codec avio_alloc_context()");
     return;
   }
+  formatContext->pb->write_data_type = WriterCallbackHelper;
+  formatContext->pb->ignore_boundary_point = 1;
   formatContext->flags = AVFMT_FLAG_CUSTOM_IO;
   formatContext->pb->seekable = 0;
   int r;
-  if ((r = avformat_write_header(formatContext, nullptr)) < 0) {
+  if ((r = WriteHeader()) < 0) {
     spdlog::error("codec avformat_write_header(): {}", r);
     return;
   }
@@ -422,24 +935,62 @@ void BufferWriter::End() {
   av_free(buffer);
 }
 
-void BufferWriter::WriterCallback(std::string_view buffer) {
+void BufferWriter::WriterCallback(std::string_view buffer, AVIODataMarkerType type) {
+  if (type == AVIO_DATA_MARKER_HEADER) {
+    initSegment += buffer;
+  } else if (options.fragment != WriterFragment::None) {
+    fragment += buffer;
+  }
   processor.WriteData(buffer);
 }
 
-FileWriter::FileWriter(const WriterOptions& options, std::string_view filename) : Writer{options}, filename{filename} {
+void BufferWriter::FragmentFlushed(const FragmentInfo& info) {
+  if (not initDelivered) {
+    processor.WriteInitSegment(initSegment);
+    initDelivered = true;
+  }
+  processor.WriteFragment(fragment, info.keyframe);
+  fragment.clear();
+}
+
+const std::string& BufferWriter::InitSegment() const {
+  return initSegment;
 }
 
+FileWriter::FileWriter(const WriterOptions& options, std::string_view filename, FileClosedCallback closed)
+    : Writer{options}, filename{filename}, closed{std::move(closed)} {
+}
+
+FileWriter::~FileWriter() {
+  file.reset();
+  if (indexFd >= 0) {
+    close(indexFd);
+  }
+}
+
+// the muxer writes into an AsyncFile so a slow disk holds up its writer thread instead of the encoder
 void FileWriter::Begin() {
-  int r;
-  if ((r = avio_open2(&formatContext->pb, filename.c_str(), AVIO_FLAG_WRITE, nullptr, nullptr)) < 0) {
-    spdlog::error("codec avio_open2()");
+  file = std::make_unique<os::AsyncFile>(filename, options.file);
+  if (not file->Ok()) {
     return;
   }
+  constexpr int writable = 1;
+  buffer = static_cast<std::uint8_t*>(av_malloc(bufferSize));
+  formatContext->pb = avio_alloc_context(buffer, bufferSize, writable, this, nullptr, nullptr, FileSeekHelper);
   if (formatContext->pb == nullptr) {
-    spdlog::error("codec avio_open2()");
+    spdlog::error("codec avio_alloc_context()");
     return;
   }
-  if ((r = avformat_write_header(formatContext, nullptr)) < 0) {
+  formatContext->pb->write_data_type = FileWriteHelper;
+  if (options.fragment != WriterFragment::None) {
+    const auto indexFilename = filename + ".idx";
+    indexFd = open(indexFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (indexFd < 0) {
+      spdlog::error("codec open({}): {}", indexFilename, strerror(errno));
+    }
+  }
+  int r;
+  if ((r = WriteHeader()) < 0) {
     spdlog::error("codec avformat_write_header(): {}", r);
     return;
   }
@@ -447,9 +998,55 @@ void FileWriter::Begin() {
 
 void FileWriter::End() {
   if (formatContext and formatContext->pb) {
+    FlushPendingFragment();
     av_write_trailer(formatContext);
-    avio_close(formatContext->pb);
+    avio_context_free(&formatContext->pb);
   }
+  av_free(buffer);
+  buffer = nullptr;
+  if (not file) {
+    return;
+  }
+  // the segment is reported as ending now and reaching back by the duration written into it, but only once the
+  // writer thread has truncated and synced the file so readers never see it short. The sidecar is closed there too,
+  // after the last line the writer appended
+  std::optional<os::RecordingSegment> segment;
+  if (closed and file->Ok()) {
+    const auto end = av_gettime() / 1000;
+    segment = os::RecordingSegment{filename, end - Duration(), end, static_cast<std::uint64_t>(file->Size())};
+  }
+  file->Close([segment = std::move(segment), closed = std::exchange(closed, nullptr),
+                  indexFd = std::exchange(indexFd, -1)] {
+    if (indexFd >= 0) {
+      if (fdatasync(indexFd) < 0) {
+        spdlog::error("codec sidecar fdatasync(): {}", strerror(errno));
+      }
+      close(indexFd);
+    }
+    if (segment) {
+      closed(*segment);
+    }
+  });
+}
+
+// each complete fragment is handed to the disk right away. Its "ms offset size" line goes into the sidecar from the
+// writer thread once the fragment itself has been written, so the index never points past the data
+void FileWriter::FragmentFlushed(const FragmentInfo& info) {
+  if (indexFd < 0) {
+    file->Flush();
+    return;
+  }
+  const auto ms = av_rescale_q(info.pts, {1, options.framerate}, {1, 1000});
+  auto line = std::to_string(ms) + " " + std::to_string(info.offset) + " " + std::to_string(info.size) + "\n";
+  file->Flush([indexFd = indexFd, line = std::move(line)] {
+    if (write(indexFd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+      spdlog::error("codec sidecar write(): {}", strerror(errno));
+    }
+  });
+}
+
+os::AsyncFile& FileWriter::File() {
+  return *file;
 }
 
 }  // namespace codec
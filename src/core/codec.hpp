@@ -1,7 +1,17 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
+#include "convert.hpp"
+#include "file.hpp"
+#include "overlay.hpp"
+#include "recording.hpp"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -12,6 +22,59 @@ extern "C" {
 namespace codec {
 
 void DisableCodecLogs();
+std::optional<std::int64_t> ProbeDuration(std::string_view);
+
+class PacketBuffer {
+public:
+  PacketBuffer() = default;
+  PacketBuffer(AVBufferRef*, size_t, std::int64_t);
+  PacketBuffer(const PacketBuffer&);
+  PacketBuffer(PacketBuffer&&) noexcept;
+  PacketBuffer& operator=(const PacketBuffer&) = delete;
+  PacketBuffer& operator=(PacketBuffer&&) noexcept;
+  ~PacketBuffer();
+
+  AVBufferRef* Ref() const;
+  std::string_view View() const;
+  bool Empty() const;
+  std::int64_t Timestamp() const;
+
+private:
+  AVBufferRef* buffer{nullptr};
+  size_t size{0};
+  std::int64_t timestamp{0};
+};
+
+class PacketBufferPool {
+public:
+  PacketBufferPool() = default;
+  PacketBufferPool(const PacketBufferPool&) = delete;
+  PacketBufferPool(PacketBufferPool&&) = delete;
+  PacketBufferPool& operator=(const PacketBufferPool&) = delete;
+  PacketBufferPool& operator=(PacketBufferPool&&) = delete;
+  ~PacketBufferPool();
+
+  PacketBuffer Copy(std::string_view);
+
+private:
+  AVBufferPool* pool{nullptr};
+  size_t bufferSize{0};
+  std::mutex poolMut;
+};
+
+class PacketBufferRing {
+public:
+  PacketBufferRing(std::int64_t, size_t);
+  void Push(const PacketBuffer&);
+  std::deque<PacketBuffer> Drain();
+  size_t Bytes() const;
+
+private:
+  const std::int64_t maxDuration;
+  const size_t maxBytes;
+  std::deque<PacketBuffer> buffers;
+  size_t bytes{0};
+};
 
 class DecodedDataProcessor {
 public:
@@ -21,6 +84,9 @@ public:
 
 struct DecoderOptions {
   std::string codec;
+  int threadCount{0};
+  std::string threadType{"auto"};
+  int lowres{0};
 };
 
 class Decoder {
@@ -29,7 +95,9 @@ public:
   Decoder(const Decoder&) = delete;
   ~Decoder();
   void Decode(std::string_view, DecodedDataProcessor&) const;
+  void Decode(const PacketBuffer&, DecodedDataProcessor&) const;
   void Flush(DecodedDataProcessor&) const;
+  void Reset();
 
 private:
   void GetDecodedFrame(DecodedDataProcessor&) const;
@@ -37,6 +105,7 @@ private:
   AVCodecContext* context{nullptr};
   AVFrame* frame{nullptr};
   AVPacket* packet{nullptr};
+  mutable PacketBufferPool pool;
 };
 
 class FilteredDataProcessor {
@@ -52,6 +121,8 @@ struct FilterOptions {
   std::string inFormat;
   std::string outFormat;
   std::string description;
+  std::optional<OverlayOptions> overlay;
+  int threadCount{0};
 };
 
 class Filter {
@@ -61,12 +132,24 @@ public:
   void Process(AVFrame*, FilteredDataProcessor&);
 
 private:
+  void Convert(AVFrame*, FilteredDataProcessor&);
+  void ApplyOverlay(FilteredDataProcessor&);
+
+  static constexpr int frameAlign = 64;
+
+  int width;
+  int height;
+  AVPixelFormat outFormat;
+  bool bypassGraph{false};
+  int outLinesize[4]{};
+  AVBufferPool* framePool{nullptr};
   AVFilterContext* contextIn{nullptr};
   AVFilterContext* contextOut{nullptr};
   AVFilterInOut* filterIn{nullptr};
   AVFilterInOut* filterOut{nullptr};
   AVFilterGraph* graph{nullptr};
   AVFrame* frame{nullptr};
+  std::unique_ptr<TimestampOverlay> overlay;
 };
 
 class EncodedDataProcessor {
@@ -82,6 +165,19 @@ struct EncoderOptions {
   int height;
   int framerate;
   int bitrate;
+  double bitrateTolerance{0.5};
+  int maxBitrate{0};
+  int bufferSize{0};
+  int gopSize{12};
+  int maxBFrames{0};
+  std::string preset{"fast"};
+  std::string tune;
+  float crf{-1};
+  int qscale{0};
+  bool intraRefresh{false};
+  std::string codecOptions;
+  int threadCount{0};
+  std::string threadType{"auto"};
 };
 
 class Encoder {
@@ -90,7 +186,11 @@ public:
   Encoder(const Encoder&) = delete;
   ~Encoder();
   void Encode(AVFrame*, EncodedDataProcessor&);
+  void Skip();
+  void ForceKeyframe();
   void Flush(EncodedDataProcessor&) const;
+  bool Reset();
+  void SetBitrate(int);
 
 private:
   void GetEncodedPacket(EncodedDataProcessor&) const;
@@ -99,12 +199,41 @@ private:
   AVFrame* frame{nullptr};
   AVPacket* packet{nullptr};
   std::int64_t pts{0};
+  std::atomic<bool> keyframeRequested{false};
+};
+
+struct RateControlOptions {
+  int minBitrate;
+  int maxBitrate;
+  size_t highWatermark{256 * 1024};
+  size_t lowWatermark{32 * 1024};
+  int decreaseFrames{3};
+  int increaseFrames{30};
+  int maxFrameInterval{4};
+};
+
+class RateController {
+public:
+  explicit RateController(const RateControlOptions&);
+  bool Update(size_t);
+  void Reset();
+  int Bitrate() const;
+  int FrameInterval() const;
+
+private:
+  const RateControlOptions options;
+  int bitrate;
+  int frameInterval{1};
+  int congested{0};
+  int clear{0};
+  size_t lastBuffered{0};
 };
 
 class Transcoder {
 public:
   Transcoder(Decoder&, Filter&, Encoder&);
   void Process(std::string_view, EncodedDataProcessor&);
+  void Process(const PacketBuffer&, EncodedDataProcessor&);
   void Flush(EncodedDataProcessor&);
 
 private:
@@ -113,19 +242,52 @@ private:
   Encoder& encoder;
 };
 
+class StreamCopier {
+public:
+  explicit StreamCopier(int);
+  StreamCopier(const StreamCopier&) = delete;
+  StreamCopier(StreamCopier&&) = delete;
+  StreamCopier& operator=(const StreamCopier&) = delete;
+  StreamCopier& operator=(StreamCopier&&) = delete;
+  ~StreamCopier();
+  void Process(const PacketBuffer&, EncodedDataProcessor&);
+
+private:
+  int framerate;
+  AVPacket* packet{nullptr};
+  std::optional<std::int64_t> startTimestamp;
+  std::int64_t lastPts{-1};
+};
+
 class WriterProcessor {
 public:
   virtual ~WriterProcessor() = default;
   virtual void WriteData(std::string_view) = 0;
+  virtual void WriteInitSegment(std::string_view) {
+  }
+  virtual void WriteFragment(std::string_view, bool) {
+  }
 };
 
+enum class WriterFragment { None, Frame, Gop };
+
 struct WriterOptions {
   std::string format;
+  std::string formatOptions;
+  WriterFragment fragment{WriterFragment::None};
   std::string codec;
   int width;
   int height;
   int framerate;
   int bitrate;
+  os::AsyncFileOptions file;
+};
+
+struct FragmentInfo {
+  bool keyframe;
+  std::int64_t pts;
+  std::int64_t offset;
+  std::int64_t size;
 };
 
 class Writer {
@@ -135,14 +297,28 @@ public:
   virtual void Begin() = 0;
   virtual void End() = 0;
   void Process(AVPacket*);
+  void SetTimestampOffset(std::int64_t);
+  std::int64_t Duration() const;
 
 protected:
+  int WriteHeader();
+  void FlushPendingFragment();
+  virtual void FragmentFlushed(const FragmentInfo&) {
+  }
+
   WriterOptions options;
   AVFormatContext* formatContext{nullptr};
 
 private:
+  void FlushFragment();
+
   AVStream* stream;
   AVPacket* packet{nullptr};
+  std::int64_t timestampOffset{0};
+  std::int64_t endPts{0};
+  bool fragmentPending{false};
+  FragmentInfo pendingFragment{false, 0, 0, 0};
+  bool initFlushed{false};
 };
 
 class BufferWriter : public Writer {
@@ -151,23 +327,41 @@ public:
   ~BufferWriter() override = default;
   void Begin() override;
   void End() override;
-  void WriterCallback(std::string_view);
+  void WriterCallback(std::string_view, AVIODataMarkerType);
+  const std::string& InitSegment() const;
+
+protected:
+  void FragmentFlushed(const FragmentInfo&) override;
 
 private:
   WriterProcessor& processor;
+  std::string initSegment;
+  std::string fragment;
+  bool initDelivered{false};
   std::uint8_t* buffer{nullptr};
   int bufferSize{4 * 1024};
 };
 
+using FileClosedCallback = std::function<void(const os::RecordingSegment&)>;
+
 class FileWriter : public Writer {
 public:
-  FileWriter(const WriterOptions&, std::string_view);
-  ~FileWriter() override = default;
+  FileWriter(const WriterOptions&, std::string_view, FileClosedCallback = nullptr);
+  ~FileWriter() override;
   void Begin() override;
   void End() override;
+  os::AsyncFile& File();
+
+protected:
+  void FragmentFlushed(const FragmentInfo&) override;
 
 private:
   std::string filename;
+  FileClosedCallback closed;
+  std::unique_ptr<os::AsyncFile> file;
+  int indexFd{-1};
+  std::uint8_t* buffer{nullptr};
+  int bufferSize{64 * 1024};
 };
 
 }  // namespace codec
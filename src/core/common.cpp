@@ -1,4 +1,5 @@
 #include "common.hpp"
+#include <string.h>
 
 namespace {
 
@@ -163,4 +164,21 @@ std::string Base64(std::string_view payload) {
   return result;
 }
 
+std::string FormatHttpDate(std::time_t t) {
+  std::tm tm;
+  gmtime_r(&t, &tm);
+  char buf[64];
+  std::strftime(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return buf;
+}
+
+std::optional<std::time_t> ParseHttpDate(const std::string& s) {
+  std::tm tm;
+  memset(&tm, 0, sizeof tm);
+  if (strptime(s.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) == nullptr) {
+    return std::nullopt;
+  }
+  return timegm(&tm);
+}
+
 }  // namespace common
@@ -1,4 +1,6 @@
 #pragma once
+#include <ctime>
+#include <optional>
 #include <string>
 
 namespace common {
@@ -11,4 +13,8 @@ std::string SHA1(std::string_view);
 
 std::string Base64(std::string_view);
 
+std::string FormatHttpDate(std::time_t);
+
+std::optional<std::time_t> ParseHttpDate(const std::string&);
+
 }  // namespace common
@@ -0,0 +1,153 @@
+#include "convert.hpp"
+#include <cstring>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+void CopyPlane(const std::uint8_t* src, int srcStride, std::uint8_t* dst, int dstStride, int width, int height) {
+  for (int y = 0; y < height; y++) {
+    std::memcpy(dst + y * dstStride, src + y * srcStride, width);
+  }
+}
+
+void AverageRow(std::uint8_t* dst, const std::uint8_t* a, const std::uint8_t* b, int len) {
+  int i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= len; i += 32) {
+    const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_avg_epu8(x, y));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_avg_epu8(x, y));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= len; i += 16) {
+    vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+  }
+#endif
+  for (; i < len; i++) {
+    dst[i] = static_cast<std::uint8_t>((a[i] + b[i] + 1) >> 1);
+  }
+}
+
+// averages two rows of each chroma plane and interleaves the results, pass the same row twice to only interleave
+void AverageInterleaveRow(std::uint8_t* dst, const std::uint8_t* u0, const std::uint8_t* u1, const std::uint8_t* v0,
+    const std::uint8_t* v1, int len) {
+  int i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= len; i += 32) {
+    const __m256i u = _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(u0 + i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(u1 + i)));
+    const __m256i v = _mm256_avg_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(v0 + i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v1 + i)));
+    // unpack works within 128-bit lanes, so the halves come out as 0-7|16-23 and 8-15|24-31
+    const __m256i lo = _mm256_unpacklo_epi8(u, v);
+    const __m256i hi = _mm256_unpackhi_epi8(u, v);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    const __m128i u = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u0 + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(u1 + i)));
+    const __m128i v = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v0 + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(v1 + i)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), _mm_unpacklo_epi8(u, v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i + 16), _mm_unpackhi_epi8(u, v));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= len; i += 16) {
+    uint8x16x2_t uv;
+    uv.val[0] = vrhaddq_u8(vld1q_u8(u0 + i), vld1q_u8(u1 + i));
+    uv.val[1] = vrhaddq_u8(vld1q_u8(v0 + i), vld1q_u8(v1 + i));
+    vst2q_u8(dst + 2 * i, uv);
+  }
+#endif
+  for (; i < len; i++) {
+    dst[2 * i] = static_cast<std::uint8_t>((u0[i] + u1[i] + 1) >> 1);
+    dst[2 * i + 1] = static_cast<std::uint8_t>((v0[i] + v1[i] + 1) >> 1);
+  }
+}
+
+}  // namespace
+
+namespace codec {
+
+void ConvertYuv422pToYuv420p(const std::uint8_t* const src[], const int srcStride[], std::uint8_t* const dst[],
+    const int dstStride[], int width, int height) {
+  CopyPlane(src[0], srcStride[0], dst[0], dstStride[0], width, height);
+  const int chromaWidth = (width + 1) / 2;
+  const int chromaHeight = (height + 1) / 2;
+  for (int plane = 1; plane < 3; plane++) {
+    for (int y = 0; y < chromaHeight; y++) {
+      const std::uint8_t* top = src[plane] + 2 * y * srcStride[plane];
+      const std::uint8_t* bottom = 2 * y + 1 < height ? top + srcStride[plane] : top;
+      AverageRow(dst[plane] + y * dstStride[plane], top, bottom, chromaWidth);
+    }
+  }
+}
+
+void ConvertYuv422pToNv12(const std::uint8_t* const src[], const int srcStride[], std::uint8_t* const dst[],
+    const int dstStride[], int width, int height) {
+  CopyPlane(src[0], srcStride[0], dst[0], dstStride[0], width, height);
+  const int chromaWidth = (width + 1) / 2;
+  const int chromaHeight = (height + 1) / 2;
+  for (int y = 0; y < chromaHeight; y++) {
+    const std::uint8_t* u = src[1] + 2 * y * srcStride[1];
+    const std::uint8_t* v = src[2] + 2 * y * srcStride[2];
+    const bool last = 2 * y + 1 >= height;
+    AverageInterleaveRow(dst[1] + y * dstStride[1], u, last ? u : u + srcStride[1], v, last ? v : v + srcStride[2],
+        chromaWidth);
+  }
+}
+
+void ConvertYuv420pToNv12(const std::uint8_t* const src[], const int srcStride[], std::uint8_t* const dst[],
+    const int dstStride[], int width, int height) {
+  CopyPlane(src[0], srcStride[0], dst[0], dstStride[0], width, height);
+  const int chromaWidth = (width + 1) / 2;
+  const int chromaHeight = (height + 1) / 2;
+  for (int y = 0; y < chromaHeight; y++) {
+    const std::uint8_t* u = src[1] + y * srcStride[1];
+    const std::uint8_t* v = src[2] + y * srcStride[2];
+    AverageInterleaveRow(dst[1] + y * dstStride[1], u, u, v, v, chromaWidth);
+  }
+}
+
+// the J formats share the layout of their counterparts, the range is carried in the frame properties
+bool SameLayout(AVPixelFormat a, AVPixelFormat b) {
+  const auto layout = [](AVPixelFormat format) {
+    if (format == AV_PIX_FMT_YUVJ422P) {
+      return AV_PIX_FMT_YUV422P;
+    }
+    if (format == AV_PIX_FMT_YUVJ420P) {
+      return AV_PIX_FMT_YUV420P;
+    }
+    return format;
+  };
+  return layout(a) == layout(b);
+}
+
+ConvertFunction FindConversion(AVPixelFormat in, AVPixelFormat out) {
+  if (SameLayout(in, AV_PIX_FMT_YUV422P) and SameLayout(out, AV_PIX_FMT_YUV420P)) {
+    return ConvertYuv422pToYuv420p;
+  }
+  if (SameLayout(in, AV_PIX_FMT_YUV422P) and out == AV_PIX_FMT_NV12) {
+    return ConvertYuv422pToNv12;
+  }
+  if (SameLayout(in, AV_PIX_FMT_YUV420P) and out == AV_PIX_FMT_NV12) {
+    return ConvertYuv420pToNv12;
+  }
+  return nullptr;
+}
+
+}  // namespace codec
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+
+namespace codec {
+
+using ConvertFunction = void (*)(
+    const std::uint8_t* const[], const int[], std::uint8_t* const[], const int[], int, int);
+
+void ConvertYuv422pToYuv420p(const std::uint8_t* const[], const int[], std::uint8_t* const[], const int[], int, int);
+void ConvertYuv422pToNv12(const std::uint8_t* const[], const int[], std::uint8_t* const[], const int[], int, int);
+void ConvertYuv420pToNv12(const std::uint8_t* const[], const int[], std::uint8_t* const[], const int[], int, int);
+bool SameLayout(AVPixelFormat, AVPixelFormat);
+ConvertFunction FindConversion(AVPixelFormat, AVPixelFormat);
+
+}  // namespace codec
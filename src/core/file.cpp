@@ -1,8 +1,19 @@
 #include "file.hpp"
 #include <fcntl.h>
+#include <spdlog/spdlog.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <utility>
+
+namespace {
+
+constexpr size_t pageSize = 4096;
+
+}  // namespace
 
 namespace os {
 
@@ -13,6 +24,7 @@ File::File(std::string_view filename) {
     struct stat statbuf;
     fstat(fd, &statbuf);
     size = statbuf.st_size;
+    modifiedTime = statbuf.st_mtime;
   }
 }
 
@@ -29,8 +41,10 @@ File::File(File&& f) {
 File& File::operator=(File&& f) {
   fd = f.fd;
   size = f.size;
+  modifiedTime = f.modifiedTime;
   f.fd = -1;
   f.size = 0;
+  f.modifiedTime = 0;
   return *this;
 }
 
@@ -42,8 +56,208 @@ size_t File::Size() const {
   return size;
 }
 
+std::string File::Read(size_t offset, size_t length) const {
+  std::string data(length, '\0');
+  size_t done = 0;
+  while (done < length) {
+    const auto n = pread(fd, data.data() + done, length - done, offset + done);
+    if (n <= 0) {
+      if (n < 0) {
+        spdlog::error("file pread(): {}", strerror(errno));
+      }
+      break;
+    }
+    done += n;
+  }
+  data.resize(done);
+  return data;
+}
+
+std::time_t File::ModifiedTime() const {
+  return modifiedTime;
+}
+
 bool File::Ok() const {
   return fd >= 0;
 }
 
+AsyncFile::AsyncFile(std::string_view filename, const AsyncFileOptions& options) : options{options} {
+  const std::string s{filename};
+  fd = open(s.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (not Ok()) {
+    spdlog::error("file open({}): {}", s, strerror(errno));
+    return;
+  }
+  writerThread = std::thread([this] { RunWriter(); });
+}
+
+AsyncFile::~AsyncFile() {
+  Close();
+  if (writerThread.joinable()) {
+    writerThread.join();
+  }
+  for (auto* buffer : freeBuffers) {
+    std::free(buffer);
+  }
+}
+
+// data lands in the current buffer, a full buffer or a seek away from its end hands it to the writer thread
+void AsyncFile::Write(std::string_view data) {
+  if (not Ok() or closed) {
+    return;
+  }
+  while (not data.empty()) {
+    if (current and (current->offset + static_cast<std::int64_t>(current->size) != position or
+                        current->size == options.bufferSize)) {
+      Submit();
+    }
+    if (not current) {
+      std::unique_lock lock{pendingMut};
+      if (freeBuffers.empty() and allocatedBuffers >= options.maxBuffers) {
+        spdlog::warn("file write buffers exhausted, waiting for storage");
+        freeCv.wait(lock, [this] { return not freeBuffers.empty(); });
+      }
+      std::uint8_t* buffer;
+      if (freeBuffers.empty()) {
+        const size_t allocation = (options.bufferSize + pageSize - 1) & ~(pageSize - 1);
+        buffer = static_cast<std::uint8_t*>(std::aligned_alloc(pageSize, allocation));
+        if (buffer == nullptr) {
+          spdlog::error("file aligned_alloc()");
+          return;
+        }
+        allocatedBuffers++;
+      } else {
+        buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+      }
+      current = Chunk{buffer, 0, position};
+    }
+    const size_t n = std::min(data.size(), options.bufferSize - current->size);
+    std::memcpy(current->data + current->size, data.data(), n);
+    current->size += n;
+    position += n;
+    size = std::max(size, position);
+    data.remove_prefix(n);
+  }
+}
+
+void AsyncFile::Seek(std::int64_t offset) {
+  position = offset;
+}
+
+// done runs on the writer thread once everything written before it is on disk
+void AsyncFile::Flush(std::function<void()> done) {
+  Submit();
+  if (not done) {
+    return;
+  }
+  if (not writerThread.joinable() or closed) {
+    done();
+    return;
+  }
+  {
+    std::lock_guard lock{pendingMut};
+    pending.emplace_back(Operation{std::nullopt, std::move(done)});
+  }
+  pendingCv.notify_one();
+}
+
+std::int64_t AsyncFile::Position() const {
+  return position;
+}
+
+std::int64_t AsyncFile::Size() const {
+  return size;
+}
+
+// only queues the close, the writer thread finishes the pending writes and calls done once the file is truncated,
+// synced and closed. The destructor waits for it
+void AsyncFile::Close(std::function<void()> done) {
+  if (closed) {
+    return;
+  }
+  closed = true;
+  if (not writerThread.joinable()) {
+    if (done) {
+      done();
+    }
+    return;
+  }
+  Submit();
+  {
+    std::lock_guard lock{pendingMut};
+    pending.emplace_back(Operation{std::nullopt, std::move(done), true});
+  }
+  pendingCv.notify_one();
+}
+
+bool AsyncFile::Ok() const {
+  return fd >= 0;
+}
+
+void AsyncFile::Submit() {
+  if (not current) {
+    return;
+  }
+  {
+    std::lock_guard lock{pendingMut};
+    pending.emplace_back(Operation{std::exchange(current, std::nullopt), nullptr});
+  }
+  pendingCv.notify_one();
+}
+
+void AsyncFile::RunWriter() {
+  if (options.preallocateBytes > 0 and fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, options.preallocateBytes) < 0) {
+    spdlog::error("file fallocate(): {}", strerror(errno));
+  }
+  size_t unsynced = 0;
+  std::function<void()> closeDone;
+  while (true) {
+    std::unique_lock lock{pendingMut};
+    pendingCv.wait(lock, [this] { return not pending.empty(); });
+    auto [chunk, done, close] = std::move(pending.front());
+    pending.pop_front();
+    lock.unlock();
+    if (close) {
+      closeDone = std::move(done);
+      break;
+    }
+    if (not chunk) {
+      done();
+      continue;
+    }
+    size_t written = 0;
+    while (written < chunk->size) {
+      const auto r = pwrite(fd, chunk->data + written, chunk->size - written, chunk->offset + written);
+      if (r < 0) {
+        spdlog::error("file pwrite(): {}", strerror(errno));
+        break;
+      }
+      written += r;
+    }
+    unsynced += written;
+    if (options.syncBytes > 0 and unsynced >= options.syncBytes) {
+      if (fdatasync(fd) < 0) {
+        spdlog::error("file fdatasync(): {}", strerror(errno));
+      }
+      unsynced = 0;
+    }
+    lock.lock();
+    freeBuffers.emplace_back(chunk->data);
+    lock.unlock();
+    freeCv.notify_one();
+  }
+  // preallocation past the end is released again
+  if (ftruncate(fd, size) < 0) {
+    spdlog::error("file ftruncate(): {}", strerror(errno));
+  }
+  if (fdatasync(fd) < 0) {
+    spdlog::error("file fdatasync(): {}", strerror(errno));
+  }
+  close(fd);
+  if (closeDone) {
+    closeDone();
+  }
+}
+
 }  // namespace os
@@ -1,5 +1,15 @@
 #pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 namespace os {
 
@@ -14,11 +24,69 @@ public:
 
   int Fd() const;
   size_t Size() const;
+  std::string Read(size_t, size_t) const;
+  std::time_t ModifiedTime() const;
   bool Ok() const;
 
 private:
   int fd;
   size_t size;
+  std::time_t modifiedTime;
+};
+
+struct AsyncFileOptions {
+  size_t bufferSize{1024 * 1024};
+  int maxBuffers{8};
+  size_t preallocateBytes{0};
+  size_t syncBytes{0};
+};
+
+class AsyncFile {
+public:
+  AsyncFile(std::string_view, const AsyncFileOptions&);
+  ~AsyncFile();
+  AsyncFile(const AsyncFile&) = delete;
+  AsyncFile(AsyncFile&&) = delete;
+  AsyncFile& operator=(const AsyncFile&) = delete;
+  AsyncFile& operator=(AsyncFile&&) = delete;
+
+  void Write(std::string_view);
+  void Seek(std::int64_t);
+  void Flush(std::function<void()> = nullptr);
+  std::int64_t Position() const;
+  std::int64_t Size() const;
+  void Close(std::function<void()> = nullptr);
+  bool Ok() const;
+
+private:
+  struct Chunk {
+    std::uint8_t* data;
+    size_t size;
+    std::int64_t offset;
+  };
+
+  struct Operation {
+    std::optional<Chunk> chunk;
+    std::function<void()> done;
+    bool close{false};
+  };
+
+  void Submit();
+  void RunWriter();
+
+  const AsyncFileOptions options;
+  int fd;
+  std::int64_t position{0};
+  std::int64_t size{0};
+  std::optional<Chunk> current;
+  bool closed{false};
+  std::vector<std::uint8_t*> freeBuffers;
+  int allocatedBuffers{0};
+  std::deque<Operation> pending;
+  std::mutex pendingMut;
+  std::condition_variable pendingCv;
+  std::condition_variable freeCv;
+  std::thread writerThread;
 };
 
 }  // namespace os
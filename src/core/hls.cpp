@@ -0,0 +1,208 @@
+#include "hls.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+std::string FormatDuration(double duration) {
+  char buf[32];
+  std::snprintf(buf, sizeof buf, "%.3f", duration);
+  return buf;
+}
+
+std::string PartUri(std::uint64_t sequence, std::uint64_t part) {
+  return "part.m4s?msn=" + std::to_string(sequence) + "&part=" + std::to_string(part);
+}
+
+}  // namespace
+
+namespace network {
+
+HlsSegmentRing::HlsSegmentRing(size_t maxSegments, double partTarget)
+    : maxSegments{maxSegments}, partTarget{partTarget} {
+}
+
+void HlsSegmentRing::SetInitSegment(std::string buffer) {
+  std::lock_guard lock{segmentsMut};
+  initSegment = std::make_shared<const std::string>(std::move(buffer));
+}
+
+void HlsSegmentRing::AddPart(std::string buffer, double duration, bool independent) {
+  {
+    std::lock_guard lock{segmentsMut};
+    if (segments.empty() or (independent and not segments.back().parts.empty())) {
+      if (not segments.empty()) {
+        segments.back().complete = true;
+      }
+      segments.emplace_back(HlsSegment{nextSequence++, {}});
+      while (segments.size() > maxSegments) {
+        segments.pop_front();
+      }
+    }
+    auto& segment = segments.back();
+    segment.parts.emplace_back(HlsPart{std::make_shared<const std::string>(std::move(buffer)), duration, independent});
+    segment.duration += duration;
+  }
+  NotifyWaiters();
+}
+
+std::shared_ptr<const std::string> HlsSegmentRing::InitSegment() const {
+  std::lock_guard lock{segmentsMut};
+  return initSegment;
+}
+
+std::vector<std::shared_ptr<const std::string>> HlsSegmentRing::Segment(std::uint64_t sequence) const {
+  std::lock_guard lock{segmentsMut};
+  std::vector<std::shared_ptr<const std::string>> result;
+  const auto* segment = Find(sequence);
+  if (segment == nullptr or not segment->complete) {
+    return result;
+  }
+  for (const auto& part : segment->parts) {
+    result.emplace_back(part.data);
+  }
+  return result;
+}
+
+std::shared_ptr<const std::string> HlsSegmentRing::Part(std::uint64_t sequence, std::uint64_t part) const {
+  std::lock_guard lock{segmentsMut};
+  const auto* segment = Find(sequence);
+  if (segment == nullptr or part >= segment->parts.size()) {
+    return nullptr;
+  }
+  return segment->parts[part].data;
+}
+
+std::string HlsSegmentRing::Playlist() const {
+  std::lock_guard lock{segmentsMut};
+  std::string playlist = "#EXTM3U\n#EXT-X-VERSION:9\n";
+  playlist += "#EXT-X-TARGETDURATION:" + std::to_string(static_cast<int>(TargetDuration())) + "\n";
+  playlist += "#EXT-X-PART-INF:PART-TARGET=" + FormatDuration(partTarget) + "\n";
+  playlist += "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" + FormatDuration(partTarget * 3) + "\n";
+  if (segments.empty()) {
+    return playlist;
+  }
+  playlist += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(segments.front().sequence) + "\n";
+  playlist += "#EXT-X-MAP:URI=\"init.mp4\"\n";
+  for (size_t i = 0; i < segments.size(); i++) {
+    const auto& segment = segments[i];
+    if (i + partListSegments >= segments.size()) {
+      for (size_t j = 0; j < segment.parts.size(); j++) {
+        const auto& part = segment.parts[j];
+        playlist += "#EXT-X-PART:DURATION=" + FormatDuration(part.duration) + ",URI=\"" +
+                    PartUri(segment.sequence, j) + "\"" + (part.independent ? ",INDEPENDENT=YES" : "") + "\n";
+      }
+    }
+    if (segment.complete) {
+      playlist += "#EXTINF:" + FormatDuration(segment.duration) + ",\n";
+      playlist += "segment.m4s?msn=" + std::to_string(segment.sequence) + "\n";
+    }
+  }
+  const auto& current = segments.back();
+  playlist += "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"" + PartUri(current.sequence, current.parts.size()) + "\"\n";
+  return playlist;
+}
+
+bool HlsSegmentRing::Reachable(std::uint64_t sequence) const {
+  std::lock_guard lock{segmentsMut};
+  const std::uint64_t current = segments.empty() ? nextSequence : segments.back().sequence;
+  return sequence <= current + 2;
+}
+
+// a blocked reload gives up after three target durations, the callback is told whether the request became ready
+std::optional<std::uint64_t> HlsSegmentRing::Wait(
+    std::uint64_t sequence, std::optional<std::uint64_t> part, std::function<void(bool)> callback) {
+  std::lock_guard waitersLock{waitersMut};
+  std::chrono::steady_clock::time_point deadline;
+  {
+    std::lock_guard lock{segmentsMut};
+    if (Ready(sequence, part)) {
+      return std::nullopt;
+    }
+    deadline = std::chrono::steady_clock::now() +
+               std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                   std::chrono::duration<double>(3 * TargetDuration()));
+  }
+  const auto id = nextWaiterId++;
+  waiters.emplace(id, Waiter{sequence, part, std::move(callback), deadline});
+  return id;
+}
+
+void HlsSegmentRing::Cancel(std::uint64_t id) {
+  std::lock_guard lock{waitersMut};
+  waiters.erase(id);
+}
+
+void HlsSegmentRing::ExpireWaiters(std::chrono::steady_clock::time_point now) {
+  std::lock_guard lock{waitersMut};
+  for (auto it = waiters.begin(); it != waiters.end();) {
+    if (it->second.deadline > now) {
+      ++it;
+      continue;
+    }
+    it->second.callback(false);
+    it = waiters.erase(it);
+  }
+}
+
+// drops the segments of a stopped encode, sequence numbers carry on so a restarted one never reuses them
+void HlsSegmentRing::Clear() {
+  {
+    std::lock_guard lock{segmentsMut};
+    segments.clear();
+    initSegment.reset();
+  }
+  std::lock_guard lock{waitersMut};
+  for (auto& [_, waiter] : waiters) {
+    waiter.callback(false);
+  }
+  waiters.clear();
+}
+
+bool HlsSegmentRing::Ready(std::uint64_t sequence, std::optional<std::uint64_t> part) const {
+  if (segments.empty()) {
+    return false;
+  }
+  const auto& current = segments.back();
+  if (sequence != current.sequence) {
+    return sequence < current.sequence;
+  }
+  return part and *part < current.parts.size();
+}
+
+double HlsSegmentRing::TargetDuration() const {
+  double maxDuration = 1;
+  for (const auto& segment : segments) {
+    if (segment.complete) {
+      maxDuration = std::max(maxDuration, segment.duration);
+    }
+  }
+  return std::ceil(maxDuration);
+}
+
+const HlsSegment* HlsSegmentRing::Find(std::uint64_t sequence) const {
+  if (segments.empty() or sequence < segments.front().sequence or sequence > segments.back().sequence) {
+    return nullptr;
+  }
+  return &segments[sequence - segments.front().sequence];
+}
+
+void HlsSegmentRing::NotifyWaiters() {
+  std::lock_guard waitersLock{waitersMut};
+  for (auto it = waiters.begin(); it != waiters.end();) {
+    bool ready;
+    {
+      std::lock_guard lock{segmentsMut};
+      ready = Ready(it->second.sequence, it->second.part);
+    }
+    if (not ready) {
+      ++it;
+      continue;
+    }
+    it->second.callback(true);
+    it = waiters.erase(it);
+  }
+}
+
+}  // namespace network
@@ -0,0 +1,75 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace network {
+
+struct HlsPart {
+  std::shared_ptr<const std::string> data;
+  double duration;
+  bool independent;
+};
+
+struct HlsSegment {
+  std::uint64_t sequence;
+  std::vector<HlsPart> parts;
+  double duration{0};
+  bool complete{false};
+};
+
+class HlsSegmentRing {
+public:
+  HlsSegmentRing(size_t, double);
+  HlsSegmentRing(const HlsSegmentRing&) = delete;
+  HlsSegmentRing(HlsSegmentRing&&) = delete;
+  HlsSegmentRing& operator=(const HlsSegmentRing&) = delete;
+  HlsSegmentRing& operator=(HlsSegmentRing&&) = delete;
+  ~HlsSegmentRing() = default;
+
+  void SetInitSegment(std::string);
+  void AddPart(std::string, double, bool);
+  std::shared_ptr<const std::string> InitSegment() const;
+  std::vector<std::shared_ptr<const std::string>> Segment(std::uint64_t) const;
+  std::shared_ptr<const std::string> Part(std::uint64_t, std::uint64_t) const;
+  std::string Playlist() const;
+  bool Reachable(std::uint64_t) const;
+  std::optional<std::uint64_t> Wait(std::uint64_t, std::optional<std::uint64_t>, std::function<void(bool)>);
+  void Cancel(std::uint64_t);
+  void ExpireWaiters(std::chrono::steady_clock::time_point);
+  void Clear();
+
+  static constexpr size_t partListSegments = 3;
+
+private:
+  struct Waiter {
+    std::uint64_t sequence;
+    std::optional<std::uint64_t> part;
+    std::function<void(bool)> callback;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  bool Ready(std::uint64_t, std::optional<std::uint64_t>) const;
+  double TargetDuration() const;
+  const HlsSegment* Find(std::uint64_t) const;
+  void NotifyWaiters();
+
+  size_t maxSegments;
+  double partTarget;
+  std::shared_ptr<const std::string> initSegment;
+  std::deque<HlsSegment> segments;
+  std::uint64_t nextSequence{0};
+  mutable std::mutex segmentsMut;
+  std::map<std::uint64_t, Waiter> waiters;
+  std::uint64_t nextWaiterId{0};
+  std::mutex waitersMut;
+};
+
+}  // namespace network
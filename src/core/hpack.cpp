@@ -0,0 +1,367 @@
+#include "hpack.hpp"
+#include <array>
+
+namespace {
+
+struct HpackStaticEntry {
+  std::string_view field;
+  std::string_view value;
+};
+
+constexpr std::array<HpackStaticEntry, 61> staticTable{{
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+}};
+
+struct HuffmanCode {
+  std::uint32_t code;
+  std::uint8_t length;
+};
+
+constexpr HuffmanCode huffmanCodes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28},
+    {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28}, {0xfffffea, 28},
+    {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28},
+    {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28}, {0xffffff4, 28},
+    {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28},
+    {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6}, {0xf8, 8},
+    {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6},
+    {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6}, {0x5d, 7},
+    {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7}, {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7},
+    {0x68, 7}, {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7}, {0x6f, 7}, {0x70, 7}, {0x71, 7},
+    {0x72, 7}, {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5},
+    {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7}, {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11},
+    {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23},
+    {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23}, {0xffffec, 24}, {0xffffed, 24},
+    {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23},
+    {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23},
+    {0x1fffde, 21}, {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23},
+    {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23}, {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20},
+    {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26},
+    {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26},
+    {0x7ffffe2, 27}, {0xfffff2, 24}, {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20},
+    {0x1fffe6, 21}, {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},
+};
+
+struct HuffmanNode {
+  std::int16_t children[2]{-1, -1};
+  std::int16_t symbol{-1};
+};
+
+const std::vector<HuffmanNode>& HuffmanTree() {
+  static const std::vector<HuffmanNode> tree = [] {
+    std::vector<HuffmanNode> nodes(1);
+    for (std::int16_t symbol = 0; symbol < 257; symbol++) {
+      const auto [code, length] = huffmanCodes[symbol];
+      size_t node = 0;
+      for (int i = length - 1; i >= 0; i--) {
+        const int bit = (code >> i) & 0b1;
+        if (nodes[node].children[bit] < 0) {
+          nodes[node].children[bit] = static_cast<std::int16_t>(nodes.size());
+          nodes.emplace_back();
+        }
+        node = nodes[node].children[bit];
+      }
+      nodes[node].symbol = symbol;
+    }
+    return nodes;
+  }();
+  return tree;
+}
+
+std::optional<std::string> DecodeHuffman(std::string_view in) {
+  constexpr std::int16_t eos = 256;
+  const auto& tree = HuffmanTree();
+  std::string out;
+  size_t node = 0;
+  int paddingBits = 0;
+  bool paddingOnes = true;
+  for (const char c : in) {
+    const auto byte = static_cast<std::uint8_t>(c);
+    for (int i = 7; i >= 0; i--) {
+      const int bit = (byte >> i) & 0b1;
+      const auto next = tree[node].children[bit];
+      if (next < 0) {
+        return std::nullopt;
+      }
+      node = next;
+      const auto symbol = tree[node].symbol;
+      if (symbol == eos) {
+        return std::nullopt;
+      }
+      if (symbol >= 0) {
+        out += static_cast<char>(symbol);
+        node = 0;
+        paddingBits = 0;
+        paddingOnes = true;
+        continue;
+      }
+      paddingBits++;
+      paddingOnes = paddingOnes and bit == 1;
+    }
+  }
+  if (paddingBits > 7 or not paddingOnes) {
+    return std::nullopt;
+  }
+  return out;
+}
+
+std::optional<std::uint64_t> DecodeInteger(std::string_view& in, int prefixBits) {
+  if (in.empty()) {
+    return std::nullopt;
+  }
+  const std::uint64_t maxPrefix = (1 << prefixBits) - 1;
+  std::uint64_t value = static_cast<std::uint8_t>(in.front()) & maxPrefix;
+  in.remove_prefix(1);
+  if (value < maxPrefix) {
+    return value;
+  }
+  for (int shift = 0;; shift += 7) {
+    if (in.empty() or shift > 56) {
+      return std::nullopt;
+    }
+    const auto byte = static_cast<std::uint8_t>(in.front());
+    in.remove_prefix(1);
+    value += static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+}
+
+std::optional<std::string> DecodeString(std::string_view& in) {
+  if (in.empty()) {
+    return std::nullopt;
+  }
+  const bool huffman = static_cast<std::uint8_t>(in.front()) & 0x80;
+  const auto length = DecodeInteger(in, 7);
+  if (not length or *length > in.size()) {
+    return std::nullopt;
+  }
+  const auto raw = in.substr(0, *length);
+  in.remove_prefix(*length);
+  if (huffman) {
+    return DecodeHuffman(raw);
+  }
+  return std::string{raw};
+}
+
+void EncodeInteger(std::string& out, std::uint8_t flags, int prefixBits, std::uint64_t value) {
+  const std::uint64_t maxPrefix = (1 << prefixBits) - 1;
+  if (value < maxPrefix) {
+    out += static_cast<char>(flags | value);
+    return;
+  }
+  out += static_cast<char>(flags | maxPrefix);
+  value -= maxPrefix;
+  while (value >= 0x80) {
+    out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+void EncodeString(std::string& out, std::string_view s) {
+  EncodeInteger(out, 0x00, 7, s.size());
+  out += s;
+}
+
+size_t EntrySize(const network::HttpHeader& header) {
+  constexpr size_t entryOverhead = 32;
+  return header.field.size() + header.value.size() + entryOverhead;
+}
+
+}  // namespace
+
+namespace network {
+
+HpackDecoder::HpackDecoder(size_t maxTableSize) : maxTableSize{maxTableSize}, tableSizeLimit{maxTableSize} {
+}
+
+std::optional<HpackHeaderList> HpackDecoder::Decode(std::string_view in) {
+  HpackHeaderList headers;
+  while (not in.empty()) {
+    const auto prefix = static_cast<std::uint8_t>(in.front());
+    if (prefix & 0x80) {
+      const auto index = DecodeInteger(in, 7);
+      if (not index) {
+        return std::nullopt;
+      }
+      auto header = Lookup(*index);
+      if (not header) {
+        return std::nullopt;
+      }
+      headers.emplace_back(std::move(*header));
+      continue;
+    }
+    if ((prefix & 0xe0) == 0x20) {
+      const auto size = DecodeInteger(in, 5);
+      if (not size or *size > maxTableSize) {
+        return std::nullopt;
+      }
+      tableSizeLimit = *size;
+      Evict();
+      continue;
+    }
+    const bool indexing = prefix & 0x40;
+    const auto index = DecodeInteger(in, indexing ? 6 : 4);
+    if (not index) {
+      return std::nullopt;
+    }
+    HttpHeader header;
+    if (*index > 0) {
+      auto indexed = Lookup(*index);
+      if (not indexed) {
+        return std::nullopt;
+      }
+      header.field = std::move(indexed->field);
+    } else {
+      auto field = DecodeString(in);
+      if (not field) {
+        return std::nullopt;
+      }
+      header.field = std::move(*field);
+    }
+    auto value = DecodeString(in);
+    if (not value) {
+      return std::nullopt;
+    }
+    header.value = std::move(*value);
+    if (indexing) {
+      Insert(header);
+    }
+    headers.emplace_back(std::move(header));
+  }
+  return headers;
+}
+
+std::optional<HttpHeader> HpackDecoder::Lookup(std::uint64_t index) const {
+  if (index == 0) {
+    return std::nullopt;
+  }
+  if (index <= staticTable.size()) {
+    const auto& entry = staticTable[index - 1];
+    return HttpHeader{std::string{entry.field}, std::string{entry.value}};
+  }
+  index -= staticTable.size() + 1;
+  if (index >= dynamicTable.size()) {
+    return std::nullopt;
+  }
+  return dynamicTable[index];
+}
+
+void HpackDecoder::Insert(HttpHeader header) {
+  tableSize += EntrySize(header);
+  dynamicTable.emplace_front(std::move(header));
+  Evict();
+}
+
+void HpackDecoder::Evict() {
+  while (tableSize > tableSizeLimit and not dynamicTable.empty()) {
+    tableSize -= EntrySize(dynamicTable.back());
+    dynamicTable.pop_back();
+  }
+}
+
+std::string HpackEncoder::Encode(const HpackHeaderList& headers) const {
+  std::string out;
+  for (const auto& [field, value] : headers) {
+    size_t fieldIndex = 0;
+    size_t exactIndex = 0;
+    for (size_t i = 0; i < staticTable.size() and exactIndex == 0; i++) {
+      if (staticTable[i].field != field) {
+        continue;
+      }
+      if (fieldIndex == 0) {
+        fieldIndex = i + 1;
+      }
+      if (staticTable[i].value == value) {
+        exactIndex = i + 1;
+      }
+    }
+    if (exactIndex > 0) {
+      EncodeInteger(out, 0x80, 7, exactIndex);
+      continue;
+    }
+    EncodeInteger(out, 0x00, 4, fieldIndex);
+    if (fieldIndex == 0) {
+      EncodeString(out, field);
+    }
+    EncodeString(out, value);
+  }
+  return out;
+}
+
+}  // namespace network
@@ -0,0 +1,47 @@
+#pragma once
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "network.hpp"
+
+namespace network {
+
+using HpackHeaderList = std::vector<HttpHeader>;
+
+class HpackDecoder {
+public:
+  explicit HpackDecoder(size_t);
+  HpackDecoder(const HpackDecoder&) = delete;
+  HpackDecoder(HpackDecoder&&) = delete;
+  HpackDecoder& operator=(const HpackDecoder&) = delete;
+  HpackDecoder& operator=(HpackDecoder&&) = delete;
+  ~HpackDecoder() = default;
+
+  std::optional<HpackHeaderList> Decode(std::string_view);
+
+private:
+  std::optional<HttpHeader> Lookup(std::uint64_t) const;
+  void Insert(HttpHeader);
+  void Evict();
+
+  size_t maxTableSize;
+  size_t tableSize{0};
+  size_t tableSizeLimit;
+  std::deque<HttpHeader> dynamicTable;
+};
+
+class HpackEncoder {
+public:
+  HpackEncoder() = default;
+  HpackEncoder(const HpackEncoder&) = delete;
+  HpackEncoder(HpackEncoder&&) = delete;
+  HpackEncoder& operator=(const HpackEncoder&) = delete;
+  HpackEncoder& operator=(HpackEncoder&&) = delete;
+  ~HpackEncoder() = default;
+
+  std::string Encode(const HpackHeaderList&) const;
+};
+
+}  // namespace network
@@ -1,6 +1,7 @@
 #include "http.hpp"
 #include <spdlog/spdlog.h>
 #include <cctype>
+#include <charconv>
 #include <sstream>
 #include "common.hpp"
 #include "file.hpp"
@@ -8,53 +9,153 @@
 
 namespace {
 
-std::string ToString(network::HttpStatus status) {
+std::string_view TrimWhiteSpaces(std::string_view s) {
+  const auto begin = s.find_first_not_of(' ');
+  if (begin == s.npos) {
+    return {};
+  }
+  const auto end = s.find_last_not_of(' ');
+  return s.substr(begin, end - begin + 1);
+}
+
+std::optional<size_t> ParseBytePosition(std::string_view s) {
+  size_t n;
+  const auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), n);
+  if (ec != std::errc{} or p != s.data() + s.size()) {
+    return std::nullopt;
+  }
+  return n;
+}
+
+std::string BuildResponseHeader(network::HttpStatus status, const network::HttpHeaders& headers) {
+  std::string respPayload = "HTTP/1.1 " + network::ToString(status) + "\r\n";
+  for (const auto& [k, v] : headers) {
+    respPayload += k + ": " + v + "\r\n";
+  }
+  respPayload += "\r\n";
+  return respPayload;
+}
+
+}  // namespace
+
+namespace network {
+
+std::string ToString(HttpStatus status) {
   switch (status) {
-    case network::HttpStatus::SwitchingProtocols:
+    case HttpStatus::SwitchingProtocols:
       return "101 Switching Protocols";
-    case network::HttpStatus::OK:
+    case HttpStatus::OK:
       return "200 OK";
-    case network::HttpStatus::BadRequest:
+    case HttpStatus::PartialContent:
+      return "206 Partial Content";
+    case HttpStatus::NotModified:
+      return "304 Not Modified";
+    case HttpStatus::BadRequest:
       return "400 Bad Request";
-    case network::HttpStatus::NotFound:
+    case HttpStatus::NotFound:
       return "404 Not Found";
+    case HttpStatus::RangeNotSatisfiable:
+      return "416 Range Not Satisfiable";
+    case HttpStatus::ServiceUnavailable:
+      return "503 Service Unavailable";
   }
   return "";
 }
 
-std::string ToString(network::HttpMethod method) {
+std::string ToString(HttpMethod method) {
   switch (method) {
-    case network::HttpMethod::GET:
+    case HttpMethod::GET:
       return "GET";
-    case network::HttpMethod::PUT:
+    case HttpMethod::PUT:
       return "PUT";
-    case network::HttpMethod::POST:
+    case HttpMethod::POST:
       return "POST";
-    case network::HttpMethod::DELETE:
+    case HttpMethod::DELETE:
       return "DELETE";
+    case HttpMethod::PRI:
+      return "PRI";
   }
   return "";
 }
 
-std::optional<network::HttpMethod> ConvertMethod(std::string_view method) {
+std::optional<HttpMethod> ConvertMethod(std::string_view method) {
   if (method == "get") {
-    return network::HttpMethod::GET;
+    return HttpMethod::GET;
   }
   if (method == "put") {
-    return network::HttpMethod::PUT;
+    return HttpMethod::PUT;
   }
   if (method == "post") {
-    return network::HttpMethod::POST;
+    return HttpMethod::POST;
   }
   if (method == "delete") {
-    return network::HttpMethod::DELETE;
+    return HttpMethod::DELETE;
+  }
+  if (method == "pri") {
+    return HttpMethod::PRI;
   }
   return std::nullopt;
 }
 
-}  // namespace
+std::string ContentRange(const HttpByteRange& range, size_t size) {
+  return "bytes " + std::to_string(range.offset) + "-" + std::to_string(range.offset + range.length - 1) + "/" +
+         std::to_string(size);
+}
 
-namespace network {
+std::string FileEntityTag(const os::File& file) {
+  char buf[64];
+  std::snprintf(buf, sizeof buf, "\"%llx-%zx\"", static_cast<unsigned long long>(file.ModifiedTime()), file.Size());
+  return buf;
+}
+
+std::optional<std::vector<HttpByteRange>> ParseByteRanges(std::string_view value, size_t size) {
+  constexpr size_t maxRanges = 16;
+  constexpr std::string_view unit = "bytes=";
+  value = TrimWhiteSpaces(value);
+  if (not value.starts_with(unit)) {
+    return std::nullopt;
+  }
+  value.remove_prefix(unit.size());
+  std::vector<HttpByteRange> ranges;
+  for (size_t count = 0;; count++) {
+    if (count >= maxRanges) {
+      return std::nullopt;
+    }
+    const auto n = value.find(',');
+    const auto spec = TrimWhiteSpaces(value.substr(0, n));
+    const auto dash = spec.find('-');
+    if (dash == spec.npos) {
+      return std::nullopt;
+    }
+    const auto first = spec.substr(0, dash);
+    const auto last = spec.substr(dash + 1);
+    if (first.empty()) {
+      const auto suffix = ParseBytePosition(last);
+      if (not suffix) {
+        return std::nullopt;
+      }
+      if (*suffix > 0 and size > 0) {
+        const auto length = std::min(*suffix, size);
+        ranges.emplace_back(HttpByteRange{size - length, length});
+      }
+    } else {
+      const auto start = ParseBytePosition(first);
+      const auto end = last.empty() ? std::make_optional(size - 1) : ParseBytePosition(last);
+      if (not start or not end or (not last.empty() and *end < *start)) {
+        return std::nullopt;
+      }
+      if (*start < size) {
+        const auto clamped = std::min(*end, size - 1);
+        ranges.emplace_back(HttpByteRange{*start, clamped - *start + 1});
+      }
+    }
+    if (n == value.npos) {
+      break;
+    }
+    value.remove_prefix(n + 1);
+  }
+  return ranges;
+}
 
 std::optional<HttpRequest> ConcreteHttpParser::Parse(std::string& payload_) const {
   std::string payload = payload_;
@@ -238,7 +339,9 @@ ConcreteHttpSender::ConcreteHttpSender(TcpSender& sender) : sender{sender} {
 
 void ConcreteHttpSender::Send(HttpResponse&& response) const {
   std::string respPayload = "HTTP/1.1 " + ToString(response.status) + "\r\n";
-  response.headers.emplace("Content-Length", std::to_string(response.body.length()));
+  if (response.status != HttpStatus::NotModified) {
+    response.headers.emplace("Content-Length", std::to_string(response.body.length()));
+  }
   for (const auto& [k, v] : response.headers) {
     respPayload += k + ": " + v + "\r\n";
   }
@@ -247,6 +350,18 @@ void ConcreteHttpSender::Send(HttpResponse&& response) const {
   sender.Send(std::move(respPayload));
 }
 
+void ConcreteHttpSender::Send(SharedHttpResponse&& response) const {
+  size_t size = 0;
+  for (const auto& buf : response.body) {
+    size += buf->size();
+  }
+  response.headers.emplace("Content-Length", std::to_string(size));
+  sender.Send(BuildResponseHeader(response.status, response.headers));
+  for (auto& buf : response.body) {
+    sender.Send(std::move(buf));
+  }
+}
+
 void ConcreteHttpSender::Send(FileHttpResponse&& response) const {
   os::File file{response.path};
   if (not file.Ok()) {
@@ -255,14 +370,79 @@ void ConcreteHttpSender::Send(FileHttpResponse&& response) const {
     resp.status = HttpStatus::NotFound;
     return Send(std::move(resp));
   }
-  std::string respPayload = "HTTP/1.1 " + ToString(HttpStatus::OK) + "\r\n";
-  response.headers.emplace("Content-Length", std::to_string(file.Size()));
-  for (const auto& [k, v] : response.headers) {
-    respPayload += k + ": " + v + "\r\n";
+  if (not response.parts.empty()) {
+    size_t length = 0;
+    for (const auto& part : response.parts) {
+      length += part.length;
+    }
+    response.headers.emplace("Content-Length", std::to_string(length));
+    sender.Send(BuildResponseHeader(HttpStatus::OK, response.headers));
+    const auto shared = std::make_shared<const os::File>(std::move(file));
+    for (const auto& part : response.parts) {
+      sender.Send(shared, part.offset, part.length);
+    }
+    return;
   }
-  respPayload += "\r\n";
-  sender.Send(std::move(respPayload));
-  sender.Send(std::move(file));
+  const size_t size = file.Size();
+  const auto etag = FileEntityTag(file);
+  const auto lastModified = common::FormatHttpDate(file.ModifiedTime());
+  response.headers.emplace("Accept-Ranges", "bytes");
+  response.headers.emplace("ETag", etag);
+  response.headers.emplace("Last-Modified", lastModified);
+  std::optional<std::vector<HttpByteRange>> ranges;
+  if (not response.range.empty() and
+      (response.ifRange.empty() or response.ifRange == etag or response.ifRange == lastModified)) {
+    ranges = ParseByteRanges(response.range, size);
+  }
+  if (not ranges) {
+    response.headers.emplace("Content-Length", std::to_string(size));
+    sender.Send(BuildResponseHeader(HttpStatus::OK, response.headers));
+    sender.Send(std::move(file));
+    return;
+  }
+  if (ranges->empty()) {
+    HttpResponse resp;
+    resp.status = HttpStatus::RangeNotSatisfiable;
+    resp.headers.emplace("Content-Range", "bytes */" + std::to_string(size));
+    return Send(std::move(resp));
+  }
+  if (ranges->size() == 1) {
+    const auto& range = ranges->front();
+    response.headers.emplace("Content-Range", ContentRange(range, size));
+    response.headers.emplace("Content-Length", std::to_string(range.length));
+    sender.Send(BuildResponseHeader(HttpStatus::PartialContent, response.headers));
+    sender.Send(std::make_shared<const os::File>(std::move(file)), range.offset, range.length);
+    return;
+  }
+  constexpr std::string_view boundary = "BYTERANGES";
+  std::string contentType = "application/octet-stream";
+  if (auto it = response.headers.find("Content-Type"); it != response.headers.end()) {
+    contentType = std::move(it->second);
+    response.headers.erase(it);
+  }
+  std::vector<std::string> partHeaders;
+  size_t contentLength = 0;
+  for (const auto& range : *ranges) {
+    std::string partHeader = "\r\n--";
+    partHeader += boundary;
+    partHeader += "\r\nContent-Type: " + contentType + "\r\nContent-Range: " + ContentRange(range, size) + "\r\n\r\n";
+    contentLength += partHeader.size() + range.length;
+    partHeaders.emplace_back(std::move(partHeader));
+  }
+  std::string trailer = "\r\n--";
+  trailer += boundary;
+  trailer += "--\r\n";
+  contentLength += trailer.size();
+  response.headers.emplace("Content-Type", "multipart/byteranges; boundary=" + std::string{boundary});
+  response.headers.emplace("Content-Length", std::to_string(contentLength));
+  sender.Send(BuildResponseHeader(HttpStatus::PartialContent, response.headers));
+  // every part is sent from the descriptor the lengths were computed from, the path may be rotated meanwhile
+  const auto shared = std::make_shared<const os::File>(std::move(file));
+  for (size_t i = 0; i < ranges->size(); i++) {
+    sender.Send(std::move(partHeaders[i]));
+    sender.Send(shared, (*ranges)[i].offset, (*ranges)[i].length);
+  }
+  sender.Send(std::move(trailer));
 }
 
 void ConcreteHttpSender::Send(MixedReplaceHeaderHttpResponse&&) const {
@@ -302,6 +482,10 @@ void ConcreteHttpSender::Send(ChunkedDataHttpResponse&& response) const {
   sender.Send(ss.str());
 }
 
+size_t ConcreteHttpSender::Buffered() const {
+  return sender.Buffered();
+}
+
 void ConcreteHttpSender::Close() const {
   sender.Close();
 }
@@ -1,9 +1,22 @@
 #pragma once
 #include <optional>
+#include <vector>
 #include "network.hpp"
 
 namespace network {
 
+std::string ToString(HttpStatus);
+
+std::string ToString(HttpMethod);
+
+std::optional<HttpMethod> ConvertMethod(std::string_view);
+
+std::optional<std::vector<HttpByteRange>> ParseByteRanges(std::string_view, size_t);
+
+std::string ContentRange(const HttpByteRange&, size_t);
+
+std::string FileEntityTag(const os::File&);
+
 class ConcreteHttpParser final : public HttpParser {
 public:
   ConcreteHttpParser() = default;
@@ -14,6 +27,8 @@ public:
   ~ConcreteHttpParser() override = default;
 
   std::optional<HttpRequest> Parse(std::string&) const override;
+  std::string ParseUriBase(std::string&) const;
+  HttpQuery ParseQueryString(std::string&) const;
 
 private:
   void Reset();
@@ -25,21 +40,21 @@ private:
   std::optional<std::string> ParseHeaderField(std::string&) const;
   std::optional<std::string> ParseLine(std::string&) const;
   size_t FindContentLength(const HttpHeaders&) const;
-  std::string ParseUriBase(std::string&) const;
   std::string ParseQueryKey(std::string&) const;
   std::string ParseQueryValue(std::string&) const;
-  HttpQuery ParseQueryString(std::string&) const;
 };
 
 class ConcreteHttpSender final : public HttpSender {
 public:
   explicit ConcreteHttpSender(TcpSender&);
   void Send(HttpResponse&&) const override;
+  void Send(SharedHttpResponse&&) const override;
   void Send(FileHttpResponse&&) const override;
   void Send(MixedReplaceHeaderHttpResponse&&) const override;
   void Send(MixedReplaceDataHttpResponse&&) const override;
   void Send(ChunkedHeaderHttpResponse&&) const override;
   void Send(ChunkedDataHttpResponse&&) const override;
+  size_t Buffered() const override;
   void Close() const override;
 
 private:
@@ -0,0 +1,860 @@
+#include "http2.hpp"
+#include <spdlog/spdlog.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "common.hpp"
+#include "file.hpp"
+
+namespace {
+
+constexpr std::string_view clientPrefaceTail = "SM\r\n\r\n";
+
+constexpr std::uint8_t frameData = 0x0;
+constexpr std::uint8_t frameHeaders = 0x1;
+constexpr std::uint8_t framePriority = 0x2;
+constexpr std::uint8_t frameRstStream = 0x3;
+constexpr std::uint8_t frameSettings = 0x4;
+constexpr std::uint8_t framePushPromise = 0x5;
+constexpr std::uint8_t framePing = 0x6;
+constexpr std::uint8_t frameGoAway = 0x7;
+constexpr std::uint8_t frameWindowUpdate = 0x8;
+constexpr std::uint8_t frameContinuation = 0x9;
+
+constexpr std::uint8_t flagEndStream = 0x1;
+constexpr std::uint8_t flagAck = 0x1;
+constexpr std::uint8_t flagEndHeaders = 0x4;
+constexpr std::uint8_t flagPadded = 0x8;
+constexpr std::uint8_t flagPriority = 0x20;
+
+constexpr std::uint32_t errorNone = 0x0;
+constexpr std::uint32_t errorProtocol = 0x1;
+constexpr std::uint32_t errorInternal = 0x2;
+constexpr std::uint32_t errorFlowControl = 0x3;
+constexpr std::uint32_t errorStreamClosed = 0x5;
+constexpr std::uint32_t errorFrameSize = 0x6;
+constexpr std::uint32_t errorRefusedStream = 0x7;
+constexpr std::uint32_t errorCancel = 0x8;
+constexpr std::uint32_t errorCompression = 0x9;
+constexpr std::uint32_t errorEnhanceYourCalm = 0xb;
+
+constexpr std::uint16_t settingsHeaderTableSize = 0x1;
+constexpr std::uint16_t settingsEnablePush = 0x2;
+constexpr std::uint16_t settingsMaxConcurrentStreams = 0x3;
+constexpr std::uint16_t settingsInitialWindowSize = 0x4;
+constexpr std::uint16_t settingsMaxFrameSize = 0x5;
+
+constexpr std::int64_t defaultWindowSize = 65535;
+constexpr std::int64_t maxWindowSize = 0x7fffffff;
+constexpr std::uint32_t maxPeerFrameSize = 0xffffff;
+constexpr std::uint32_t headerTableSize = 4096;
+constexpr std::uint32_t maxConcurrentStreams = 100;
+constexpr size_t maxHeaderBlockSize = 64 * 1024;
+constexpr size_t maxRequestBodySize = 1024 * 1024;
+constexpr size_t maxFileChunkSize = 256 * 1024;
+
+std::uint32_t ReadUint(std::string_view s, size_t offset, size_t n) {
+  std::uint32_t value = 0;
+  for (size_t i = 0; i < n; i++) {
+    value = (value << 8) | static_cast<std::uint8_t>(s[offset + i]);
+  }
+  return value;
+}
+
+void AppendUint(std::string& s, std::uint32_t value, size_t n) {
+  for (size_t i = n; i > 0; i--) {
+    s += common::ToChar((value >> ((i - 1) * 8)) & 0xff);
+  }
+}
+
+void AppendFrame(
+    std::string& out, std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, std::string_view payload) {
+  AppendUint(out, payload.size(), 3);
+  out += common::ToChar(type);
+  out += common::ToChar(flags);
+  AppendUint(out, streamId & 0x7fffffff, 4);
+  out += payload;
+}
+
+void AppendRstStream(std::string& out, std::uint32_t streamId, std::uint32_t errorCode) {
+  std::string payload;
+  AppendUint(payload, errorCode, 4);
+  AppendFrame(out, frameRstStream, 0, streamId, payload);
+}
+
+void AppendWindowUpdate(std::string& out, std::uint32_t streamId, std::uint32_t increment) {
+  std::string payload;
+  AppendUint(payload, increment, 4);
+  AppendFrame(out, frameWindowUpdate, 0, streamId, payload);
+}
+
+bool StripPadding(const network::Http2Frame& frame, std::string_view& payload) {
+  payload = frame.payload;
+  if (not(frame.flags & flagPadded)) {
+    return true;
+  }
+  if (payload.empty()) {
+    return false;
+  }
+  const size_t padLength = static_cast<std::uint8_t>(payload.front());
+  payload.remove_prefix(1);
+  if (padLength > payload.size()) {
+    return false;
+  }
+  payload.remove_suffix(padLength);
+  return true;
+}
+
+bool IsConnectionSpecific(std::string_view field) {
+  return field == "connection" or field == "keep-alive" or field == "proxy-connection" or
+         field == "transfer-encoding" or field == "upgrade";
+}
+
+}  // namespace
+
+namespace network {
+
+std::optional<Http2Frame> Http2FrameParser::Parse(std::string& payload) const {
+  if (payload.size() < frameHeaderLen) {
+    return std::nullopt;
+  }
+  Http2Frame frame;
+  frame.length = ReadUint(payload, 0, 3);
+  frame.type = payload[3];
+  frame.flags = payload[4];
+  frame.streamId = ReadUint(payload, 5, 4) & 0x7fffffff;
+  if (frame.length > maxFrameSize) {
+    payload.erase(0, frameHeaderLen);
+    return frame;
+  }
+  if (payload.size() < frameHeaderLen + frame.length) {
+    return std::nullopt;
+  }
+  frame.payload = payload.substr(frameHeaderLen, frame.length);
+  payload.erase(0, frameHeaderLen + frame.length);
+  return frame;
+}
+
+Http2StreamSender::Http2StreamSender(Http2Connection& connection, std::uint32_t streamId)
+    : connection{connection}, streamId{streamId} {
+}
+
+void Http2StreamSender::Send(HttpResponse&& response) const {
+  if (response.status != HttpStatus::NotModified) {
+    response.headers.emplace("Content-Length", std::to_string(response.body.length()));
+  }
+  if (response.body.empty()) {
+    connection.SendHeaders(streamId, response.status, response.headers, true);
+    return;
+  }
+  connection.SendHeaders(streamId, response.status, response.headers, false);
+  connection.SendData(streamId, response.body, true);
+}
+
+void Http2StreamSender::Send(SharedHttpResponse&& response) const {
+  size_t size = 0;
+  for (const auto& buf : response.body) {
+    size += buf->size();
+  }
+  response.headers.emplace("Content-Length", std::to_string(size));
+  if (size == 0) {
+    connection.SendHeaders(streamId, response.status, response.headers, true);
+    return;
+  }
+  connection.SendHeaders(streamId, response.status, response.headers, false);
+  for (size_t i = 0; i < response.body.size(); i++) {
+    connection.SendData(streamId, *response.body[i], i + 1 == response.body.size());
+  }
+}
+
+void Http2StreamSender::Send(FileHttpResponse&& response) const {
+  os::File file{response.path};
+  if (not file.Ok()) {
+    spdlog::error("http2 open(\"{}\"): {}", response.path, strerror(errno));
+    HttpResponse resp;
+    resp.status = HttpStatus::NotFound;
+    return Send(std::move(resp));
+  }
+  // a stream carries a single file span, the spans before the last one are small and go out as data
+  if (not response.parts.empty()) {
+    size_t length = 0;
+    for (const auto& part : response.parts) {
+      length += part.length;
+    }
+    response.headers.emplace("Content-Length", std::to_string(length));
+    connection.SendHeaders(streamId, HttpStatus::OK, response.headers, false);
+    for (size_t i = 0; i + 1 < response.parts.size(); i++) {
+      connection.SendData(streamId, file.Read(response.parts[i].offset, response.parts[i].length), false);
+    }
+    const auto& last = response.parts.back();
+    connection.SendFile(streamId, std::move(file), last.offset, last.length);
+    return;
+  }
+  const size_t size = file.Size();
+  const auto etag = FileEntityTag(file);
+  const auto lastModified = common::FormatHttpDate(file.ModifiedTime());
+  response.headers.emplace("Accept-Ranges", "bytes");
+  response.headers.emplace("ETag", etag);
+  response.headers.emplace("Last-Modified", lastModified);
+  std::optional<std::vector<HttpByteRange>> ranges;
+  if (not response.range.empty() and
+      (response.ifRange.empty() or response.ifRange == etag or response.ifRange == lastModified)) {
+    ranges = ParseByteRanges(response.range, size);
+  }
+  if (ranges and ranges->empty()) {
+    HttpResponse resp;
+    resp.status = HttpStatus::RangeNotSatisfiable;
+    resp.headers.emplace("Content-Range", "bytes */" + std::to_string(size));
+    return Send(std::move(resp));
+  }
+  if (ranges and ranges->size() == 1) {
+    const auto& range = ranges->front();
+    response.headers.emplace("Content-Range", ContentRange(range, size));
+    response.headers.emplace("Content-Length", std::to_string(range.length));
+    connection.SendHeaders(streamId, HttpStatus::PartialContent, response.headers, false);
+    connection.SendFile(streamId, std::move(file), range.offset, range.length);
+    return;
+  }
+  response.headers.emplace("Content-Length", std::to_string(size));
+  connection.SendHeaders(streamId, HttpStatus::OK, response.headers, false);
+  connection.SendFile(streamId, std::move(file), 0, size);
+}
+
+void Http2StreamSender::Send(MixedReplaceHeaderHttpResponse&&) const {
+  HttpHeaders headers;
+  headers.emplace("Content-Type", "multipart/x-mixed-replace; boundary=\"BND\"");
+  connection.SendHeaders(streamId, HttpStatus::OK, headers, false);
+}
+
+void Http2StreamSender::Send(MixedReplaceDataHttpResponse&& response) const {
+  std::string respPayload = "--BND\r\n";
+  response.headers.emplace("Content-Length", std::to_string(response.body.size()));
+  for (const auto& [k, v] : response.headers) {
+    respPayload += k + ": " + v + "\r\n";
+  }
+  respPayload += "\r\n";
+  respPayload += std::move(response.body);
+  respPayload += "\r\n";
+  connection.SendData(streamId, respPayload, false);
+}
+
+void Http2StreamSender::Send(ChunkedHeaderHttpResponse&& response) const {
+  connection.SendHeaders(streamId, HttpStatus::OK, response.headers, false);
+}
+
+void Http2StreamSender::Send(ChunkedDataHttpResponse&& response) const {
+  connection.SendData(streamId, response.body, false);
+}
+
+size_t Http2StreamSender::Buffered() const {
+  return connection.Buffered(streamId);
+}
+
+void Http2StreamSender::Close() const {
+  connection.Reset(streamId);
+}
+
+Http2Connection::Http2Connection(TcpSender& sender, HttpProcessorFactory& processorFactory)
+    : sender{sender},
+      processorFactory{processorFactory},
+      decoder{headerTableSize},
+      connectionSendWindow{defaultWindowSize},
+      peerInitialWindowSize{defaultWindowSize},
+      peerMaxFrameSize{Http2FrameParser::maxFrameSize} {
+}
+
+Http2Connection::~Http2Connection() {
+  decltype(streams) remaining;
+  {
+    std::lock_guard lock{connectionMut};
+    remaining.swap(streams);
+  }
+}
+
+bool Http2Connection::PrefaceReceived() const {
+  std::lock_guard lock{connectionMut};
+  return prefaceReceived;
+}
+
+bool Http2Connection::Closed() const {
+  std::lock_guard lock{connectionMut};
+  return closed;
+}
+
+bool Http2Connection::ProcessPreface(std::string& payload) {
+  const size_t n = std::min(payload.size(), clientPrefaceTail.size());
+  if (payload.compare(0, n, clientPrefaceTail, 0, n) != 0) {
+    spdlog::error("http2 invalid connection preface");
+    Fail(errorProtocol);
+    return false;
+  }
+  if (n < clientPrefaceTail.size()) {
+    return false;
+  }
+  payload.erase(0, n);
+  std::string settings;
+  AppendUint(settings, settingsMaxConcurrentStreams, 2);
+  AppendUint(settings, maxConcurrentStreams, 4);
+  AppendUint(settings, settingsHeaderTableSize, 2);
+  AppendUint(settings, headerTableSize, 4);
+  std::string out;
+  AppendFrame(out, frameSettings, 0, 0, settings);
+  std::lock_guard lock{connectionMut};
+  prefaceReceived = true;
+  sender.Send(std::move(out));
+  return true;
+}
+
+void Http2Connection::Process(Http2Frame&& frame) {
+  if (frame.length != frame.payload.size()) {
+    return Fail(errorFrameSize);
+  }
+  if (continuationStreamId and frame.type != frameContinuation) {
+    return Fail(errorProtocol);
+  }
+  std::uint32_t error = errorNone;
+  switch (frame.type) {
+    case frameData:
+      error = ProcessData(frame);
+      break;
+    case frameHeaders:
+      error = ProcessHeaders(frame);
+      break;
+    case framePriority:
+      error = frame.streamId == 0 ? errorProtocol : errorNone;
+      break;
+    case frameRstStream:
+      error = ProcessRstStream(frame);
+      break;
+    case frameSettings:
+      error = ProcessSettings(frame);
+      break;
+    case framePushPromise:
+      error = errorProtocol;
+      break;
+    case framePing:
+      error = ProcessPing(frame);
+      break;
+    case frameGoAway:
+      error = ProcessGoAway(frame);
+      break;
+    case frameWindowUpdate:
+      error = ProcessWindowUpdate(frame);
+      break;
+    case frameContinuation:
+      error = ProcessContinuation(frame);
+      break;
+    default:
+      break;
+  }
+  if (error != errorNone) {
+    spdlog::error("http2 connection error: type = {}, stream = {}, error = {}", frame.type, frame.streamId, error);
+    Fail(error);
+  }
+}
+
+std::uint32_t Http2Connection::ProcessData(const Http2Frame& frame) {
+  if (frame.streamId == 0) {
+    return errorProtocol;
+  }
+  std::string_view payload;
+  if (not StripPadding(frame, payload)) {
+    return errorProtocol;
+  }
+  std::unique_lock lock{connectionMut};
+  std::string out;
+  if (frame.length > 0) {
+    AppendWindowUpdate(out, 0, frame.length);
+  }
+  const auto it = streams.find(frame.streamId);
+  if (it == streams.end() or it->second.remoteClosed) {
+    if (frame.streamId > lastStreamId) {
+      return errorProtocol;
+    }
+    AppendRstStream(out, frame.streamId, errorStreamClosed);
+    sender.Send(std::move(out));
+    return errorNone;
+  }
+  auto& stream = it->second;
+  if (stream.requestBody.size() + payload.size() > maxRequestBodySize) {
+    AppendRstStream(out, frame.streamId, errorEnhanceYourCalm);
+    sender.Send(std::move(out));
+    stream.localClosed = true;
+    stream.remoteClosed = true;
+    return errorNone;
+  }
+  stream.requestBody += payload;
+  if (not(frame.flags & flagEndStream)) {
+    if (frame.length > 0) {
+      AppendWindowUpdate(out, frame.streamId, frame.length);
+    }
+    sender.Send(std::move(out));
+    return errorNone;
+  }
+  stream.remoteClosed = true;
+  if (not out.empty()) {
+    sender.Send(std::move(out));
+  }
+  lock.unlock();
+  Dispatch(frame.streamId);
+  return errorNone;
+}
+
+std::uint32_t Http2Connection::ProcessHeaders(const Http2Frame& frame) {
+  if (frame.streamId == 0) {
+    return errorProtocol;
+  }
+  std::string_view payload;
+  if (not StripPadding(frame, payload)) {
+    return errorProtocol;
+  }
+  if (frame.flags & flagPriority) {
+    if (payload.size() < 5) {
+      return errorFrameSize;
+    }
+    payload.remove_prefix(5);
+  }
+  headerBlock = payload;
+  continuationEndStream = frame.flags & flagEndStream;
+  if (not(frame.flags & flagEndHeaders)) {
+    continuationStreamId = frame.streamId;
+    return errorNone;
+  }
+  return ProcessHeaderBlock(frame.streamId, continuationEndStream);
+}
+
+std::uint32_t Http2Connection::ProcessContinuation(const Http2Frame& frame) {
+  if (not continuationStreamId or *continuationStreamId != frame.streamId) {
+    return errorProtocol;
+  }
+  if (headerBlock.size() + frame.payload.size() > maxHeaderBlockSize) {
+    return errorEnhanceYourCalm;
+  }
+  headerBlock += frame.payload;
+  if (not(frame.flags & flagEndHeaders)) {
+    return errorNone;
+  }
+  continuationStreamId.reset();
+  return ProcessHeaderBlock(frame.streamId, continuationEndStream);
+}
+
+std::uint32_t Http2Connection::ProcessHeaderBlock(std::uint32_t streamId, bool endStream) {
+  auto headers = decoder.Decode(headerBlock);
+  headerBlock.clear();
+  if (not headers) {
+    return errorCompression;
+  }
+  std::unique_lock lock{connectionMut};
+  const auto it = streams.find(streamId);
+  if (it != streams.end()) {
+    auto& stream = it->second;
+    if (stream.remoteClosed or not endStream) {
+      return errorProtocol;
+    }
+    stream.remoteClosed = true;
+    lock.unlock();
+    Dispatch(streamId);
+    return errorNone;
+  }
+  if (streamId % 2 == 0 or streamId <= lastStreamId) {
+    return errorProtocol;
+  }
+  lastStreamId = streamId;
+  if (streams.size() >= maxConcurrentStreams) {
+    std::string out;
+    AppendRstStream(out, streamId, errorRefusedStream);
+    sender.Send(std::move(out));
+    return errorNone;
+  }
+  auto& stream = streams[streamId];
+  stream.sendWindow = peerInitialWindowSize;
+  stream.requestHeaders = std::move(*headers);
+  stream.remoteClosed = endStream;
+  stream.sender = std::make_unique<Http2StreamSender>(*this, streamId);
+  stream.processor = processorFactory.Create(*stream.sender);
+  lock.unlock();
+  if (endStream) {
+    Dispatch(streamId);
+  }
+  return errorNone;
+}
+
+void Http2Connection::Dispatch(std::uint32_t streamId) {
+  std::unique_lock lock{connectionMut};
+  const auto it = streams.find(streamId);
+  if (it == streams.end()) {
+    return;
+  }
+  auto& stream = it->second;
+  HttpRequest request;
+  request.version = "HTTP/2.0";
+  request.body = std::move(stream.requestBody);
+  std::optional<HttpMethod> method;
+  std::optional<std::string> path;
+  for (auto& [field, value] : stream.requestHeaders) {
+    if (field == ":method") {
+      common::ToLower(value);
+      method = ConvertMethod(value);
+    } else if (field == ":path") {
+      path = std::move(value);
+    } else if (field == ":authority") {
+      request.headers.emplace("host", std::move(value));
+    } else if (not field.starts_with(':')) {
+      request.headers.emplace(std::move(field), std::move(value));
+    }
+  }
+  stream.requestHeaders.clear();
+  auto* streamSender = stream.sender.get();
+  auto* processor = stream.processor.get();
+  lock.unlock();
+  if (not method or *method == HttpMethod::PRI or not path or path->empty()) {
+    HttpResponse resp;
+    resp.status = HttpStatus::BadRequest;
+    return streamSender->Send(std::move(resp));
+  }
+  request.method = *method;
+  request.uri = uriParser.ParseUriBase(*path);
+  request.query = uriParser.ParseQueryString(*path);
+  spdlog::debug("http2 received request: stream = {}, method = {}, uri = {}", streamId, ToString(request.method),
+      request.uri);
+  processor->Process(std::move(request));
+}
+
+std::uint32_t Http2Connection::ProcessRstStream(const Http2Frame& frame) {
+  if (frame.streamId == 0) {
+    return errorProtocol;
+  }
+  if (frame.length != 4) {
+    return errorFrameSize;
+  }
+  decltype(streams)::node_type node;
+  {
+    std::lock_guard lock{connectionMut};
+    if (frame.streamId > lastStreamId) {
+      return errorProtocol;
+    }
+    node = streams.extract(frame.streamId);
+  }
+  return errorNone;
+}
+
+std::uint32_t Http2Connection::ProcessSettings(const Http2Frame& frame) {
+  if (frame.streamId != 0) {
+    return errorProtocol;
+  }
+  if (frame.flags & flagAck) {
+    return frame.length == 0 ? errorNone : errorFrameSize;
+  }
+  if (frame.length % 6 != 0) {
+    return errorFrameSize;
+  }
+  std::lock_guard lock{connectionMut};
+  for (size_t i = 0; i < frame.payload.size(); i += 6) {
+    const auto id = ReadUint(frame.payload, i, 2);
+    const auto value = ReadUint(frame.payload, i + 2, 4);
+    switch (id) {
+      case settingsEnablePush:
+        if (value > 1) {
+          return errorProtocol;
+        }
+        break;
+      case settingsInitialWindowSize:
+        if (value > maxWindowSize) {
+          return errorFlowControl;
+        }
+        for (auto& [_, stream] : streams) {
+          stream.sendWindow += value - peerInitialWindowSize;
+        }
+        peerInitialWindowSize = value;
+        break;
+      case settingsMaxFrameSize:
+        if (value < Http2FrameParser::maxFrameSize or value > maxPeerFrameSize) {
+          return errorProtocol;
+        }
+        peerMaxFrameSize = value;
+        break;
+      default:
+        break;
+    }
+  }
+  std::string out;
+  AppendFrame(out, frameSettings, flagAck, 0, "");
+  sender.Send(std::move(out));
+  FlushAll();
+  return errorNone;
+}
+
+std::uint32_t Http2Connection::ProcessPing(const Http2Frame& frame) {
+  if (frame.streamId != 0) {
+    return errorProtocol;
+  }
+  if (frame.length != 8) {
+    return errorFrameSize;
+  }
+  if (frame.flags & flagAck) {
+    return errorNone;
+  }
+  std::string out;
+  AppendFrame(out, framePing, flagAck, 0, frame.payload);
+  sender.Send(std::move(out));
+  return errorNone;
+}
+
+std::uint32_t Http2Connection::ProcessGoAway(const Http2Frame& frame) {
+  if (frame.streamId != 0) {
+    return errorProtocol;
+  }
+  std::lock_guard lock{connectionMut};
+  closed = true;
+  sender.Close();
+  return errorNone;
+}
+
+std::uint32_t Http2Connection::ProcessWindowUpdate(const Http2Frame& frame) {
+  if (frame.length != 4) {
+    return errorFrameSize;
+  }
+  const std::int64_t increment = ReadUint(frame.payload, 0, 4) & 0x7fffffff;
+  std::lock_guard lock{connectionMut};
+  if (frame.streamId == 0) {
+    if (increment == 0) {
+      return errorProtocol;
+    }
+    if (connectionSendWindow + increment > maxWindowSize) {
+      return errorFlowControl;
+    }
+    connectionSendWindow += increment;
+    FlushAll();
+    return errorNone;
+  }
+  const auto it = streams.find(frame.streamId);
+  if (it == streams.end()) {
+    return errorNone;
+  }
+  auto& stream = it->second;
+  if (increment == 0 or stream.sendWindow + increment > maxWindowSize) {
+    std::string out;
+    AppendRstStream(out, frame.streamId, increment == 0 ? errorProtocol : errorFlowControl);
+    sender.Send(std::move(out));
+    stream.localClosed = true;
+    stream.remoteClosed = true;
+    return errorNone;
+  }
+  stream.sendWindow += increment;
+  std::string out;
+  Flush(frame.streamId, stream, out);
+  if (not out.empty()) {
+    sender.Send(std::move(out));
+  }
+  return errorNone;
+}
+
+void Http2Connection::ReapClosedStreams() {
+  std::vector<decltype(streams)::node_type> closedStreams;
+  std::lock_guard lock{connectionMut};
+  for (auto it = streams.begin(); it != streams.end();) {
+    if (it->second.localClosed and it->second.remoteClosed) {
+      closedStreams.emplace_back(streams.extract(it++));
+    } else {
+      ++it;
+    }
+  }
+}
+
+void Http2Connection::Fail(std::uint32_t errorCode) {
+  std::lock_guard lock{connectionMut};
+  if (closed) {
+    return;
+  }
+  std::string payload;
+  AppendUint(payload, lastStreamId, 4);
+  AppendUint(payload, errorCode, 4);
+  std::string out;
+  AppendFrame(out, frameGoAway, 0, 0, payload);
+  sender.Send(std::move(out));
+  closed = true;
+  sender.Close();
+}
+
+void Http2Connection::SendHeaders(
+    std::uint32_t streamId, HttpStatus status, const HttpHeaders& headers, bool endStream) {
+  HpackHeaderList headerList;
+  headerList.emplace_back(":status", ToString(status).substr(0, 3));
+  for (const auto& [k, v] : headers) {
+    auto field = k;
+    common::ToLower(field);
+    if (IsConnectionSpecific(field)) {
+      continue;
+    }
+    headerList.emplace_back(std::move(field), v);
+  }
+  const auto block = encoder.Encode(headerList);
+  std::lock_guard lock{connectionMut};
+  const auto it = streams.find(streamId);
+  if (closed or it == streams.end() or it->second.localClosed) {
+    return;
+  }
+  std::string out;
+  size_t offset = 0;
+  do {
+    const size_t n = std::min<size_t>(block.size() - offset, peerMaxFrameSize);
+    std::uint8_t flags = offset + n == block.size() ? flagEndHeaders : 0;
+    if (offset == 0 and endStream) {
+      flags |= flagEndStream;
+    }
+    AppendFrame(out, offset == 0 ? frameHeaders : frameContinuation, flags, streamId,
+        std::string_view{block}.substr(offset, n));
+    offset += n;
+  } while (offset < block.size());
+  sender.Send(std::move(out));
+  it->second.localClosed = endStream;
+}
+
+void Http2Connection::SendData(std::uint32_t streamId, std::string_view data, bool endStream) {
+  std::lock_guard lock{connectionMut};
+  const auto it = streams.find(streamId);
+  if (closed or it == streams.end() or it->second.localClosed or it->second.endPending) {
+    return;
+  }
+  auto& stream = it->second;
+  if (stream.pendingOffset > 0) {
+    stream.pending.erase(0, stream.pendingOffset);
+    stream.pendingOffset = 0;
+  }
+  stream.pending += data;
+  stream.endPending = endStream;
+  std::string out;
+  Flush(streamId, stream, out);
+  if (not out.empty()) {
+    sender.Send(std::move(out));
+  }
+}
+
+void Http2Connection::SendFile(std::uint32_t streamId, os::File file, size_t offset, size_t length) {
+  std::lock_guard lock{connectionMut};
+  const auto it = streams.find(streamId);
+  if (closed or it == streams.end() or it->second.localClosed or it->second.endPending) {
+    return;
+  }
+  auto& stream = it->second;
+  stream.file.emplace(std::move(file));
+  stream.fileOffset = offset;
+  stream.fileRemaining = length;
+  stream.endPending = true;
+  std::string out;
+  Flush(streamId, stream, out);
+  if (not out.empty()) {
+    sender.Send(std::move(out));
+  }
+}
+
+void Http2Connection::Reset(std::uint32_t streamId) {
+  std::lock_guard lock{connectionMut};
+  const auto it = streams.find(streamId);
+  if (closed or it == streams.end() or it->second.localClosed) {
+    return;
+  }
+  std::string out;
+  AppendRstStream(out, streamId, errorCancel);
+  sender.Send(std::move(out));
+  it->second.localClosed = true;
+  it->second.remoteClosed = true;
+}
+
+// what the stream still holds back for flow control plus what the socket has not taken yet from the whole connection
+size_t Http2Connection::Buffered(std::uint32_t streamId) const {
+  size_t size = sender.Buffered();
+  std::lock_guard lock{connectionMut};
+  const auto it = streams.find(streamId);
+  if (it != streams.end()) {
+    size += it->second.pending.size() - it->second.pendingOffset + it->second.fileRemaining;
+  }
+  return size;
+}
+
+void Http2Connection::FlushAll() {
+  std::string out;
+  for (auto& [streamId, stream] : streams) {
+    Flush(streamId, stream, out);
+  }
+  if (not out.empty()) {
+    sender.Send(std::move(out));
+  }
+}
+
+void Http2Connection::Flush(std::uint32_t streamId, Http2Stream& stream, std::string& out) {
+  while (not stream.localClosed) {
+    const std::int64_t window = std::min(stream.sendWindow, connectionSendWindow);
+    if (stream.pendingOffset == stream.pending.size()) {
+      stream.pending.clear();
+      stream.pendingOffset = 0;
+      if (stream.file and stream.fileRemaining > 0) {
+        if (window <= 0) {
+          return;
+        }
+        const size_t n = std::min({stream.fileRemaining, static_cast<size_t>(window), maxFileChunkSize});
+        stream.pending.resize(n);
+        const ssize_t r = pread(stream.file->Fd(), stream.pending.data(), n, stream.fileOffset);
+        if (r <= 0) {
+          spdlog::error("http2 pread(): {}", strerror(errno));
+          stream.pending.clear();
+          AppendRstStream(out, streamId, errorInternal);
+          stream.localClosed = true;
+          stream.remoteClosed = true;
+          return;
+        }
+        stream.pending.resize(r);
+        stream.fileOffset += r;
+        stream.fileRemaining -= r;
+        continue;
+      }
+      stream.file.reset();
+      if (stream.endPending) {
+        AppendFrame(out, frameData, flagEndStream, streamId, "");
+        stream.localClosed = true;
+      }
+      return;
+    }
+    if (window <= 0) {
+      return;
+    }
+    const size_t n = std::min(
+        {stream.pending.size() - stream.pendingOffset, static_cast<size_t>(window), size_t{peerMaxFrameSize}});
+    const bool last = stream.endPending and stream.pendingOffset + n == stream.pending.size() and
+                      (not stream.file or stream.fileRemaining == 0);
+    AppendFrame(out, frameData, last ? flagEndStream : 0, streamId,
+        std::string_view{stream.pending}.substr(stream.pendingOffset, n));
+    stream.pendingOffset += n;
+    stream.sendWindow -= n;
+    connectionSendWindow -= n;
+    if (last) {
+      stream.file.reset();
+      stream.localClosed = true;
+    }
+  }
+}
+
+Http2Layer::Http2Layer(Http2FrameParser& parser, Http2Connection& connection)
+    : parser{parser}, connection{connection} {
+}
+
+bool Http2Layer::TryProcess(std::string& payload) const {
+  if (connection.Closed()) {
+    return false;
+  }
+  if (not connection.PrefaceReceived()) {
+    return connection.ProcessPreface(payload);
+  }
+  auto frame = parser.Parse(payload);
+  if (not frame) {
+    return false;
+  }
+  spdlog::debug("http2 layer received frame: type = {}, flags = {}, stream = {}, length = {}", frame->type,
+      frame->flags, frame->streamId, frame->length);
+  connection.Process(std::move(*frame));
+  connection.ReapClosedStreams();
+  return not connection.Closed();
+}
+
+}  // namespace network
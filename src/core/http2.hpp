@@ -0,0 +1,146 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <optional>
+#include "hpack.hpp"
+#include "http.hpp"
+#include "network.hpp"
+
+namespace network {
+
+struct Http2Frame {
+  std::uint32_t length;
+  std::uint8_t type;
+  std::uint8_t flags;
+  std::uint32_t streamId;
+  std::string payload;
+};
+
+class Http2FrameParser {
+public:
+  Http2FrameParser() = default;
+  Http2FrameParser(const Http2FrameParser&) = delete;
+  Http2FrameParser(Http2FrameParser&&) = delete;
+  Http2FrameParser& operator=(const Http2FrameParser&) = delete;
+  Http2FrameParser& operator=(Http2FrameParser&&) = delete;
+  ~Http2FrameParser() = default;
+
+  std::optional<Http2Frame> Parse(std::string&) const;
+
+  static constexpr std::uint32_t frameHeaderLen = 9;
+  static constexpr std::uint32_t maxFrameSize = 16384;
+};
+
+class Http2Connection;
+
+class Http2StreamSender final : public HttpSender {
+public:
+  Http2StreamSender(Http2Connection&, std::uint32_t);
+  Http2StreamSender(const Http2StreamSender&) = delete;
+  Http2StreamSender(Http2StreamSender&&) = delete;
+  Http2StreamSender& operator=(const Http2StreamSender&) = delete;
+  Http2StreamSender& operator=(Http2StreamSender&&) = delete;
+  ~Http2StreamSender() override = default;
+
+  void Send(HttpResponse&&) const override;
+  void Send(SharedHttpResponse&&) const override;
+  void Send(FileHttpResponse&&) const override;
+  void Send(MixedReplaceHeaderHttpResponse&&) const override;
+  void Send(MixedReplaceDataHttpResponse&&) const override;
+  void Send(ChunkedHeaderHttpResponse&&) const override;
+  void Send(ChunkedDataHttpResponse&&) const override;
+  size_t Buffered() const override;
+  void Close() const override;
+
+private:
+  Http2Connection& connection;
+  std::uint32_t streamId;
+};
+
+struct Http2Stream {
+  std::unique_ptr<Http2StreamSender> sender;
+  std::unique_ptr<HttpProcessor> processor;
+  HpackHeaderList requestHeaders;
+  std::string requestBody;
+  std::int64_t sendWindow;
+  std::string pending;
+  size_t pendingOffset{0};
+  std::optional<os::File> file;
+  size_t fileOffset{0};
+  size_t fileRemaining{0};
+  bool endPending{false};
+  bool localClosed{false};
+  bool remoteClosed{false};
+};
+
+class Http2Connection {
+public:
+  Http2Connection(TcpSender&, HttpProcessorFactory&);
+  Http2Connection(const Http2Connection&) = delete;
+  Http2Connection(Http2Connection&&) = delete;
+  Http2Connection& operator=(const Http2Connection&) = delete;
+  Http2Connection& operator=(Http2Connection&&) = delete;
+  ~Http2Connection();
+
+  bool ProcessPreface(std::string&);
+  void Process(Http2Frame&&);
+  void ReapClosedStreams();
+  bool PrefaceReceived() const;
+  bool Closed() const;
+
+  void SendHeaders(std::uint32_t, HttpStatus, const HttpHeaders&, bool);
+  void SendData(std::uint32_t, std::string_view, bool);
+  void SendFile(std::uint32_t, os::File, size_t, size_t);
+  void Reset(std::uint32_t);
+  size_t Buffered(std::uint32_t) const;
+
+private:
+  std::uint32_t ProcessData(const Http2Frame&);
+  std::uint32_t ProcessHeaders(const Http2Frame&);
+  std::uint32_t ProcessContinuation(const Http2Frame&);
+  std::uint32_t ProcessRstStream(const Http2Frame&);
+  std::uint32_t ProcessSettings(const Http2Frame&);
+  std::uint32_t ProcessPing(const Http2Frame&);
+  std::uint32_t ProcessGoAway(const Http2Frame&);
+  std::uint32_t ProcessWindowUpdate(const Http2Frame&);
+  std::uint32_t ProcessHeaderBlock(std::uint32_t, bool);
+  void Dispatch(std::uint32_t);
+  void Flush(std::uint32_t, Http2Stream&, std::string&);
+  void FlushAll();
+  void Fail(std::uint32_t);
+
+  TcpSender& sender;
+  HttpProcessorFactory& processorFactory;
+  ConcreteHttpParser uriParser;
+  HpackDecoder decoder;
+  HpackEncoder encoder;
+  std::map<std::uint32_t, Http2Stream> streams;
+  std::uint32_t lastStreamId{0};
+  std::optional<std::uint32_t> continuationStreamId;
+  bool continuationEndStream{false};
+  std::string headerBlock;
+  std::int64_t connectionSendWindow;
+  std::int64_t peerInitialWindowSize;
+  std::uint32_t peerMaxFrameSize;
+  bool prefaceReceived{false};
+  bool closed{false};
+  mutable std::mutex connectionMut;
+};
+
+class Http2Layer final : public ProtocolProcessor {
+public:
+  Http2Layer(Http2FrameParser&, Http2Connection&);
+  Http2Layer(const Http2Layer&) = delete;
+  Http2Layer(Http2Layer&&) = delete;
+  Http2Layer& operator=(const Http2Layer&) = delete;
+  Http2Layer& operator=(Http2Layer&&) = delete;
+  ~Http2Layer() override = default;
+
+  bool TryProcess(std::string&) const override;
+
+private:
+  Http2FrameParser& parser;
+  Http2Connection& connection;
+};
+
+}  // namespace network
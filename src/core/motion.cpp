@@ -0,0 +1,182 @@
+#include "motion.hpp"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace codec {
+
+// adds the sum of every group of scale pixels in the row to sums, 8 wide groups take the SAD path
+void DownscaleRow(const std::uint8_t* row, std::uint16_t* sums, int groups, int scale) {
+  int g = 0;
+  if (scale == 8) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; g + 2 <= groups; g += 2) {
+      const __m128i s = _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + g * 8)), zero);
+      sums[g] += static_cast<std::uint16_t>(_mm_cvtsi128_si32(s));
+      sums[g + 1] += static_cast<std::uint16_t>(_mm_extract_epi16(s, 4));
+    }
+#elif defined(__ARM_NEON)
+    for (; g + 2 <= groups; g += 2) {
+      const uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vld1q_u8(row + g * 8))));
+      sums[g] += static_cast<std::uint16_t>(vgetq_lane_u64(s, 0));
+      sums[g + 1] += static_cast<std::uint16_t>(vgetq_lane_u64(s, 1));
+    }
+#endif
+  }
+  for (; g < groups; g++) {
+    int sum = 0;
+    for (int i = 0; i < scale; i++) {
+      sum += row[g * scale + i];
+    }
+    sums[g] += static_cast<std::uint16_t>(sum);
+  }
+}
+
+// background holds luma with 7 fractional bits and moves towards the frame by 1/2^shift of the difference
+void DetectRow(const std::uint8_t* luma, std::int16_t* background, const std::uint8_t* mask, std::uint8_t* changed,
+    int len, int threshold, int shift) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i limit = _mm_set1_epi16(static_cast<std::int16_t>(threshold));
+  const __m128i count = _mm_cvtsi32_si128(shift);
+  for (; i + 8 <= len; i += 8) {
+    const __m128i cur = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(luma + i)), zero);
+    auto* p = reinterpret_cast<__m128i*>(background + i);
+    __m128i bg = _mm_loadu_si128(p);
+    const __m128i diff = _mm_sub_epi16(cur, _mm_srai_epi16(bg, 7));
+    const __m128i hit = _mm_cmpgt_epi16(_mm_max_epi16(diff, _mm_sub_epi16(zero, diff)), limit);
+    bg = _mm_add_epi16(bg, _mm_sra_epi16(_mm_sub_epi16(_mm_slli_epi16(cur, 7), bg), count));
+    _mm_storeu_si128(p, bg);
+    const __m128i m = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask + i));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(changed + i), _mm_and_si128(_mm_packs_epi16(hit, hit), m));
+  }
+#elif defined(__ARM_NEON)
+  const int16x8_t limit = vdupq_n_s16(static_cast<std::int16_t>(threshold));
+  const int16x8_t count = vdupq_n_s16(static_cast<std::int16_t>(-shift));
+  for (; i + 8 <= len; i += 8) {
+    const int16x8_t cur = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(luma + i)));
+    int16x8_t bg = vld1q_s16(background + i);
+    const uint16x8_t hit = vcgtq_s16(vabdq_s16(cur, vshrq_n_s16(bg, 7)), limit);
+    bg = vaddq_s16(bg, vshlq_s16(vsubq_s16(vshlq_n_s16(cur, 7), bg), count));
+    vst1q_s16(background + i, bg);
+    vst1_u8(changed + i, vand_u8(vmovn_u16(hit), vld1_u8(mask + i)));
+  }
+#endif
+  for (; i < len; i++) {
+    const int diff = luma[i] - (background[i] >> 7);
+    changed[i] = std::abs(diff) > threshold ? mask[i] : 0;
+    background[i] = static_cast<std::int16_t>(background[i] + (((luma[i] << 7) - background[i]) >> shift));
+  }
+}
+
+MotionDetector::MotionDetector(const MotionOptions& options)
+    : options{options}, scale{std::clamp(options.scale, 1, 16)} {
+}
+
+bool MotionDetector::Process(const std::uint8_t* data, int linesize, int width, int height) {
+  if (width != frameWidth or height != frameHeight) {
+    Reset(width, height);
+  }
+  if (zones.empty()) {
+    return active;
+  }
+  const int area = scale * scale;
+  for (int y = 0; y < gridHeight; y++) {
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int row = 0; row < scale; row++) {
+      DownscaleRow(data + (y * scale + row) * linesize, sums.data(), gridWidth, scale);
+    }
+    for (int x = 0; x < gridWidth; x++) {
+      luma[y * gridWidth + x] = static_cast<std::uint8_t>((sums[x] + area / 2) / area);
+    }
+  }
+  if (not seeded) {
+    std::transform(luma.begin(), luma.end(), background.begin(), [](auto v) { return v << 7; });
+    seeded = true;
+    return active;
+  }
+  DetectRow(luma.data(), background.data(), mask.data(), changed.data(), gridWidth * gridHeight, options.sensitivity,
+      options.backgroundShift);
+  bool motion = false;
+  for (const auto& zone : zones) {
+    int count = 0;
+    for (int y = zone.y0; y < zone.y1; y++) {
+      for (int x = zone.x0; x < zone.x1; x++) {
+        count += changed[y * gridWidth + x];
+      }
+    }
+    motion = motion or count >= zone.minChanged;
+  }
+  if (motion) {
+    quiet = 0;
+    active = active or ++triggered >= options.triggerFrames;
+  } else {
+    triggered = 0;
+    if (active and ++quiet >= options.releaseFrames) {
+      active = false;
+      quiet = 0;
+    }
+  }
+  return active;
+}
+
+bool MotionDetector::Active() const {
+  return active;
+}
+
+void MotionDetector::Reset(int width, int height) {
+  frameWidth = width;
+  frameHeight = height;
+  gridWidth = width / scale;
+  gridHeight = height / scale;
+  const size_t cells = gridWidth * gridHeight;
+  sums.assign(gridWidth, 0);
+  luma.assign(cells, 0);
+  background.assign(cells, 0);
+  changed.assign(cells, 0);
+  mask.assign(cells, 1);
+  const auto toCell = [](double v, int count) {
+    return std::clamp(static_cast<int>(std::lround(v * count)), 0, count);
+  };
+  const auto toCells = [this, &toCell](const MotionRegion& region) {
+    return Zone{toCell(region.x, gridWidth), toCell(region.y, gridHeight), toCell(region.x + region.width, gridWidth),
+        toCell(region.y + region.height, gridHeight), 0};
+  };
+  for (const auto& region : options.masks) {
+    const auto cellsOf = toCells(region);
+    for (int y = cellsOf.y0; y < cellsOf.y1; y++) {
+      std::fill(mask.begin() + y * gridWidth + cellsOf.x0, mask.begin() + y * gridWidth + cellsOf.x1, 0);
+    }
+  }
+  auto regions = options.zones;
+  if (regions.empty()) {
+    regions.emplace_back(MotionRegion{0, 0, 1, 1, options.threshold});
+  }
+  zones.clear();
+  for (const auto& region : regions) {
+    auto zone = toCells(region);
+    int analysed = 0;
+    for (int y = zone.y0; y < zone.y1; y++) {
+      for (int x = zone.x0; x < zone.x1; x++) {
+        analysed += mask[y * gridWidth + x];
+      }
+    }
+    if (analysed == 0) {
+      continue;
+    }
+    zone.minChanged = std::max(1, static_cast<int>(std::ceil(region.threshold * analysed)));
+    zones.emplace_back(zone);
+  }
+  seeded = false;
+  triggered = 0;
+  quiet = 0;
+  active = false;
+}
+
+}  // namespace codec
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace codec {
+
+struct MotionRegion {
+  double x{0};
+  double y{0};
+  double width{1};
+  double height{1};
+  double threshold{0.02};
+};
+
+struct MotionOptions {
+  int scale{8};
+  int sensitivity{25};
+  int backgroundShift{5};
+  int triggerFrames{2};
+  int releaseFrames{50};
+  double threshold{0.02};
+  std::vector<MotionRegion> zones;
+  std::vector<MotionRegion> masks;
+};
+
+void DownscaleRow(const std::uint8_t*, std::uint16_t*, int, int);
+void DetectRow(const std::uint8_t*, std::int16_t*, const std::uint8_t*, std::uint8_t*, int, int, int);
+
+class MotionDetector {
+public:
+  explicit MotionDetector(const MotionOptions&);
+  MotionDetector(const MotionDetector&) = delete;
+  MotionDetector(MotionDetector&&) = delete;
+  MotionDetector& operator=(const MotionDetector&) = delete;
+  MotionDetector& operator=(MotionDetector&&) = delete;
+  ~MotionDetector() = default;
+
+  bool Process(const std::uint8_t*, int, int, int);
+  bool Active() const;
+
+private:
+  struct Zone {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+    int minChanged;
+  };
+
+  void Reset(int, int);
+
+  const MotionOptions options;
+  const int scale;
+  int frameWidth{0};
+  int frameHeight{0};
+  int gridWidth{0};
+  int gridHeight{0};
+  std::vector<std::uint16_t> sums;
+  std::vector<std::uint8_t> luma;
+  std::vector<std::int16_t> background;
+  std::vector<std::uint8_t> mask;
+  std::vector<std::uint8_t> changed;
+  std::vector<Zone> zones;
+  bool seeded{false};
+  int triggered{0};
+  int quiet{0};
+  bool active{false};
+};
+
+}  // namespace codec
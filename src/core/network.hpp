@@ -4,6 +4,7 @@
 #include <string_view>
 #include <unordered_map>
 #include <variant>
+#include <vector>
 #include "file.hpp"
 
 namespace network {
@@ -13,15 +14,20 @@ public:
   virtual ~TcpSenderSupervisor() = default;
   virtual void MarkSenderPending(int) const = 0;
   virtual void UnmarkSenderPending(int) const = 0;
+  virtual void MarkSenderClosing(int) const = 0;
 };
 
 class TcpSender {
 public:
   virtual ~TcpSender() = default;
   virtual void Send(std::string_view) = 0;
+  virtual void Send(std::shared_ptr<const std::string>) = 0;
   virtual void Send(os::File) = 0;
+  virtual void Send(std::shared_ptr<const os::File>, size_t, size_t) = 0;
   virtual void SendBuffered() = 0;
+  virtual size_t Buffered() const = 0;
   virtual void Close() = 0;
+  virtual bool Closing() const = 0;
 };
 
 class TcpProcessor {
@@ -48,7 +54,7 @@ public:
   virtual void SetProcessor(ProtocolProcessor*) = 0;
 };
 
-enum class HttpMethod { PUT, GET, POST, DELETE };
+enum class HttpMethod { PUT, GET, POST, DELETE, PRI };
 
 using HttpQuery = std::unordered_map<std::string, std::string>;
 
@@ -68,7 +74,16 @@ struct HttpRequest {
   std::string body;
 };
 
-enum class HttpStatus { SwitchingProtocols, OK, BadRequest, NotFound };
+enum class HttpStatus {
+  SwitchingProtocols,
+  OK,
+  PartialContent,
+  NotModified,
+  BadRequest,
+  NotFound,
+  RangeNotSatisfiable,
+  ServiceUnavailable,
+};
 
 struct HttpResponse {
   HttpStatus status;
@@ -76,13 +91,28 @@ struct HttpResponse {
   std::string body;
 };
 
+struct SharedHttpResponse {
+  HttpStatus status;
+  HttpHeaders headers;
+  std::vector<std::shared_ptr<const std::string>> body;
+};
+
 struct RawHttpResponse {
   std::string body;
 };
 
+struct HttpByteRange {
+  size_t offset;
+  size_t length;
+};
+
 struct FileHttpResponse {
   HttpHeaders headers;
   std::string path;
+  std::string range;
+  std::string ifRange;
+  // when set the body is these spans of the file back to back and range requests are ignored
+  std::vector<HttpByteRange> parts;
 };
 
 struct MixedReplaceHeaderHttpResponse {};
@@ -110,11 +140,13 @@ class HttpSender {
 public:
   virtual ~HttpSender() = default;
   virtual void Send(HttpResponse&&) const = 0;
+  virtual void Send(SharedHttpResponse&&) const = 0;
   virtual void Send(FileHttpResponse&&) const = 0;
   virtual void Send(MixedReplaceHeaderHttpResponse&&) const = 0;
   virtual void Send(MixedReplaceDataHttpResponse&&) const = 0;
   virtual void Send(ChunkedHeaderHttpResponse&&) const = 0;
   virtual void Send(ChunkedDataHttpResponse&&) const = 0;
+  virtual size_t Buffered() const = 0;
   virtual void Close() const = 0;
 };
 
@@ -139,13 +171,14 @@ struct WebsocketFrame {
 class WebsocketParser {
 public:
   virtual ~WebsocketParser() = default;
-  virtual std::optional<WebsocketFrame> Parse(std::string&) const = 0;
+  virtual std::optional<WebsocketFrame> Parse(std::string&) = 0;
 };
 
 class WebsocketSender {
 public:
   virtual ~WebsocketSender() = default;
   virtual void Send(WebsocketFrame&&) const = 0;
+  virtual size_t Buffered() const = 0;
   virtual void Close() const = 0;
 };
 
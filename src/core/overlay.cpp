@@ -0,0 +1,264 @@
+#include "overlay.hpp"
+#include <ft2build.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include FT_FREETYPE_H
+
+extern "C" {
+#include <libavutil/time.h>
+}
+
+namespace {
+
+std::uint8_t ClampColor(double value) {
+  return static_cast<std::uint8_t>(std::clamp(std::lround(value), 0L, 255L));
+}
+
+int CeilShift(int value, int shift) {
+  return -((-value) >> shift);
+}
+
+#if defined(__SSE2__)
+__m128i BlendWords(__m128i d, __m128i a, __m128i c) {
+  __m128i v = _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a));
+  v = _mm_add_epi16(v, _mm_mullo_epi16(c, a));
+  v = _mm_add_epi16(v, _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+#endif
+
+}  // namespace
+
+namespace codec {
+
+// dst = (dst * (255 - a) + color * a) / 255, with the exact round-to-nearest division by 255
+void BlendRow(std::uint8_t* dst, const std::uint8_t* alpha, const std::uint8_t* color, size_t len) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= len; i += 16) {
+    auto* p = reinterpret_cast<__m128i*>(dst + i);
+    const __m128i d = _mm_loadu_si128(p);
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(alpha + i));
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(color + i));
+    const __m128i lo = BlendWords(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(c, zero));
+    const __m128i hi = BlendWords(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(c, zero));
+    _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 8 <= len; i += 8) {
+    const uint8x8_t a = vld1_u8(alpha + i);
+    uint16x8_t v = vmull_u8(vld1_u8(dst + i), vmvn_u8(a));
+    v = vmlal_u8(v, vld1_u8(color + i), a);
+    vst1_u8(dst + i, vraddhn_u16(v, vrshrq_n_u16(v, 8)));
+  }
+#endif
+  for (; i < len; i++) {
+    const unsigned v = dst[i] * (255u - alpha[i]) + color[i] * alpha[i] + 128;
+    dst[i] = static_cast<std::uint8_t>((v + (v >> 8)) >> 8);
+  }
+}
+
+TimestampOverlay::TimestampOverlay(const OverlayOptions& options) : options{options} {
+  const double red = (options.color >> 16) & 0xff;
+  const double green = (options.color >> 8) & 0xff;
+  const double blue = options.color & 0xff;
+  colorY = ClampColor(0.299 * red + 0.587 * green + 0.114 * blue);
+  colorU = ClampColor(128 - 0.168736 * red - 0.331264 * green + 0.5 * blue);
+  colorV = ClampColor(128 + 0.5 * red - 0.418688 * green - 0.081312 * blue);
+  FT_Error r;
+  if ((r = FT_Init_FreeType(&library)) != 0) {
+    spdlog::error("codec FT_Init_FreeType(): {}", r);
+    library = nullptr;
+    return;
+  }
+  if ((r = FT_New_Face(library, options.fontfile.c_str(), 0, &face)) != 0) {
+    spdlog::error("codec FT_New_Face({}): {}", options.fontfile, r);
+    face = nullptr;
+    return;
+  }
+  if ((r = FT_Set_Pixel_Sizes(face, 0, options.fontSize)) != 0) {
+    spdlog::error("codec FT_Set_Pixel_Sizes(): {}", r);
+    FT_Done_Face(face);
+    face = nullptr;
+    return;
+  }
+}
+
+TimestampOverlay::~TimestampOverlay() {
+  if (face != nullptr) {
+    FT_Done_Face(face);
+  }
+  if (library != nullptr) {
+    FT_Done_FreeType(library);
+  }
+}
+
+void TimestampOverlay::Apply(AVFrame* frame) {
+  if (face == nullptr) {
+    return;
+  }
+  // frames carry their capture time on the monotonic clock, pre-roll is encoded well after it was captured
+  const std::time_t now = frame->pts == AV_NOPTS_VALUE
+                              ? std::time(nullptr)
+                              : (av_gettime() - av_gettime_relative() + frame->pts) / 1000000;
+  if (now != renderedTime or frame->format != renderedFormat) {
+    std::tm tm;
+    localtime_r(&now, &tm);
+    char text[128];
+    const size_t len = std::strftime(text, sizeof text, options.format.c_str(), &tm);
+    Render({text, len}, frame->format);
+    renderedTime = now;
+    renderedFormat = frame->format;
+  }
+  const int x = options.x & ~1;
+  const int y = options.y & ~1;
+  Blend(luma, frame->data[0], frame->linesize[0], x, y, frame->width, frame->height);
+  const int step = chromaInterleaved ? 2 : 1;
+  const int chromaWidth = CeilShift(frame->width, chromaShiftX) * step;
+  const int chromaHeight = CeilShift(frame->height, chromaShiftY);
+  for (int i = 0; i < chromaLayers; i++) {
+    Blend(chroma[i], frame->data[i + 1], frame->linesize[i + 1], (x >> chromaShiftX) * step, y >> chromaShiftY,
+        chromaWidth, chromaHeight);
+  }
+}
+
+const TimestampOverlay::Glyph& TimestampOverlay::LoadGlyph(char c) {
+  if (auto it = glyphs.find(c); it != glyphs.end()) {
+    return it->second;
+  }
+  Glyph glyph{{}, 0, 0, 0, 0, 0};
+  FT_Error r;
+  if ((r = FT_Load_Char(face, static_cast<unsigned char>(c), FT_LOAD_RENDER)) != 0) {
+    spdlog::error("codec FT_Load_Char({}): {}", c, r);
+    return glyphs.emplace(c, std::move(glyph)).first->second;
+  }
+  const auto* slot = face->glyph;
+  glyph.width = static_cast<int>(slot->bitmap.width);
+  glyph.height = static_cast<int>(slot->bitmap.rows);
+  glyph.left = slot->bitmap_left;
+  glyph.top = slot->bitmap_top;
+  glyph.advance = static_cast<int>(slot->advance.x >> 6);
+  glyph.bitmap.resize(glyph.width * glyph.height);
+  for (int row = 0; row < glyph.height; row++) {
+    std::memcpy(glyph.bitmap.data() + row * glyph.width, slot->bitmap.buffer + row * slot->bitmap.pitch, glyph.width);
+  }
+  return glyphs.emplace(c, std::move(glyph)).first->second;
+}
+
+void TimestampOverlay::Render(std::string_view text, int format) {
+  const int ascender = static_cast<int>(face->size->metrics.ascender >> 6);
+  const int descender = static_cast<int>(face->size->metrics.descender >> 6);
+  int width = 0;
+  int pen = 0;
+  for (char c : text) {
+    const auto& glyph = LoadGlyph(c);
+    width = std::max(width, pen + glyph.left + glyph.width);
+    pen += glyph.advance;
+  }
+  width = std::max(width, pen);
+  luma.width = (width + 1) & ~1;
+  luma.height = (ascender - descender + 1) & ~1;
+  luma.alpha.assign(luma.width * luma.height, 0);
+  luma.color.assign(luma.width, colorY);
+  pen = 0;
+  for (char c : text) {
+    const auto& glyph = LoadGlyph(c);
+    for (int row = 0; row < glyph.height; row++) {
+      const int dy = ascender - glyph.top + row;
+      if (dy < 0 or dy >= luma.height) {
+        continue;
+      }
+      for (int col = 0; col < glyph.width; col++) {
+        const int dx = pen + glyph.left + col;
+        if (dx < 0 or dx >= luma.width) {
+          continue;
+        }
+        auto& a = luma.alpha[dy * luma.width + dx];
+        a = std::max(a, glyph.bitmap[row * glyph.width + col]);
+      }
+    }
+    pen += glyph.advance;
+  }
+
+  chromaLayers = 0;
+  switch (format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+      chromaLayers = 2;
+      chromaInterleaved = false;
+      chromaShiftX = 1;
+      chromaShiftY = 1;
+      break;
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+      chromaLayers = 2;
+      chromaInterleaved = false;
+      chromaShiftX = 1;
+      chromaShiftY = 0;
+      break;
+    case AV_PIX_FMT_NV12:
+      chromaLayers = 1;
+      chromaInterleaved = true;
+      chromaShiftX = 1;
+      chromaShiftY = 1;
+      break;
+    default:
+      if (format != renderedFormat) {
+        spdlog::error("codec overlay pixel format {} not supported, drawing luma only", format);
+      }
+      return;
+  }
+  if (chromaInterleaved) {
+    Subsample(chroma[0], colorU, colorV);
+  } else {
+    Subsample(chroma[0], colorU, colorU);
+    Subsample(chroma[1], colorV, colorV);
+  }
+}
+
+void TimestampOverlay::Subsample(Layer& layer, std::uint8_t first, std::uint8_t second) const {
+  const int step = chromaInterleaved ? 2 : 1;
+  const int width = luma.width >> chromaShiftX;
+  const int samples = 1 << (chromaShiftX + chromaShiftY);
+  layer.width = width * step;
+  layer.height = luma.height >> chromaShiftY;
+  layer.alpha.assign(layer.width * layer.height, 0);
+  layer.color.resize(layer.width);
+  for (int x = 0; x < layer.width; x++) {
+    layer.color[x] = x % step == 0 ? first : second;
+  }
+  for (int y = 0; y < layer.height; y++) {
+    for (int x = 0; x < width; x++) {
+      int sum = 0;
+      for (int sy = 0; sy < 1 << chromaShiftY; sy++) {
+        for (int sx = 0; sx < 1 << chromaShiftX; sx++) {
+          sum += luma.alpha[((y << chromaShiftY) + sy) * luma.width + (x << chromaShiftX) + sx];
+        }
+      }
+      const auto a = static_cast<std::uint8_t>((sum + samples / 2) / samples);
+      std::fill_n(layer.alpha.begin() + y * layer.width + x * step, step, a);
+    }
+  }
+}
+
+void TimestampOverlay::Blend(
+    const Layer& layer, std::uint8_t* data, int linesize, int x, int y, int planeWidth, int planeHeight) const {
+  const int rows = std::min(layer.height, planeHeight - y);
+  const int cols = std::min(layer.width, planeWidth - x);
+  if (rows <= 0 or cols <= 0) {
+    return;
+  }
+  for (int row = 0; row < rows; row++) {
+    BlendRow(data + (y + row) * linesize + x, layer.alpha.data() + row * layer.width, layer.color.data(), cols);
+  }
+}
+
+}  // namespace codec
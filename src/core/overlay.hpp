@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+typedef struct FT_LibraryRec_* FT_Library;
+typedef struct FT_FaceRec_* FT_Face;
+
+namespace codec {
+
+struct OverlayOptions {
+  std::string fontfile;
+  int fontSize{16};
+  std::string format{"%Y-%m-%d %H:%M:%S"};
+  int x{10};
+  int y{10};
+  std::uint32_t color{0xffff00};
+};
+
+void BlendRow(std::uint8_t*, const std::uint8_t*, const std::uint8_t*, size_t);
+
+class TimestampOverlay {
+public:
+  explicit TimestampOverlay(const OverlayOptions&);
+  TimestampOverlay(const TimestampOverlay&) = delete;
+  TimestampOverlay(TimestampOverlay&&) = delete;
+  TimestampOverlay& operator=(const TimestampOverlay&) = delete;
+  TimestampOverlay& operator=(TimestampOverlay&&) = delete;
+  ~TimestampOverlay();
+
+  void Apply(AVFrame*);
+
+private:
+  struct Glyph {
+    std::vector<std::uint8_t> bitmap;
+    int width;
+    int height;
+    int left;
+    int top;
+    int advance;
+  };
+
+  struct Layer {
+    std::vector<std::uint8_t> alpha;
+    std::vector<std::uint8_t> color;
+    int width{0};
+    int height{0};
+  };
+
+  const Glyph& LoadGlyph(char);
+  void Render(std::string_view, int);
+  void Subsample(Layer&, std::uint8_t, std::uint8_t) const;
+  void Blend(const Layer&, std::uint8_t*, int, int, int, int, int) const;
+
+  const OverlayOptions options;
+  FT_Library library{nullptr};
+  FT_Face face{nullptr};
+  std::unordered_map<char, Glyph> glyphs;
+  std::time_t renderedTime{-1};
+  int renderedFormat{-1};
+  Layer luma;
+  Layer chroma[2];
+  int chromaLayers{0};
+  bool chromaInterleaved{false};
+  int chromaShiftX{0};
+  int chromaShiftY{0};
+  std::uint8_t colorY;
+  std::uint8_t colorU;
+  std::uint8_t colorV;
+};
+
+}  // namespace codec
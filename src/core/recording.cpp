@@ -0,0 +1,250 @@
+#include "recording.hpp"
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace {
+
+// every record is 64 bytes: magic, op, start, end and size followed by the nul padded name
+constexpr std::uint32_t recordMagic = 0x58444952;
+constexpr size_t recordSize = 64;
+constexpr size_t nameOffset = 32;
+constexpr size_t maxNameSize = recordSize - nameOffset - 1;
+
+void EncodeRecord(char* record, std::uint8_t op, const os::RecordingSegment& segment) {
+  std::memset(record, 0, recordSize);
+  std::memcpy(record, &recordMagic, sizeof recordMagic);
+  record[4] = static_cast<char>(op);
+  std::memcpy(record + 8, &segment.start, sizeof segment.start);
+  std::memcpy(record + 16, &segment.end, sizeof segment.end);
+  std::memcpy(record + 24, &segment.size, sizeof segment.size);
+  std::memcpy(record + nameOffset, segment.name.data(), std::min(segment.name.size(), maxNameSize));
+}
+
+bool DecodeRecord(const char* record, std::uint8_t& op, os::RecordingSegment& segment) {
+  std::uint32_t magic;
+  std::memcpy(&magic, record, sizeof magic);
+  if (magic != recordMagic) {
+    return false;
+  }
+  op = static_cast<std::uint8_t>(record[4]);
+  std::memcpy(&segment.start, record + 8, sizeof segment.start);
+  std::memcpy(&segment.end, record + 16, sizeof segment.end);
+  std::memcpy(&segment.size, record + 24, sizeof segment.size);
+  segment.name.assign(record + nameOffset, strnlen(record + nameOffset, maxNameSize));
+  return true;
+}
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const auto r = write(fd, data, size);
+    if (r < 0) {
+      spdlog::error("recording write(): {}", strerror(errno));
+      return false;
+    }
+    data += r;
+    size -= r;
+  }
+  return true;
+}
+
+}  // namespace
+
+namespace os {
+
+// reads the "ms offset size" lines the fragmented writer leaves next to each segment
+std::vector<RecordingFragment> ReadFragmentIndex(std::string_view filename) {
+  std::vector<RecordingFragment> fragments;
+  std::ifstream in{std::string{filename}};
+  RecordingFragment fragment;
+  while (in >> fragment.time >> fragment.offset >> fragment.size) {
+    fragments.emplace_back(fragment);
+  }
+  return fragments;
+}
+
+// every fragment opens with a keyframe, so the span starts at the last one beginning at or before from
+std::optional<RecordingSpan> FindFragmentSpan(
+    const std::vector<RecordingFragment>& fragments, std::int64_t from, std::int64_t to) {
+  if (fragments.empty() or to <= fragments.front().time) {
+    return std::nullopt;
+  }
+  auto first = std::upper_bound(
+      fragments.begin(), fragments.end(), from, [](std::int64_t t, const auto& f) { return t < f.time; });
+  if (first != fragments.begin()) {
+    --first;
+  }
+  const auto last = std::lower_bound(
+      first + 1, fragments.end(), to, [](const auto& f, std::int64_t t) { return f.time < t; }) - 1;
+  return RecordingSpan{first->time, first->offset, last->offset + last->size - first->offset};
+}
+
+RecordingIndex::RecordingIndex(std::string_view filename) : filename{filename} {
+  Load();
+  if (removedRecords > segments.size()) {
+    Compact();
+  }
+  if (fd >= 0) {
+    return;
+  }
+  fd = open(this->filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    spdlog::error("recording open({}): {}", this->filename, strerror(errno));
+  }
+}
+
+RecordingIndex::~RecordingIndex() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void RecordingIndex::Add(const RecordingSegment& segment) {
+  if (segment.name.size() > maxNameSize) {
+    spdlog::error("recording name {} too long for the index", segment.name);
+    return;
+  }
+  std::lock_guard lock{indexMut};
+  const auto existing =
+      std::find_if(segments.begin(), segments.end(), [&segment](const auto& s) { return s.name == segment.name; });
+  if (existing != segments.end()) {
+    totalSize -= existing->size;
+    segments.erase(existing);
+  }
+  const auto it = std::upper_bound(segments.begin(), segments.end(), segment.start,
+      [](std::int64_t start, const RecordingSegment& s) { return start < s.start; });
+  segments.insert(it, segment);
+  totalSize += segment.size;
+  Append(Op::Add, segment);
+}
+
+void RecordingIndex::Remove(std::string_view name) {
+  std::lock_guard lock{indexMut};
+  const auto it = std::find_if(segments.begin(), segments.end(), [name](const auto& s) { return s.name == name; });
+  if (it == segments.end()) {
+    return;
+  }
+  Append(Op::Remove, *it);
+  totalSize -= it->size;
+  segments.erase(it);
+  removedRecords++;
+}
+
+std::vector<RecordingSegment> RecordingIndex::List() const {
+  std::lock_guard lock{indexMut};
+  return segments;
+}
+
+// segments do not overlap, so both their starts and their ends are sorted
+std::vector<RecordingSegment> RecordingIndex::Find(std::int64_t from, std::int64_t to) const {
+  std::lock_guard lock{indexMut};
+  const auto first =
+      std::partition_point(segments.begin(), segments.end(), [from](const auto& s) { return s.end <= from; });
+  const auto last = std::partition_point(first, segments.end(), [to](const auto& s) { return s.start < to; });
+  return {first, last};
+}
+
+std::vector<RecordingSegment> RecordingIndex::Expire(std::uint64_t maxBytes, std::int64_t minStart) {
+  std::lock_guard lock{indexMut};
+  auto it = segments.begin();
+  std::uint64_t size = totalSize;
+  while (it != segments.end() and ((maxBytes > 0 and size > maxBytes) or it->start < minStart)) {
+    size -= it->size;
+    Append(Op::Remove, *it);
+    ++it;
+  }
+  std::vector<RecordingSegment> expired{std::make_move_iterator(segments.begin()), std::make_move_iterator(it)};
+  segments.erase(segments.begin(), it);
+  totalSize = size;
+  removedRecords += expired.size();
+  if (removedRecords > segments.size()) {
+    Compact();
+  }
+  return expired;
+}
+
+std::uint64_t RecordingIndex::TotalSize() const {
+  std::lock_guard lock{indexMut};
+  return totalSize;
+}
+
+void RecordingIndex::Load() {
+  const int in = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    return;
+  }
+  char record[recordSize];
+  off_t valid = 0;
+  std::unordered_map<std::string, RecordingSegment> live;
+  while (read(in, record, recordSize) == static_cast<ssize_t>(recordSize)) {
+    std::uint8_t op;
+    RecordingSegment segment;
+    if (not DecodeRecord(record, op, segment)) {
+      break;
+    }
+    valid += recordSize;
+    if (op == static_cast<std::uint8_t>(Op::Remove)) {
+      removedRecords += live.erase(segment.name);
+    } else if (op == static_cast<std::uint8_t>(Op::Add)) {
+      // a later add of the same name replaces the earlier one, as Add does
+      auto name = segment.name;
+      removedRecords += not live.insert_or_assign(std::move(name), std::move(segment)).second;
+    }
+  }
+  close(in);
+  for (auto& [_, segment] : live) {
+    totalSize += segment.size;
+    segments.emplace_back(std::move(segment));
+  }
+  // a record torn by a crash is dropped along with anything after it
+  if (truncate(filename.c_str(), valid) < 0) {
+    spdlog::error("recording truncate(): {}", strerror(errno));
+  }
+  std::stable_sort(segments.begin(), segments.end(), [](const auto& a, const auto& b) { return a.start < b.start; });
+}
+
+void RecordingIndex::Append(Op op, const RecordingSegment& segment) {
+  if (fd < 0) {
+    return;
+  }
+  char record[recordSize];
+  EncodeRecord(record, static_cast<std::uint8_t>(op), segment);
+  if (WriteAll(fd, record, recordSize) and fdatasync(fd) < 0) {
+    spdlog::error("recording fdatasync(): {}", strerror(errno));
+  }
+}
+
+// rewrites the log with only the live segments and swaps it in with a rename
+void RecordingIndex::Compact() {
+  const std::string tmp = filename + ".tmp";
+  const int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    spdlog::error("recording open({}): {}", tmp, strerror(errno));
+    return;
+  }
+  std::string records(segments.size() * recordSize, '\0');
+  for (size_t i = 0; i < segments.size(); i++) {
+    EncodeRecord(records.data() + i * recordSize, static_cast<std::uint8_t>(Op::Add), segments[i]);
+  }
+  const bool ok = WriteAll(out, records.data(), records.size()) and fdatasync(out) == 0;
+  close(out);
+  if (not ok or rename(tmp.c_str(), filename.c_str()) < 0) {
+    spdlog::error("recording compaction of {} failed", filename);
+    unlink(tmp.c_str());
+    return;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  fd = open(filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (fd < 0) {
+    spdlog::error("recording open({}): {}", filename, strerror(errno));
+  }
+  removedRecords = 0;
+}
+
+}  // namespace os
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace os {
+
+struct RecordingSegment {
+  std::string name;
+  std::int64_t start;
+  std::int64_t end;
+  std::uint64_t size;
+};
+
+struct RecordingFragment {
+  std::int64_t time;
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+struct RecordingSpan {
+  std::int64_t time;
+  std::uint64_t offset;
+  std::uint64_t length;
+};
+
+std::vector<RecordingFragment> ReadFragmentIndex(std::string_view);
+std::optional<RecordingSpan> FindFragmentSpan(const std::vector<RecordingFragment>&, std::int64_t, std::int64_t);
+
+class RecordingIndex {
+public:
+  explicit RecordingIndex(std::string_view);
+  ~RecordingIndex();
+  RecordingIndex(const RecordingIndex&) = delete;
+  RecordingIndex(RecordingIndex&&) = delete;
+  RecordingIndex& operator=(const RecordingIndex&) = delete;
+  RecordingIndex& operator=(RecordingIndex&&) = delete;
+
+  void Add(const RecordingSegment&);
+  void Remove(std::string_view);
+  std::vector<RecordingSegment> List() const;
+  std::vector<RecordingSegment> Find(std::int64_t, std::int64_t) const;
+  std::vector<RecordingSegment> Expire(std::uint64_t, std::int64_t);
+  std::uint64_t TotalSize() const;
+
+private:
+  enum class Op : std::uint8_t { Add = 1, Remove = 2 };
+
+  void Load();
+  void Append(Op, const RecordingSegment&);
+  void Compact();
+
+  std::string filename;
+  int fd{-1};
+  std::vector<RecordingSegment> segments;
+  std::uint64_t totalSize{0};
+  size_t removedRecords{0};
+  mutable std::mutex indexMut;
+};
+
+}  // namespace os
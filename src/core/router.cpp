@@ -14,13 +14,24 @@ bool ConcreteRouter::TryUpgrade(const HttpRequest& req) {
   }
   httpProcessor.reset();
   dispatcher.SetProcessor(&websocketLayer);
-  websocketProcessor = entry->Create(websocketSender);
+  // the 101 is queued first, a processor may start sending from its constructor
   httpSender.Send(std::move(*resp));
+  websocketProcessor = entry->Create(websocketSender);
+  return true;
+}
+
+bool ConcreteRouter::TryHttp2(const HttpRequest& req) {
+  if (req.method != HttpMethod::PRI or req.version != "HTTP/2.0") {
+    return false;
+  }
+  httpProcessor.reset();
+  websocketProcessor.reset();
+  dispatcher.SetProcessor(&http2Layer);
   return true;
 }
 
 void ConcreteRouter::Process(HttpRequest&& req) {
-  if (TryUpgrade(req)) {
+  if (TryHttp2(req) or TryUpgrade(req)) {
     return;
   }
   auto entry = httpMapping.Get(req.method, req.uri);
@@ -38,6 +49,7 @@ void ConcreteRouter::Process(HttpRequest&& req) {
 void ConcreteRouter::Process(WebsocketFrame&& req) {
   if (not websocketProcessor) {
     websocketSender.Close();
+    return;
   }
   websocketProcessor->Process(std::move(req));
 }
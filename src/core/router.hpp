@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include "http.hpp"
+#include "http2.hpp"
 #include "websocket.hpp"
 
 namespace network {
@@ -47,6 +48,42 @@ private:
   std::vector<std::tuple<std::regex, std::unique_ptr<WebsocketProcessorFactory>>> mapping;
 };
 
+class Http2StreamRouter final : public HttpProcessor {
+public:
+  Http2StreamRouter(HttpRouteMapping& httpMapping, HttpSender& sender) : httpMapping{httpMapping}, sender{sender} {
+  }
+
+  void Process(HttpRequest&& req) override {
+    auto entry = httpMapping.Get(req.method, req.uri);
+    if (not entry) {
+      HttpResponse resp;
+      resp.status = HttpStatus::NotFound;
+      sender.Send(std::move(resp));
+      return;
+    }
+    processor = entry->Create(sender);
+    processor->Process(std::move(req));
+  }
+
+private:
+  HttpRouteMapping& httpMapping;
+  HttpSender& sender;
+  std::unique_ptr<HttpProcessor> processor;
+};
+
+class Http2StreamRouterFactory final : public HttpProcessorFactory {
+public:
+  explicit Http2StreamRouterFactory(HttpRouteMapping& httpMapping) : httpMapping{httpMapping} {
+  }
+
+  std::unique_ptr<HttpProcessor> Create(HttpSender& sender) const override {
+    return std::make_unique<Http2StreamRouter>(httpMapping, sender);
+  }
+
+private:
+  HttpRouteMapping& httpMapping;
+};
+
 class ConcreteRouter final : public Router {
 public:
   ConcreteRouter(HttpRouteMapping& httpMapping, WebsocketRouteMapping& websocketMapping, TcpSender& sender,
@@ -57,6 +94,9 @@ public:
         websocketMapping{websocketMapping},
         websocketSender{sender},
         websocketLayer{websocketParser, websocketSender, *this},
+        http2StreamRouterFactory{httpMapping},
+        http2Connection{sender, http2StreamRouterFactory},
+        http2Layer{http2Parser, http2Connection},
         dispatcher{dispatcher} {
     dispatcher.SetProcessor(&httpLayer);
   }
@@ -66,6 +106,7 @@ public:
 
 private:
   bool TryUpgrade(const HttpRequest& req);
+  bool TryHttp2(const HttpRequest& req);
 
   HttpRouteMapping& httpMapping;
   ConcreteHttpSender httpSender;
@@ -75,6 +116,10 @@ private:
   ConcreteWebsocketSender websocketSender;
   ConcreteWebsocketParser websocketParser;
   WebsocketLayer websocketLayer;
+  Http2StreamRouterFactory http2StreamRouterFactory;
+  Http2FrameParser http2Parser;
+  Http2Connection http2Connection;
+  Http2Layer http2Layer;
   ProtocolDispatcher& dispatcher;
   std::unique_ptr<HttpProcessor> httpProcessor;
   std::unique_ptr<WebsocketProcessor> websocketProcessor;
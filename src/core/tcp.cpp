@@ -8,9 +8,16 @@
 #include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
+#include <vector>
 
 namespace {
 
+// a closing connection gets this long to flush what is queued, a peer that stopped reading does not keep it open
+constexpr auto closeDrainTimeout = std::chrono::seconds(5);
+constexpr size_t closeDrainBytes = 1024 * 1024;
+constexpr int sweepIntervalMs = 1000;
+
 struct TrySendOperation {
   auto operator()(auto& op) {
     op.Send();
@@ -18,6 +25,12 @@ struct TrySendOperation {
   }
 };
 
+struct RemainingOperation {
+  auto operator()(const auto& op) {
+    return op.Remaining();
+  }
+};
+
 }  // namespace
 
 namespace network {
@@ -47,21 +60,55 @@ bool TcpSendBuffer::Done() const {
   return size == 0;
 }
 
+size_t TcpSendBuffer::Remaining() const {
+  return size;
+}
+
 std::string TcpSendBuffer::Buffer() const {
   return buffer;
 }
 
-TcpSendFile::TcpSendFile(int peer, os::File file_) : peer{peer}, file{std::move(file_)} {
-  if (not file.Ok()) {
-    size = 0;
+TcpSendShared::TcpSendShared(int peer, std::shared_ptr<const std::string> buffer)
+    : peer{peer}, buffer{std::move(buffer)} {
+}
+
+void TcpSendShared::Send() {
+  while (offset < buffer->size()) {
+    ssize_t n = send(peer, buffer->data() + offset, buffer->size() - offset, 0);
+    if (n == -1) {
+      if (errno == EAGAIN or errno == EWOULDBLOCK) {
+        return;
+      }
+      spdlog::error("tcp send(): {}", strerror(errno));
+      return;
+    }
+    if (n == 0) {
+      return;
+    }
+    offset += n;
+  }
+}
+
+bool TcpSendShared::Done() const {
+  return offset == buffer->size();
+}
+
+size_t TcpSendShared::Remaining() const {
+  return buffer->size() - offset;
+}
+
+TcpSendFile::TcpSendFile(int peer, std::shared_ptr<const os::File> file_, size_t offset, size_t size)
+    : peer{peer}, file{std::move(file_)}, offset{static_cast<off_t>(offset)}, size{size} {
+  if (not file->Ok() or offset >= file->Size()) {
+    this->size = 0;
     return;
   }
-  size = file.Size();
+  this->size = std::min(size, file->Size() - offset);
 }
 
 void TcpSendFile::Send() {
   while (size > 0) {
-    ssize_t n = sendfile(peer, file.Fd(), nullptr, size);
+    ssize_t n = sendfile(peer, file->Fd(), &offset, size);
     if (n < 0) {
       if (errno == EAGAIN or errno == EWOULDBLOCK) {
         return;
@@ -80,6 +127,10 @@ bool TcpSendFile::Done() const {
   return size == 0;
 }
 
+size_t TcpSendFile::Remaining() const {
+  return size;
+}
+
 ConcreteTcpSender::ConcreteTcpSender(int s, TcpSenderSupervisor& supervisor) : peer{s}, supervisor{supervisor} {
   int flag = 0;
   int r = setsockopt(peer, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof flag);
@@ -89,7 +140,8 @@ ConcreteTcpSender::ConcreteTcpSender(int s, TcpSenderSupervisor& supervisor) : p
 }
 
 ConcreteTcpSender::~ConcreteTcpSender() {
-  ConcreteTcpSender::Close();
+  std::lock_guard lock{senderMut};
+  CloseImpl();
 }
 
 void ConcreteTcpSender::SendBuffered() {
@@ -102,10 +154,25 @@ void ConcreteTcpSender::SendBuffered() {
     buffered.pop_front();
   }
   UnmarkPending();
+  if (closing) {
+    CloseImpl();
+  }
+}
+
+size_t ConcreteTcpSender::Buffered() const {
+  std::lock_guard lock{senderMut};
+  size_t size = 0;
+  for (const auto& op : buffered) {
+    size += std::visit(RemainingOperation{}, op);
+  }
+  return size;
 }
 
 void ConcreteTcpSender::Send(std::string_view buf) {
   std::lock_guard lock{senderMut};
+  if (closing) {
+    return;
+  }
   std::string accumulated{buf};
   while (not buffered.empty()) {
     auto& lastOp = buffered.back();
@@ -123,16 +190,57 @@ void ConcreteTcpSender::Send(std::string_view buf) {
   MarkPending();
 }
 
+void ConcreteTcpSender::Send(std::shared_ptr<const std::string> buf) {
+  std::lock_guard lock{senderMut};
+  if (closing) {
+    return;
+  }
+  TcpSendShared op{peer, std::move(buf)};
+  buffered.emplace_back(std::move(op));
+  MarkPending();
+}
+
 void ConcreteTcpSender::Send(os::File file) {
+  const size_t size = file.Size();
+  Send(std::make_shared<const os::File>(std::move(file)), 0, size);
+}
+
+void ConcreteTcpSender::Send(std::shared_ptr<const os::File> file, size_t offset, size_t size) {
   std::lock_guard lock{senderMut};
-  TcpSendFile op{peer, std::move(file)};
+  if (closing) {
+    return;
+  }
+  TcpSendFile op{peer, std::move(file), offset, size};
   buffered.emplace_back(std::move(op));
   MarkPending();
 }
 
+// nothing is read after close, the queued data is flushed unless there is too much of it
 void ConcreteTcpSender::Close() {
   std::lock_guard lock{senderMut};
-  CloseImpl();
+  if (closing) {
+    return;
+  }
+  closing = true;
+  size_t size = 0;
+  for (const auto& op : buffered) {
+    size += std::visit(RemainingOperation{}, op);
+  }
+  if (size > closeDrainBytes) {
+    buffered.clear();
+    UnmarkPending();
+  }
+  if (buffered.empty()) {
+    CloseImpl();
+    return;
+  }
+  shutdown(peer, SHUT_RD);
+  supervisor.MarkSenderClosing(peer);
+}
+
+bool ConcreteTcpSender::Closing() const {
+  std::lock_guard lock{senderMut};
+  return closing;
 }
 
 void ConcreteTcpSender::CloseImpl() {
@@ -178,6 +286,16 @@ TcpSender& TcpConnectionContext::GetSender() const {
   return *sender;
 }
 
+bool TcpConnectionContext::CloseExpired(std::chrono::steady_clock::time_point now) {
+  if (not sender->Closing()) {
+    return false;
+  }
+  if (not closeDeadline) {
+    closeDeadline = now + closeDrainTimeout;
+  }
+  return now >= *closeDeadline;
+}
+
 TcpLayer::TcpLayer(std::unique_ptr<TcpProcessorFactory> processorFactory)
     : processorFactory{std::move(processorFactory)} {
 }
@@ -242,6 +360,18 @@ void TcpLayer::UnmarkSenderPending(int peer) const {
   }
 }
 
+void TcpLayer::MarkSenderClosing(int peer) const {
+  spdlog::debug("tcp mark sender closing: {}", peer);
+  epoll_event event;
+  event.events = EPOLLOUT;
+  event.data.fd = peer;
+  int r = epoll_ctl(epollDescriptor, EPOLL_CTL_MOD, peer, &event);
+  if (r < 0) {
+    spdlog::error("tcp epoll_ctl(): {}", strerror(errno));
+    return;
+  }
+}
+
 void TcpLayer::SetNonBlocking(int s) const {
   int flags = fcntl(s, F_GETFL);
   if (flags < 0) {
@@ -259,13 +389,13 @@ void TcpLayer::StartLoop() {
   constexpr int maxEvents = 32;
   epoll_event events[maxEvents];
   while (true) {
-    int n = epoll_wait(epollDescriptor, events, maxEvents, -1);
+    int n = epoll_wait(epollDescriptor, events, maxEvents, sweepIntervalMs);
     for (int i = 0; i < n; i++) {
       if (events[i].data.fd == localDescriptor) {
         SetupPeer();
         continue;
       }
-      if (events[i].events & EPOLLERR) {
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
         ClosePeer(events[i].data.fd);
         continue;
       }
@@ -278,6 +408,21 @@ void TcpLayer::StartLoop() {
         continue;
       }
     }
+    CloseExpiredPeers();
+  }
+}
+
+void TcpLayer::CloseExpiredPeers() {
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<int> expired;
+  for (auto& [fd, context] : connections) {
+    if (context.CloseExpired(now)) {
+      expired.push_back(fd);
+    }
+  }
+  for (int fd : expired) {
+    spdlog::info("tcp connection {} did not drain before close", fd);
+    ClosePeer(fd);
   }
 }
 
@@ -320,6 +465,9 @@ void TcpLayer::ReadFromPeer(int peerDescriptor) {
     return;
   }
   auto& context = std::get<TcpConnectionContext>(*it);
+  if (context.GetSender().Closing()) {
+    return;
+  }
   auto& processor = context.GetProcessor();
   processor.Process({buf, buf + r});
 }
@@ -1,5 +1,7 @@
 #pragma once
+#include <chrono>
 #include <deque>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <variant>
@@ -17,6 +19,7 @@ public:
   ~TcpSendBuffer() = default;
   void Send();
   bool Done() const;
+  size_t Remaining() const;
   std::string Buffer() const;
 
 private:
@@ -25,9 +28,27 @@ private:
   size_t size{0};
 };
 
+class TcpSendShared {
+public:
+  TcpSendShared(int, std::shared_ptr<const std::string>);
+  TcpSendShared(TcpSendShared&) = delete;
+  TcpSendShared(TcpSendShared&&) = default;
+  TcpSendShared& operator=(TcpSendShared&) = delete;
+  TcpSendShared& operator=(TcpSendShared&&) = default;
+  ~TcpSendShared() = default;
+  void Send();
+  bool Done() const;
+  size_t Remaining() const;
+
+private:
+  int peer;
+  std::shared_ptr<const std::string> buffer;
+  size_t offset{0};
+};
+
 class TcpSendFile {
 public:
-  TcpSendFile(int, os::File);
+  TcpSendFile(int, std::shared_ptr<const os::File>, size_t, size_t);
   TcpSendFile(TcpSendFile&) = delete;
   TcpSendFile(TcpSendFile&&) = default;
   TcpSendFile& operator=(TcpSendFile&) = delete;
@@ -35,14 +56,16 @@ public:
   ~TcpSendFile() = default;
   void Send();
   bool Done() const;
+  size_t Remaining() const;
 
 private:
   int peer;
-  os::File file;
+  std::shared_ptr<const os::File> file;
+  off_t offset{0};
   size_t size{0};
 };
 
-using TcpSendOperation = std::variant<TcpSendBuffer, TcpSendFile>;
+using TcpSendOperation = std::variant<TcpSendBuffer, TcpSendShared, TcpSendFile>;
 
 class ConcreteTcpSender final : public TcpSender {
 public:
@@ -54,9 +77,13 @@ public:
   ~ConcreteTcpSender() override;
 
   void Send(std::string_view) override;
+  void Send(std::shared_ptr<const std::string>) override;
   void Send(os::File) override;
+  void Send(std::shared_ptr<const os::File>, size_t, size_t) override;
   void SendBuffered() override;
+  size_t Buffered() const override;
   void Close() override;
+  bool Closing() const override;
 
 private:
   void CloseImpl();
@@ -67,7 +94,8 @@ private:
   TcpSenderSupervisor& supervisor;
   std::deque<TcpSendOperation> buffered;
   bool pending{false};
-  std::mutex senderMut;
+  bool closing{false};
+  mutable std::mutex senderMut;
 };
 
 class TcpConnectionContext {
@@ -81,9 +109,11 @@ public:
 
   TcpProcessor& GetProcessor() const;
   TcpSender& GetSender() const;
+  bool CloseExpired(std::chrono::steady_clock::time_point);
 
 private:
   int fd;
+  std::optional<std::chrono::steady_clock::time_point> closeDeadline;
   std::unique_ptr<TcpProcessor> processor;
   std::unique_ptr<TcpSender> sender;
 };
@@ -100,6 +130,7 @@ public:
   void Start();
   void MarkSenderPending(int) const override;
   void UnmarkSenderPending(int) const override;
+  void MarkSenderClosing(int) const override;
 
 protected:
   virtual int CreateSocket() const = 0;
@@ -113,6 +144,7 @@ private:
   void ReadFromPeer(int);
   void SendToPeer(int) const;
   void MarkReceiverPending(int) const;
+  void CloseExpiredPeers();
 
   std::unique_ptr<TcpProcessorFactory> processorFactory;
   int localDescriptor{-1};
@@ -1,62 +1,157 @@
 #include "websocket.hpp"
 #include <spdlog/spdlog.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include "common.hpp"
 
-namespace network {
+namespace {
 
-std::optional<WebsocketFrame> ConcreteWebsocketParser::Parse(std::string& payload) const {
-  std::uint64_t payloadLen = payload.length();
-  std::uint64_t requiredLen = headerLen;
-  if (payloadLen < requiredLen) {
-    return std::nullopt;
+constexpr std::uint8_t opContinuation = 0x0;
+constexpr std::uint8_t opBinary = 0x2;
+constexpr std::uint8_t opClose = 0x8;
+constexpr std::uint8_t opPing = 0x9;
+constexpr std::uint8_t opPong = 0xa;
+
+constexpr std::uint16_t closeProtocolError = 1002;
+constexpr std::uint16_t closeMessageTooBig = 1009;
+
+void Unmask(char* data, std::uint64_t len, const std::uint8_t (&maskKey)[4]) {
+  std::uint32_t key;
+  memcpy(&key, maskKey, sizeof key);
+  std::uint64_t i = 0;
+#if defined(__AVX2__)
+  const __m256i key256 = _mm256_set1_epi32(key);
+  for (; i + 32 <= len; i += 32) {
+    auto* p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), key256));
   }
-  WebsocketFrame frame;
-  const auto* p = reinterpret_cast<const std::uint8_t*>(payload.data());
-  frame.fin = (p[0] >> 7) & 0b1;
-  frame.opcode = p[0] & 0b1111;
-  bool mask = (p[1] >> 7) & 0b1;
-  std::uint64_t len = p[1] & 0b1111111;
-  p += headerLen;
-  int payloadExtLen = 0;
-  if (len == 126) {
-    payloadExtLen = ext1Len;
+#endif
+#if defined(__SSE2__)
+  const __m128i key128 = _mm_set1_epi32(key);
+  for (; i + 16 <= len; i += 16) {
+    auto* p = reinterpret_cast<__m128i*>(data + i);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), key128));
   }
-  if (len == 127) {
-    payloadExtLen = ext2Len;
+#elif defined(__ARM_NEON)
+  const uint8x16_t key128 = vreinterpretq_u8_u32(vdupq_n_u32(key));
+  for (; i + 16 <= len; i += 16) {
+    auto* p = reinterpret_cast<std::uint8_t*>(data + i);
+    vst1q_u8(p, veorq_u8(vld1q_u8(p), key128));
   }
-  requiredLen += payloadExtLen;
-  if (payloadLen < requiredLen) {
-    return std::nullopt;
+#endif
+  const std::uint64_t key64 = (static_cast<std::uint64_t>(key) << 32) | key;
+  for (; i + 8 <= len; i += 8) {
+    std::uint64_t v;
+    memcpy(&v, data + i, sizeof v);
+    v ^= key64;
+    memcpy(data + i, &v, sizeof v);
   }
-  if (payloadExtLen > 0) {
-    len = 0;
-    for (int i = 0; i < payloadExtLen; i++) {
-      len |= p[i] << (8 * (payloadExtLen - i - 1));
-    }
-    p += payloadExtLen;
+  for (; i < len; i++) {
+    data[i] ^= maskKey[i % 4];
   }
-  std::uint8_t maskKey[maskLen] = {0};
-  if (mask) {
+}
+
+std::string CloseStatus(std::uint16_t status) {
+  std::string payload;
+  payload += common::ToChar(status >> 8);
+  payload += common::ToChar(status);
+  return payload;
+}
+
+}  // namespace
+
+namespace network {
+
+std::optional<WebsocketFrame> ConcreteWebsocketParser::Parse(std::string& payload) {
+  while (not failed) {
+    const std::uint64_t payloadLen = payload.length();
+    std::uint64_t requiredLen = headerLen;
+    if (payloadLen < requiredLen) {
+      return std::nullopt;
+    }
+    const auto* p = reinterpret_cast<const std::uint8_t*>(payload.data());
+    const bool fin = (p[0] >> 7) & 0b1;
+    const std::uint8_t rsv = (p[0] >> 4) & 0b111;
+    const std::uint8_t opcode = p[0] & 0b1111;
+    const bool mask = (p[1] >> 7) & 0b1;
+    std::uint64_t len = p[1] & 0b1111111;
+    p += headerLen;
+    int payloadExtLen = 0;
+    if (len == 126) {
+      payloadExtLen = ext1Len;
+    }
+    if (len == 127) {
+      payloadExtLen = ext2Len;
+    }
+    requiredLen += payloadExtLen;
+    if (payloadLen < requiredLen) {
+      return std::nullopt;
+    }
+    if (payloadExtLen > 0) {
+      len = 0;
+      for (int i = 0; i < payloadExtLen; i++) {
+        len = (len << 8) | p[i];
+      }
+      p += payloadExtLen;
+    }
+    const bool control = opcode & opClose;
+    if (rsv != 0 or not mask or (len >> 63) != 0) {
+      return Fail(closeProtocolError);
+    }
+    if (control and (opcode > opPong or not fin or len > maxControlPayloadLen)) {
+      return Fail(closeProtocolError);
+    }
+    if (not control and (opcode > opBinary or (opcode == opContinuation) != fragmentedOpcode.has_value())) {
+      return Fail(closeProtocolError);
+    }
+    if (not control and fragmentedPayload.size() + len > maxMessageLen) {
+      return Fail(closeMessageTooBig);
+    }
     requiredLen += maskLen;
     if (payloadLen < requiredLen) {
       return std::nullopt;
     }
+    std::uint8_t maskKey[maskLen];
     for (int i = 0; i < maskLen; i++) {
       maskKey[i] = p[i];
     }
-    p += maskLen;
-  }
-  requiredLen += len;
-  if (payloadLen < requiredLen) {
-    return std::nullopt;
-  }
-  std::string data{p, p + len};
-  for (std::uint64_t i = 0; i < len; i++) {
-    reinterpret_cast<std::uint8_t&>(data[i]) ^= maskKey[i % maskLen];
+    requiredLen += len;
+    if (payloadLen < requiredLen) {
+      return std::nullopt;
+    }
+    char* data = payload.data() + (requiredLen - len);
+    Unmask(data, len, maskKey);
+    std::string_view body{data, len};
+    if (control or (fin and opcode != opContinuation)) {
+      WebsocketFrame frame{true, opcode, std::string{body}};
+      payload.erase(0, requiredLen);
+      return frame;
+    }
+    if (opcode != opContinuation) {
+      fragmentedOpcode = opcode;
+    }
+    fragmentedPayload += body;
+    payload.erase(0, requiredLen);
+    if (fin) {
+      WebsocketFrame frame{true, *fragmentedOpcode, std::move(fragmentedPayload)};
+      fragmentedOpcode.reset();
+      fragmentedPayload.clear();
+      return frame;
+    }
   }
-  frame.payload = std::move(data);
-  payload.erase(0, requiredLen);
-  return frame;
+  return std::nullopt;
+}
+
+WebsocketFrame ConcreteWebsocketParser::Fail(std::uint16_t status) {
+  spdlog::error("websocket parse failed: status = {}", status);
+  failed = true;
+  fragmentedOpcode.reset();
+  fragmentedPayload.clear();
+  return WebsocketFrame{true, opClose, CloseStatus(status)};
 }
 
 ConcreteWebsocketSender::ConcreteWebsocketSender(TcpSender& sender) : sender{sender} {
@@ -74,6 +169,10 @@ void ConcreteWebsocketSender::Send(WebsocketFrame&& frame) const {
     payload += common::ToChar(payloadLen);
   } else {
     payload += common::ToChar(127);
+    payload += common::ToChar(payloadLen >> 56);
+    payload += common::ToChar(payloadLen >> 48);
+    payload += common::ToChar(payloadLen >> 40);
+    payload += common::ToChar(payloadLen >> 32);
     payload += common::ToChar(payloadLen >> 24);
     payload += common::ToChar(payloadLen >> 16);
     payload += common::ToChar(payloadLen >> 8);
@@ -83,6 +182,10 @@ void ConcreteWebsocketSender::Send(WebsocketFrame&& frame) const {
   sender.Send(payload);
 }
 
+size_t ConcreteWebsocketSender::Buffered() const {
+  return sender.Buffered();
+}
+
 void ConcreteWebsocketSender::Close() const {
   sender.Close();
 }
@@ -122,12 +225,17 @@ bool WebsocketLayer::TryProcess(std::string& payload) const {
   if (not frame) {
     return false;
   }
-  spdlog::debug("websocket received frame: fin = {}, opcode = {}", frame->fin, frame->opcode);
-  spdlog::debug("websocket received message: {}", frame->payload);
-  constexpr int opClose{8};
-  if (frame->opcode == opClose) {
-    sender.Close();
-    return true;
+  spdlog::debug("websocket received frame: opcode = {}, length = {}", frame->opcode, frame->payload.size());
+  switch (frame->opcode) {
+    case opPing:
+      sender.Send(WebsocketFrame{true, opPong, std::move(frame->payload)});
+      return true;
+    case opPong:
+      return true;
+    case opClose:
+      sender.Send(WebsocketFrame{true, opClose, frame->payload.substr(0, 2)});
+      sender.Close();
+      return true;
   }
   processor.Process(std::move(*frame));
   return true;
@@ -13,13 +13,22 @@ public:
   ConcreteWebsocketParser& operator=(ConcreteWebsocketParser&&) = delete;
   ~ConcreteWebsocketParser() override = default;
 
-  std::optional<WebsocketFrame> Parse(std::string&) const override;
+  std::optional<WebsocketFrame> Parse(std::string&) override;
+
+  static constexpr std::uint64_t maxMessageLen = 16 * 1024 * 1024;
 
 private:
+  WebsocketFrame Fail(std::uint16_t);
+
   static constexpr std::uint8_t headerLen = 2;
   static constexpr std::uint8_t maskLen = 4;
   static constexpr std::uint8_t ext1Len = 2;
   static constexpr std::uint8_t ext2Len = 8;
+  static constexpr std::uint64_t maxControlPayloadLen = 125;
+
+  std::optional<std::uint8_t> fragmentedOpcode;
+  std::string fragmentedPayload;
+  bool failed{false};
 };
 
 class ConcreteWebsocketSender final : public WebsocketSender {
@@ -32,6 +41,7 @@ public:
   ~ConcreteWebsocketSender() override = default;
 
   void Send(WebsocketFrame&&) const override;
+  size_t Buffered() const override;
   void Close() const override;
 
 private:
@@ -1,8 +1,24 @@
 #include "app.hpp"
+#include <pthread.h>
 #include <spdlog/spdlog.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <regex>
 
 namespace {
 
+constexpr std::uint8_t websocketBinaryOpcode = 0x2;
+constexpr int maxQueuedFrames = 2;
+constexpr size_t maxBufferedBytes = 512 * 1024;
+constexpr int hlsPartsPerSecond = 5;
+constexpr size_t hlsMaxSegments = 6;
+constexpr auto hlsIdleTimeout = std::chrono::seconds(30);
+
 network::HttpResponse BuildPlainTextRequest(network::HttpStatus status, std::string_view body) {
   network::HttpResponse resp;
   resp.status = status;
@@ -11,16 +27,63 @@ network::HttpResponse BuildPlainTextRequest(network::HttpStatus status, std::str
   return resp;
 }
 
+network::SharedHttpResponse BuildMediaResponse(std::vector<std::shared_ptr<const std::string>> body) {
+  network::SharedHttpResponse resp;
+  resp.status = network::HttpStatus::OK;
+  resp.headers.emplace("Content-Type", "video/mp4");
+  resp.headers.emplace("Cache-Control", "max-age=60");
+  resp.body = std::move(body);
+  return resp;
+}
+
+std::optional<std::uint64_t> QueryNumber(const network::HttpQuery& query, const std::string& key) {
+  const auto it = query.find(key);
+  if (it == query.end()) {
+    return std::nullopt;
+  }
+  std::uint64_t value;
+  const char* end = it->second.data() + it->second.size();
+  const auto [p, ec] = std::from_chars(it->second.data(), end, value);
+  if (ec != std::errc{} or p != end) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+bool IsRecordingFilename(const std::string& name) {
+  static const std::regex pattern{R"((timelapse\.)?\d{4}(\.\d{2}){5}\.[a-z0-9]+)"};
+  return std::regex_match(name, pattern);
+}
+
+std::string RecordingContentType(const std::string& name) {
+  const auto extension = std::filesystem::path{name}.extension();
+  if (extension == ".mp4") {
+    return "video/mp4";
+  }
+  if (extension == ".mkv") {
+    return "video/x-matroska";
+  }
+  if (extension == ".mpegts" or extension == ".ts") {
+    return "video/mp2t";
+  }
+  return "application/octet-stream";
+}
+
 }  // namespace
 
 namespace application {
 
-AppMjpegSender::AppMjpegSender(AppStreamDistributer& mjpegDistributer, network::HttpSender& sender)
-    : mjpegDistributer{mjpegDistributer}, sender{sender} {
+AppMjpegSender::AppMjpegSender(
+    AppStreamDistributer& mjpegDistributer, AppMjpegVariants& mjpegVariants, network::HttpSender& sender)
+    : mjpegDistributer{mjpegDistributer}, mjpegVariants{mjpegVariants}, sender{sender} {
 }
 
 AppMjpegSender::~AppMjpegSender() {
-  mjpegDistributer.RemoveSubscriber(this);
+  if (variant) {
+    mjpegVariants.Unsubscribe(variant, this);
+  } else {
+    mjpegDistributer.RemoveSubscriber(this);
+  }
 }
 
 void AppMjpegSender::Process(network::HttpRequest&& req) {
@@ -28,31 +91,46 @@ void AppMjpegSender::Process(network::HttpRequest&& req) {
   if (skipIt != req.query.end()) {
     skipCount = std::stoi(skipIt->second);
   }
+  const auto width = QueryNumber(req.query, "width");
+  const auto quality = QueryNumber(req.query, "quality");
   sender.Send(network::MixedReplaceHeaderHttpResponse{});
+  if (width or quality) {
+    constexpr std::uint64_t maxWidth = 1 << 16;
+    constexpr std::uint64_t defaultQuality = 80;
+    variant = mjpegVariants.Subscribe(static_cast<int>(std::min(width.value_or(maxWidth), maxWidth)),
+        static_cast<int>(std::min<std::uint64_t>(quality.value_or(defaultQuality), 100)), this);
+    if (variant) {
+      return;
+    }
+  }
   mjpegDistributer.AddSubscriber(this);
 }
 
-void AppMjpegSender::Notify(std::string_view buffer) {
+void AppMjpegSender::Notify(const codec::PacketBuffer& buffer) {
   if (++skipped <= skipCount) {
     return;
   }
   skipped = 0;
   network::MixedReplaceDataHttpResponse resp;
   resp.headers.emplace("Content-Type", "image/jpeg");
-  resp.body = buffer;
+  resp.body = buffer.View();
   return sender.Send(std::move(resp));
 }
 
-AppMjpegSenderFactory::AppMjpegSenderFactory(AppStreamDistributer& distributer) : distributer{distributer} {
+AppMjpegSenderFactory::AppMjpegSenderFactory(AppStreamDistributer& distributer, AppMjpegVariants& variants)
+    : distributer{distributer}, variants{variants} {
 }
 
 std::unique_ptr<network::HttpProcessor> AppMjpegSenderFactory::Create(network::HttpSender& sender) const {
-  return std::make_unique<AppMjpegSender>(distributer, sender);
+  return std::make_unique<AppMjpegSender>(distributer, variants, sender);
 }
 
-AppEncodedStreamSender::AppEncodedStreamSender(
-    AppStreamDistributer& mjpegDistributer, AppStreamTranscoderFactory& transcoderFactory, network::HttpSender& sender)
-    : mjpegDistributer{mjpegDistributer}, transcoder{transcoderFactory.Create(*this)}, sender{sender} {
+AppEncodedStreamSender::AppEncodedStreamSender(AppStreamDistributer& mjpegDistributer,
+    AppStreamTranscoderFactory& transcoderFactory, AppStreamTranscoderPool& transcoderPool, network::HttpSender& sender)
+    : mjpegDistributer{mjpegDistributer},
+      transcoderPool{transcoderPool},
+      transcoder{transcoderPool.Acquire(transcoderFactory.CreateWriter(*this))},
+      sender{sender} {
   transcoderThread = std::thread([this] { RunTranscoder(); });
 }
 
@@ -60,11 +138,11 @@ AppEncodedStreamSender::~AppEncodedStreamSender() {
   transcoderQueue.Push(std::nullopt);
   mjpegDistributer.RemoveSubscriber(this);
   transcoderThread.join();
-  transcoder.reset();
+  transcoderPool.Release(std::move(transcoder));
 }
 
-void AppEncodedStreamSender::Notify(std::string_view buffer) {
-  transcoderQueue.Push(std::make_optional<std::string>(buffer));
+void AppEncodedStreamSender::Notify(const codec::PacketBuffer& buffer) {
+  transcoderQueue.Push(std::make_optional<codec::PacketBuffer>(buffer));
 }
 
 void AppEncodedStreamSender::WriteData(std::string_view buffer) {
@@ -79,19 +157,277 @@ void AppEncodedStreamSender::Process(network::HttpRequest&&) {
 }
 
 void AppEncodedStreamSender::RunTranscoder() {
-  std::optional<std::string> bufferOpt;
+  std::optional<codec::PacketBuffer> bufferOpt;
   while ((bufferOpt = transcoderQueue.Pop()) != std::nullopt) {
-    transcoder->Process(std::move(*bufferOpt));
+    if (not transcoder->Adapt(sender.Buffered())) {
+      transcoder->Skip();
+      continue;
+    }
+    transcoder->Process(*bufferOpt);
   }
 }
 
-AppEncodedStreamSenderFactory::AppEncodedStreamSenderFactory(
-    AppStreamDistributer& distributer, AppStreamTranscoderFactory& transcoderFactory)
-    : distributer{distributer}, transcoderFactory{transcoderFactory} {
+AppEncodedStreamSenderFactory::AppEncodedStreamSenderFactory(AppStreamDistributer& distributer,
+    AppStreamTranscoderFactory& transcoderFactory, AppStreamTranscoderPool& transcoderPool)
+    : distributer{distributer}, transcoderFactory{transcoderFactory}, transcoderPool{transcoderPool} {
 }
 
 std::unique_ptr<network::HttpProcessor> AppEncodedStreamSenderFactory::Create(network::HttpSender& sender) const {
-  return std::make_unique<AppEncodedStreamSender>(distributer, transcoderFactory, sender);
+  return std::make_unique<AppEncodedStreamSender>(distributer, transcoderFactory, transcoderPool, sender);
+}
+
+AppWebsocketStreamSender::AppWebsocketStreamSender(AppStreamDistributer& mjpegDistributer,
+    AppStreamTranscoderFactory& transcoderFactory, AppStreamTranscoderPool& transcoderPool,
+    network::WebsocketSender& sender)
+    : mjpegDistributer{mjpegDistributer},
+      transcoderPool{transcoderPool},
+      sender{sender},
+      transcoder{transcoderPool.Acquire(transcoderFactory.CreateWriter(*this))} {
+  transcoderThread = std::thread([this] { RunTranscoder(); });
+  mjpegDistributer.AddSubscriber(this);
+}
+
+AppWebsocketStreamSender::~AppWebsocketStreamSender() {
+  transcoderQueue.Push(std::nullopt);
+  mjpegDistributer.RemoveSubscriber(this);
+  transcoderThread.join();
+  transcoderPool.Release(std::move(transcoder));
+}
+
+void AppWebsocketStreamSender::Notify(const codec::PacketBuffer& buffer) {
+  if (transcoderQueue.Size() >= maxQueuedFrames or sender.Buffered() >= maxBufferedBytes) {
+    transcoderQueue.Push(std::make_optional<codec::PacketBuffer>());
+    return;
+  }
+  transcoderQueue.Push(std::make_optional<codec::PacketBuffer>(buffer));
+}
+
+void AppWebsocketStreamSender::WriteData(std::string_view buffer) {
+  message += buffer;
+}
+
+void AppWebsocketStreamSender::Process(network::WebsocketFrame&&) {
+}
+
+void AppWebsocketStreamSender::RunTranscoder() {
+  std::optional<codec::PacketBuffer> bufferOpt;
+  while ((bufferOpt = transcoderQueue.Pop()) != std::nullopt) {
+    if (bufferOpt->Empty() or not transcoder->Adapt(sender.Buffered())) {
+      transcoder->Skip();
+      continue;
+    }
+    transcoder->Process(*bufferOpt);
+    if (not message.empty()) {
+      sender.Send(network::WebsocketFrame{true, websocketBinaryOpcode, std::move(message)});
+      message.clear();
+    }
+  }
+}
+
+AppWebsocketStreamSenderFactory::AppWebsocketStreamSenderFactory(AppStreamDistributer& distributer,
+    AppStreamTranscoderFactory& transcoderFactory, AppStreamTranscoderPool& transcoderPool)
+    : distributer{distributer}, transcoderFactory{transcoderFactory}, transcoderPool{transcoderPool} {
+}
+
+std::unique_ptr<network::WebsocketProcessor> AppWebsocketStreamSenderFactory::Create(
+    network::WebsocketSender& sender) const {
+  return std::make_unique<AppWebsocketStreamSender>(distributer, transcoderFactory, transcoderPool, sender);
+}
+
+AppHlsSegmenter::AppHlsSegmenter(
+    AppStreamDistributer& mjpegDistributer, AppStreamTranscoderFactory& transcoderFactory, int framerate)
+    : mjpegDistributer{mjpegDistributer},
+      transcoderFactory{transcoderFactory},
+      framerate{framerate},
+      framesPerPart{std::max(1, framerate / hlsPartsPerSecond)},
+      partDuration{std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(static_cast<double>(framesPerPart) / framerate))},
+      ring{hlsMaxSegments, static_cast<double>(framesPerPart) / framerate} {
+  monitorThread = std::thread([this] { RunMonitor(); });
+}
+
+AppHlsSegmenter::~AppHlsSegmenter() {
+  {
+    std::lock_guard lock{segmenterMut};
+    stopped = true;
+    Stop();
+  }
+  segmenterCv.notify_one();
+  monitorThread.join();
+}
+
+// the encode runs while there are hls viewers and is started again by the next request after it went idle
+void AppHlsSegmenter::Start() {
+  std::lock_guard lock{segmenterMut};
+  lastRequest = std::chrono::steady_clock::now();
+  if (transcoder or stopped) {
+    return;
+  }
+  spdlog::info("hls segmenter started");
+  transcoder = transcoderFactory.Create(*this);
+  transcoderThread = std::thread([this] { RunTranscoder(); });
+  mjpegDistributer.AddSubscriber(this);
+}
+
+void AppHlsSegmenter::Stop() {
+  if (not transcoder) {
+    return;
+  }
+  mjpegDistributer.RemoveSubscriber(this);
+  transcoderQueue.Push(std::nullopt);
+  transcoderThread.join();
+  transcoder.reset();
+  part.clear();
+  partFrames = 0;
+  ring.Clear();
+  spdlog::info("hls segmenter stopped");
+}
+
+// at most one forced keyframe per part, viewers joining together share it
+void AppHlsSegmenter::ForceKeyframe() {
+  std::lock_guard lock{segmenterMut};
+  const auto now = std::chrono::steady_clock::now();
+  if (not transcoder or now - lastKeyframe < partDuration) {
+    return;
+  }
+  lastKeyframe = now;
+  transcoder->ForceKeyframe();
+}
+
+void AppHlsSegmenter::Notify(const codec::PacketBuffer& buffer) {
+  if (transcoderQueue.Size() >= maxQueuedFrames) {
+    transcoderQueue.Push(std::make_optional<codec::PacketBuffer>());
+    return;
+  }
+  transcoderQueue.Push(std::make_optional<codec::PacketBuffer>(buffer));
+}
+
+void AppHlsSegmenter::WriteData(std::string_view) {
+}
+
+void AppHlsSegmenter::WriteInitSegment(std::string_view buffer) {
+  ring.SetInitSegment(std::string{buffer});
+}
+
+void AppHlsSegmenter::WriteFragment(std::string_view buffer, bool keyframe) {
+  if (keyframe and partFrames > 0) {
+    FlushPart();
+  }
+  if (partFrames == 0) {
+    partIndependent = keyframe;
+  }
+  part += buffer;
+  if (++partFrames >= framesPerPart) {
+    FlushPart();
+  }
+}
+
+network::HlsSegmentRing& AppHlsSegmenter::Ring() {
+  return ring;
+}
+
+void AppHlsSegmenter::RunTranscoder() {
+  std::optional<codec::PacketBuffer> bufferOpt;
+  while ((bufferOpt = transcoderQueue.Pop()) != std::nullopt) {
+    if (bufferOpt->Empty()) {
+      transcoder->Skip();
+      continue;
+    }
+    transcoder->Process(*bufferOpt);
+  }
+}
+
+void AppHlsSegmenter::RunMonitor() {
+  std::unique_lock lock{segmenterMut};
+  while (not stopped) {
+    segmenterCv.wait_for(lock, partDuration);
+    const auto now = std::chrono::steady_clock::now();
+    ring.ExpireWaiters(now);
+    if (transcoder and now - lastRequest > hlsIdleTimeout) {
+      Stop();
+    }
+  }
+}
+
+void AppHlsSegmenter::FlushPart() {
+  ring.AddPart(std::move(part), static_cast<double>(partFrames) / framerate, partIndependent);
+  part.clear();
+  partFrames = 0;
+}
+
+AppHlsSender::AppHlsSender(AppHlsSegmenter& segmenter, network::HttpSender& sender)
+    : segmenter{segmenter}, sender{sender} {
+}
+
+AppHlsSender::~AppHlsSender() {
+  if (waiterId) {
+    segmenter.Ring().Cancel(*waiterId);
+  }
+}
+
+void AppHlsSender::Process(network::HttpRequest&& req) {
+  segmenter.Start();
+  auto& ring = segmenter.Ring();
+  uri = req.uri;
+  sequence = 0;
+  part = 0;
+  if (uri == "/hls/stream.m3u8") {
+    if (const auto msn = QueryNumber(req.query, "_HLS_msn")) {
+      sequence = *msn;
+      part = QueryNumber(req.query, "_HLS_part");
+    } else {
+      // a fresh viewer starts from the next independent part instead of waiting out the GOP
+      segmenter.ForceKeyframe();
+    }
+  } else if (uri == "/hls/segment.m4s" or uri == "/hls/part.m4s") {
+    const auto msn = QueryNumber(req.query, "msn");
+    part = QueryNumber(req.query, "part");
+    if (not msn or part.has_value() != (uri == "/hls/part.m4s")) {
+      return sender.Send(BuildPlainTextRequest(network::HttpStatus::BadRequest, ""));
+    }
+    sequence = *msn;
+  }
+  if (not ring.Reachable(sequence)) {
+    return sender.Send(BuildPlainTextRequest(network::HttpStatus::BadRequest, ""));
+  }
+  waiterId = ring.Wait(sequence, part, [this](bool ready) { Respond(ready); });
+  if (not waiterId) {
+    Respond(true);
+  }
+}
+
+void AppHlsSender::Respond(bool ready) {
+  if (not ready) {
+    return sender.Send(BuildPlainTextRequest(network::HttpStatus::ServiceUnavailable, ""));
+  }
+  auto& ring = segmenter.Ring();
+  if (uri == "/hls/stream.m3u8") {
+    auto resp = BuildPlainTextRequest(network::HttpStatus::OK, ring.Playlist());
+    resp.headers.insert_or_assign("Content-Type", "application/vnd.apple.mpegurl");
+    resp.headers.emplace("Cache-Control", "no-cache");
+    return sender.Send(std::move(resp));
+  }
+  std::vector<std::shared_ptr<const std::string>> body;
+  if (uri == "/hls/init.mp4") {
+    if (auto init = ring.InitSegment()) {
+      body.emplace_back(std::move(init));
+    }
+  } else if (uri == "/hls/segment.m4s") {
+    body = ring.Segment(sequence);
+  } else if (auto data = ring.Part(sequence, *part)) {
+    body.emplace_back(std::move(data));
+  }
+  if (body.empty()) {
+    return sender.Send(BuildPlainTextRequest(network::HttpStatus::NotFound, ""));
+  }
+  sender.Send(BuildMediaResponse(std::move(body)));
+}
+
+AppHlsSenderFactory::AppHlsSenderFactory(AppHlsSegmenter& segmenter) : segmenter{segmenter} {
+}
+
+std::unique_ptr<network::HttpProcessor> AppHlsSenderFactory::Create(network::HttpSender& sender) const {
+  return std::make_unique<AppHlsSender>(segmenter, sender);
 }
 
 AppStreamSnapshotSaver::AppStreamSnapshotSaver(AppStreamDistributer& distributer) : distributer{distributer} {
@@ -102,19 +438,21 @@ AppStreamSnapshotSaver::~AppStreamSnapshotSaver() {
   distributer.RemoveSubscriber(this);
 }
 
-void AppStreamSnapshotSaver::Notify(std::string_view buffer) {
+void AppStreamSnapshotSaver::Notify(const codec::PacketBuffer& buffer) {
   std::lock_guard lock{snapshotMut};
-  snapshot = buffer;
+  snapshot = codec::PacketBuffer{buffer};
 }
 
 std::string AppStreamSnapshotSaver::GetSnapshot() const {
   std::lock_guard lock{snapshotMut};
-  return snapshot;
+  return std::string{snapshot.View()};
 }
 
-AppStreamRecorderController::AppStreamRecorderController(
-    AppStreamDistributer& streamDistributer, common::EventQueue<AppRecorderEvent>& eventQueue)
-    : streamDistributer{streamDistributer}, eventQueue{eventQueue} {
+AppStreamRecorderController::AppStreamRecorderController(AppStreamDistributer& streamDistributer,
+    common::EventQueue<AppRecorderEvent>& eventQueue, const AppStreamRecorderOptions& recorderOptions)
+    : streamDistributer{streamDistributer},
+      eventQueue{eventQueue},
+      preRoll{static_cast<std::int64_t>(recorderOptions.preRollSeconds) * 1000000, recorderOptions.preRollBytes} {
   streamDistributer.AddSubscriber(this);
 }
 
@@ -122,18 +460,26 @@ AppStreamRecorderController::~AppStreamRecorderController() {
   streamDistributer.RemoveSubscriber(this);
 }
 
-void AppStreamRecorderController::Notify(std::string_view buffer) {
+void AppStreamRecorderController::Notify(const codec::PacketBuffer& buffer) {
   std::lock_guard lock{confMut};
   if (not isRecording) {
+    preRoll.Push(buffer);
     return;
   }
-  eventQueue.Push(RecordData{std::string{buffer}});
+  eventQueue.Push(RecordData{buffer});
 }
 
 void AppStreamRecorderController::Start() {
   std::lock_guard lock{confMut};
+  if (isRecording) {
+    return;
+  }
   isRecording = true;
   eventQueue.Push(StartRecording{});
+  // the buffered frames go in ahead of live ones so the recording opens before the trigger
+  for (auto& buffer : preRoll.Drain()) {
+    eventQueue.Push(RecordData{std::move(buffer)});
+  }
 }
 
 void AppStreamRecorderController::Stop() {
@@ -147,15 +493,111 @@ bool AppStreamRecorderController::IsRecording() const {
   return isRecording;
 }
 
-AppHttpLayer::AppHttpLayer(AppStreamSnapshotSaver& snapshotSaver, AppStreamRecorderController& recorderController)
-    : snapshotSaver{snapshotSaver}, processorController{recorderController} {
+AppMotionDetector::AppMotionDetector(AppFrameDistributer& frameDistributer,
+    AppStreamRecorderController& recorderController, const codec::MotionOptions& motionOptions)
+    : frameDistributer{frameDistributer}, recorderController{recorderController}, detector{motionOptions} {
+  frameDistributer.AddSubscriber(this);
 }
 
-void AppHttpLayer::GetIndex(network::HttpRequest&&, network::HttpSender& sender) const {
-  network::FileHttpResponse resp;
-  resp.path = "index.html";
-  resp.headers.emplace("Content-Type", "text/html");
-  return sender.Send(std::move(resp));
+AppMotionDetector::~AppMotionDetector() {
+  frameDistributer.RemoveSubscriber(this);
+}
+
+void AppMotionDetector::Notify(const AVFrame* frame) {
+  const bool wasActive = detector.Active();
+  const bool active = detector.Process(frame->data[0], frame->linesize[0], frame->width, frame->height);
+  if (active and not wasActive) {
+    spdlog::info("motion detected");
+    if (not recorderController.IsRecording()) {
+      recorderController.Start();
+      startedRecording = true;
+    }
+  } else if (wasActive and not active) {
+    spdlog::info("motion ended");
+    if (startedRecording and recorderController.IsRecording()) {
+      recorderController.Stop();
+    }
+    startedRecording = false;
+  }
+}
+
+AppTimelapse::AppTimelapse(AppStreamDistributer& streamDistributer, AppStreamTranscoderFactory& transcoderFactory,
+    const AppTimelapseOptions& options)
+    : streamDistributer{streamDistributer}, transcoderFactory{transcoderFactory}, options{options} {
+  filename = NextFilename();
+  encoderThread = std::thread([this] { RunEncoder(); });
+  streamDistributer.AddSubscriber(this);
+}
+
+AppTimelapse::~AppTimelapse() {
+  streamDistributer.RemoveSubscriber(this);
+  encoderQueue.Push(std::nullopt);
+  encoderThread.join();
+}
+
+// runs on the capturer thread, a sample only takes a reference to the jpeg and everything else happens in RunEncoder
+void AppTimelapse::Notify(const codec::PacketBuffer& buffer) {
+  const auto now = buffer.Timestamp();
+  if (periodStart == 0) {
+    periodStart = now;
+  }
+  if (now - periodStart >= static_cast<std::int64_t>(options.periodSeconds) * 1000000) {
+    filename = NextFilename();
+    periodStart = now;
+  }
+  if (lastSample != 0 and now - lastSample < static_cast<std::int64_t>(options.intervalSeconds) * 1000000) {
+    return;
+  }
+  lastSample = now;
+  if (encoderQueue.Size() >= options.maxPendingSamples) {
+    if (not dropping) {
+      spdlog::warn("timelapse encoder is behind, dropping samples");
+    }
+    dropping = true;
+    return;
+  }
+  dropping = false;
+  encoderQueue.Push(Sample{filename, buffer});
+}
+
+// the encoder only gets cpu time nothing else wants, codec worker threads inherit the policy
+// samples are encoded as they arrive so only the open period's encoder state is held in memory
+void AppTimelapse::RunEncoder() {
+  sched_param param{};
+  if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0 and
+      setpriority(PRIO_PROCESS, gettid(), 19) < 0) {
+    spdlog::error("timelapse setpriority(): {}", strerror(errno));
+  }
+  std::string current;
+  std::unique_ptr<AppStreamTranscoder> transcoder;
+  std::optional<Sample> sample;
+  while ((sample = encoderQueue.Pop()) != std::nullopt) {
+    if (not transcoder or sample->filename != current) {
+      transcoder.reset();
+      current = sample->filename;
+      transcoder = transcoderFactory.Create(current);
+    }
+    transcoder->Process(sample->buffer);
+  }
+}
+
+std::string AppTimelapse::NextFilename() const {
+  const auto now = std::time(nullptr);
+  char buf[50];
+  std::strftime(buf, sizeof buf, "timelapse.%Y.%m.%d.%H.%M.%S.", std::localtime(&now));
+  return buf + options.format;
+}
+
+AppHttpLayer::AppHttpLayer(network::StaticAssetCache& assetCache, AppStreamSnapshotSaver& snapshotSaver,
+    AppStreamRecorderController& recorderController, const os::RecordingIndex& recordingIndex)
+    : assetCache{assetCache},
+      snapshotSaver{snapshotSaver},
+      processorController{recorderController},
+      recordingIndex{recordingIndex} {
+}
+
+void AppHttpLayer::GetIndex(network::HttpRequest&& req, network::HttpSender& sender) const {
+  return sender.Send(assetCache.BuildResponse("index.html", req));
 }
 
 void AppHttpLayer::GetSnapshot(network::HttpRequest&&, network::HttpSender& sender) const {
@@ -181,4 +623,73 @@ void AppHttpLayer::SetRecording(network::HttpRequest&& req, network::HttpSender&
   return sender.Send(BuildPlainTextRequest(network::HttpStatus::OK, "OK"));
 }
 
+void AppHttpLayer::GetRecordings(network::HttpRequest&&, network::HttpSender& sender) const {
+  std::string body = "[";
+  for (const auto& segment : recordingIndex.List()) {
+    if (body.size() > 1) {
+      body += ",";
+    }
+    body += R"({"name":")" + segment.name + R"(","size":)" + std::to_string(segment.size) +
+            R"(,"start":)" + std::to_string(segment.start) + R"(,"end":)" + std::to_string(segment.end) + "}";
+  }
+  body += "]";
+  network::HttpResponse resp;
+  resp.status = network::HttpStatus::OK;
+  resp.headers.emplace("Content-Type", "application/json");
+  resp.body = std::move(body);
+  return sender.Send(std::move(resp));
+}
+
+void AppHttpLayer::GetRecordingFile(network::HttpRequest&& req, network::HttpSender& sender) const {
+  constexpr std::string_view prefix = "/recordings/";
+  auto name = req.uri.substr(prefix.size());
+  if (not IsRecordingFilename(name)) {
+    return sender.Send(BuildPlainTextRequest(network::HttpStatus::NotFound, "Not Found"));
+  }
+  network::FileHttpResponse resp;
+  resp.headers.emplace("Content-Type", RecordingContentType(name));
+  resp.path = std::move(name);
+  if (auto it = req.headers.find("range"); it != req.headers.end()) {
+    resp.range = std::move(it->second);
+  }
+  if (auto it = req.headers.find("if-range"); it != req.headers.end()) {
+    resp.ifRange = std::move(it->second);
+  }
+  return sender.Send(std::move(resp));
+}
+
+// serves the init segment and then the fragments from the keyframe before from without touching the frames, a range
+// running past the segment carries where the next request should continue
+void AppHttpLayer::GetPlayback(network::HttpRequest&& req, network::HttpSender& sender) const {
+  const auto from = QueryNumber(req.query, "from");
+  const auto to = QueryNumber(req.query, "to");
+  if (not from or not to or *from >= *to) {
+    return sender.Send(BuildPlainTextRequest(network::HttpStatus::BadRequest, "Bad Request"));
+  }
+  const auto segments = recordingIndex.Find(static_cast<std::int64_t>(*from), static_cast<std::int64_t>(*to));
+  if (segments.empty()) {
+    return sender.Send(BuildPlainTextRequest(network::HttpStatus::NotFound, "Not Found"));
+  }
+  const auto& segment = segments.front();
+  network::FileHttpResponse resp;
+  resp.headers.emplace("Content-Type", RecordingContentType(segment.name));
+  resp.path = segment.name;
+  std::int64_t start = segment.start;
+  const auto fragments = os::ReadFragmentIndex(segment.name + ".idx");
+  const auto span = os::FindFragmentSpan(fragments, static_cast<std::int64_t>(*from) - segment.start,
+      static_cast<std::int64_t>(*to) - segment.start);
+  if (span) {
+    if (fragments.front().offset > 0) {
+      resp.parts.emplace_back(network::HttpByteRange{0, fragments.front().offset});
+    }
+    resp.parts.emplace_back(network::HttpByteRange{span->offset, span->length});
+    start += span->time;
+  }
+  resp.headers.emplace("X-Playback-Start", std::to_string(start));
+  if (segment.end < static_cast<std::int64_t>(*to)) {
+    resp.headers.emplace("X-Playback-Next", std::to_string(segment.end));
+  }
+  return sender.Send(std::move(resp));
+}
+
 }  // namespace application
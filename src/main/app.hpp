@@ -1,22 +1,28 @@
 #pragma once
 #include <atomic>
 #include <mutex>
+#include "asset.hpp"
 #include "codec.hpp"
 #include "event_queue.hpp"
+#include "hls.hpp"
+#include "motion.hpp"
 #include "network.hpp"
+#include "recording.hpp"
 #include "stream.hpp"
 
 namespace application {
 
 class AppMjpegSender : public AppStreamReceiver, public network::HttpProcessor {
 public:
-  AppMjpegSender(AppStreamDistributer&, network::HttpSender&);
+  AppMjpegSender(AppStreamDistributer&, AppMjpegVariants&, network::HttpSender&);
   ~AppMjpegSender() override;
-  void Notify(std::string_view) override;
+  void Notify(const codec::PacketBuffer&) override;
   void Process(network::HttpRequest&&) override;
 
 private:
   AppStreamDistributer& mjpegDistributer;
+  AppMjpegVariants& mjpegVariants;
+  AppMjpegVariant* variant{nullptr};
   network::HttpSender& sender;
   int skipped{0};
   std::atomic<int> skipCount{0};
@@ -24,18 +30,20 @@ private:
 
 class AppMjpegSenderFactory : public network::HttpProcessorFactory {
 public:
-  explicit AppMjpegSenderFactory(AppStreamDistributer&);
+  AppMjpegSenderFactory(AppStreamDistributer&, AppMjpegVariants&);
   std::unique_ptr<network::HttpProcessor> Create(network::HttpSender&) const override;
 
 private:
   AppStreamDistributer& distributer;
+  AppMjpegVariants& variants;
 };
 
 class AppEncodedStreamSender : public AppStreamReceiver, public codec::WriterProcessor, public network::HttpProcessor {
 public:
-  AppEncodedStreamSender(AppStreamDistributer&, AppStreamTranscoderFactory&, network::HttpSender&);
+  AppEncodedStreamSender(
+      AppStreamDistributer&, AppStreamTranscoderFactory&, AppStreamTranscoderPool&, network::HttpSender&);
   ~AppEncodedStreamSender() override;
-  void Notify(std::string_view) override;
+  void Notify(const codec::PacketBuffer&) override;
   void WriteData(std::string_view) override;
   void Process(network::HttpRequest&&) override;
 
@@ -43,40 +51,141 @@ private:
   void RunTranscoder();
 
   AppStreamDistributer& mjpegDistributer;
+  AppStreamTranscoderPool& transcoderPool;
   std::unique_ptr<AppStreamTranscoder> transcoder;
   network::HttpSender& sender;
-  common::ConcreteEventQueue<std::optional<std::string>> transcoderQueue;
+  common::ConcreteEventQueue<std::optional<codec::PacketBuffer>> transcoderQueue;
   std::thread transcoderThread;
 };
 
 class AppEncodedStreamSenderFactory : public network::HttpProcessorFactory {
 public:
-  AppEncodedStreamSenderFactory(AppStreamDistributer&, AppStreamTranscoderFactory&);
+  AppEncodedStreamSenderFactory(AppStreamDistributer&, AppStreamTranscoderFactory&, AppStreamTranscoderPool&);
   std::unique_ptr<network::HttpProcessor> Create(network::HttpSender&) const override;
 
 private:
   AppStreamDistributer& distributer;
   AppStreamTranscoderFactory& transcoderFactory;
+  AppStreamTranscoderPool& transcoderPool;
+};
+
+class AppWebsocketStreamSender : public AppStreamReceiver,
+                                 public codec::WriterProcessor,
+                                 public network::WebsocketProcessor {
+public:
+  AppWebsocketStreamSender(
+      AppStreamDistributer&, AppStreamTranscoderFactory&, AppStreamTranscoderPool&, network::WebsocketSender&);
+  ~AppWebsocketStreamSender() override;
+  void Notify(const codec::PacketBuffer&) override;
+  void WriteData(std::string_view) override;
+  void Process(network::WebsocketFrame&&) override;
+
+private:
+  void RunTranscoder();
+
+  AppStreamDistributer& mjpegDistributer;
+  AppStreamTranscoderPool& transcoderPool;
+  network::WebsocketSender& sender;
+  std::string message;
+  std::unique_ptr<AppStreamTranscoder> transcoder;
+  common::ConcreteEventQueue<std::optional<codec::PacketBuffer>> transcoderQueue;
+  std::thread transcoderThread;
+};
+
+class AppWebsocketStreamSenderFactory : public network::WebsocketProcessorFactory {
+public:
+  AppWebsocketStreamSenderFactory(AppStreamDistributer&, AppStreamTranscoderFactory&, AppStreamTranscoderPool&);
+  std::unique_ptr<network::WebsocketProcessor> Create(network::WebsocketSender&) const override;
+
+private:
+  AppStreamDistributer& distributer;
+  AppStreamTranscoderFactory& transcoderFactory;
+  AppStreamTranscoderPool& transcoderPool;
+};
+
+class AppHlsSegmenter : public AppStreamReceiver, public codec::WriterProcessor {
+public:
+  AppHlsSegmenter(AppStreamDistributer&, AppStreamTranscoderFactory&, int);
+  ~AppHlsSegmenter() override;
+  void Start();
+  void ForceKeyframe();
+  void Notify(const codec::PacketBuffer&) override;
+  void WriteData(std::string_view) override;
+  void WriteInitSegment(std::string_view) override;
+  void WriteFragment(std::string_view, bool) override;
+  network::HlsSegmentRing& Ring();
+
+private:
+  void RunTranscoder();
+  void RunMonitor();
+  void Stop();
+  void FlushPart();
+
+  AppStreamDistributer& mjpegDistributer;
+  AppStreamTranscoderFactory& transcoderFactory;
+  int framerate;
+  int framesPerPart;
+  std::chrono::steady_clock::duration partDuration;
+  network::HlsSegmentRing ring;
+  std::string part;
+  int partFrames{0};
+  bool partIndependent{false};
+  std::unique_ptr<AppStreamTranscoder> transcoder;
+  common::ConcreteEventQueue<std::optional<codec::PacketBuffer>> transcoderQueue;
+  std::thread transcoderThread;
+  std::chrono::steady_clock::time_point lastRequest;
+  std::chrono::steady_clock::time_point lastKeyframe;
+  bool stopped{false};
+  std::mutex segmenterMut;
+  std::condition_variable segmenterCv;
+  std::thread monitorThread;
+};
+
+class AppHlsSender : public network::HttpProcessor {
+public:
+  AppHlsSender(AppHlsSegmenter&, network::HttpSender&);
+  ~AppHlsSender() override;
+  void Process(network::HttpRequest&&) override;
+
+private:
+  void Respond(bool);
+
+  AppHlsSegmenter& segmenter;
+  network::HttpSender& sender;
+  std::string uri;
+  std::uint64_t sequence{0};
+  std::optional<std::uint64_t> part;
+  std::optional<std::uint64_t> waiterId;
+};
+
+class AppHlsSenderFactory : public network::HttpProcessorFactory {
+public:
+  explicit AppHlsSenderFactory(AppHlsSegmenter&);
+  std::unique_ptr<network::HttpProcessor> Create(network::HttpSender&) const override;
+
+private:
+  AppHlsSegmenter& segmenter;
 };
 
 class AppStreamSnapshotSaver : public AppStreamReceiver {
 public:
   explicit AppStreamSnapshotSaver(AppStreamDistributer&);
   ~AppStreamSnapshotSaver() override;
-  void Notify(std::string_view) override;
+  void Notify(const codec::PacketBuffer&) override;
   std::string GetSnapshot() const;
 
 private:
   AppStreamDistributer& distributer;
-  std::string snapshot;
+  codec::PacketBuffer snapshot;
   mutable std::mutex snapshotMut;
 };
 
 class AppStreamRecorderController : public AppStreamReceiver {
 public:
-  explicit AppStreamRecorderController(AppStreamDistributer&, common::EventQueue<AppRecorderEvent>&);
+  AppStreamRecorderController(
+      AppStreamDistributer&, common::EventQueue<AppRecorderEvent>&, const AppStreamRecorderOptions&);
   ~AppStreamRecorderController() override;
-  void Notify(std::string_view) override;
+  void Notify(const codec::PacketBuffer&) override;
   void Start();
   void Stop();
   bool IsRecording() const;
@@ -84,13 +193,61 @@ public:
 private:
   AppStreamDistributer& streamDistributer;
   common::EventQueue<AppRecorderEvent>& eventQueue;
+  codec::PacketBufferRing preRoll;
   bool isRecording{false};
   mutable std::mutex confMut;
 };
 
+class AppMotionDetector : public AppFrameReceiver {
+public:
+  AppMotionDetector(AppFrameDistributer&, AppStreamRecorderController&, const codec::MotionOptions&);
+  ~AppMotionDetector() override;
+  void Notify(const AVFrame*) override;
+
+private:
+  AppFrameDistributer& frameDistributer;
+  AppStreamRecorderController& recorderController;
+  codec::MotionDetector detector;
+  bool startedRecording{false};
+};
+
+struct AppTimelapseOptions {
+  std::string format;
+  std::uint32_t intervalSeconds{30};
+  std::uint32_t periodSeconds{24 * 3600};
+  int maxPendingSamples{16};
+};
+
+class AppTimelapse : public AppStreamReceiver {
+public:
+  AppTimelapse(AppStreamDistributer&, AppStreamTranscoderFactory&, const AppTimelapseOptions&);
+  ~AppTimelapse() override;
+  void Notify(const codec::PacketBuffer&) override;
+
+private:
+  struct Sample {
+    std::string filename;
+    codec::PacketBuffer buffer;
+  };
+
+  void RunEncoder();
+  std::string NextFilename() const;
+
+  AppStreamDistributer& streamDistributer;
+  AppStreamTranscoderFactory& transcoderFactory;
+  const AppTimelapseOptions options;
+  std::string filename;
+  std::int64_t periodStart{0};
+  std::int64_t lastSample{0};
+  bool dropping{false};
+  common::ConcreteEventQueue<std::optional<Sample>> encoderQueue;
+  std::thread encoderThread;
+};
+
 class AppHttpLayer {
 public:
-  AppHttpLayer(AppStreamSnapshotSaver&, AppStreamRecorderController&);
+  AppHttpLayer(
+      network::StaticAssetCache&, AppStreamSnapshotSaver&, AppStreamRecorderController&, const os::RecordingIndex&);
   AppHttpLayer(const AppHttpLayer&) = delete;
   AppHttpLayer(AppHttpLayer&&) = delete;
   AppHttpLayer& operator=(const AppHttpLayer&) = delete;
@@ -101,10 +258,15 @@ public:
   void GetSnapshot(network::HttpRequest&&, network::HttpSender&) const;
   void GetRecording(network::HttpRequest&&, network::HttpSender&) const;
   void SetRecording(network::HttpRequest&&, network::HttpSender&) const;
+  void GetRecordings(network::HttpRequest&&, network::HttpSender&) const;
+  void GetRecordingFile(network::HttpRequest&&, network::HttpSender&) const;
+  void GetPlayback(network::HttpRequest&&, network::HttpSender&) const;
 
 private:
+  network::StaticAssetCache& assetCache;
   AppStreamSnapshotSaver& snapshotSaver;
   AppStreamRecorderController& processorController;
+  const os::RecordingIndex& recordingIndex;
 };
 
 }  // namespace application
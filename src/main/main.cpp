@@ -1,14 +1,56 @@
 #include <spdlog/spdlog.h>
 #include <yaml-cpp/yaml.h>
+#include <algorithm>
 #include <thread>
 #include "app.hpp"
+#include "asset.hpp"
 #include "codec.hpp"
 #include "event_queue.hpp"
+#include "file.hpp"
 #include "network.hpp"
+#include "recording.hpp"
 #include "server.hpp"
 #include "stream.hpp"
 #include "video.hpp"
 
+namespace {
+
+void ReadEncoderTuning(const YAML::Node& node, codec::EncoderOptions& options) {
+  options.bitrateTolerance = node["bitrateTolerance"].as<double>(options.bitrateTolerance);
+  options.maxBitrate = node["maxBitrate"].as<int>(options.maxBitrate);
+  options.bufferSize = node["bufferSize"].as<int>(options.bufferSize);
+  options.gopSize = node["gopSize"].as<int>(options.gopSize);
+  options.maxBFrames = node["maxBFrames"].as<int>(options.maxBFrames);
+  options.preset = node["preset"].as<std::string>(options.preset);
+  options.tune = node["tune"].as<std::string>(options.tune);
+  options.crf = node["crf"].as<float>(options.crf);
+  options.intraRefresh = node["intraRefresh"].as<bool>(options.intraRefresh);
+  options.codecOptions = node["codecOptions"].as<std::string>(options.codecOptions);
+}
+
+void ReadFileOptions(const YAML::Node& node, os::AsyncFileOptions& options) {
+  options.bufferSize = node["writeBufferSize"].as<size_t>(options.bufferSize);
+  options.maxBuffers = node["writeBuffers"].as<int>(options.maxBuffers);
+  options.preallocateBytes = node["preallocateBytes"].as<size_t>(options.preallocateBytes);
+  options.syncBytes = node["syncBytes"].as<size_t>(options.syncBytes);
+}
+
+std::vector<codec::MotionRegion> ReadMotionRegions(const YAML::Node& node, double threshold) {
+  std::vector<codec::MotionRegion> regions;
+  for (const auto& entry : node) {
+    codec::MotionRegion region;
+    region.x = entry["x"].as<double>(region.x);
+    region.y = entry["y"].as<double>(region.y);
+    region.width = entry["width"].as<double>(region.width);
+    region.height = entry["height"].as<double>(region.height);
+    region.threshold = entry["threshold"].as<double>(threshold);
+    regions.emplace_back(region);
+  }
+  return regions;
+}
+
+}  // namespace
+
 int main() {
   spdlog::set_level(spdlog::level::off);
   codec::DisableCodecLogs();
@@ -23,30 +65,86 @@ int main() {
   auto capturerFramerate = config["capturer"]["framerate"].as<int>();
   auto recorderCodec = config["recorder"]["codec"].as<std::string>();
   auto recorderPixfmt = config["recorder"]["pixfmt"].as<std::string>();
+  auto recorderMode = config["recorder"]["mode"].as<std::string>("transcode");
   auto recorderFormat = config["recorder"]["format"].as<std::string>();
+  auto recorderCopyFormat = config["recorder"]["copyFormat"].as<std::string>("mkv");
+  auto recorderFragmented = config["recorder"]["fragmented"].as<bool>(false);
   auto recorderWidth = config["recorder"]["width"].as<int>();
   auto recorderHeight = config["recorder"]["height"].as<int>();
   auto recorderBitrate = config["recorder"]["bitrate"].as<int>();
   auto maxRecordingTimeInSeconds = config["recorder"]["maxRecordingTimeInSeconds"].as<int>();
+  auto recorderThreads = config["recorder"]["threads"].as<int>(0);
+  auto recorderThreadType = config["recorder"]["threadType"].as<std::string>("frame");
   auto encoderCodec = config["encoder"]["codec"].as<std::string>();
   auto encoderPixfmt = config["encoder"]["pixfmt"].as<std::string>();
   auto encoderFormat = config["encoder"]["format"].as<std::string>();
   auto encoderWidth = config["encoder"]["width"].as<int>();
   auto encoderHeight = config["encoder"]["height"].as<int>();
   auto encoderBitrate = config["encoder"]["bitrate"].as<int>();
+  auto encoderFragment = config["encoder"]["fragment"].as<std::string>("none");
+  auto encoderThreads = config["encoder"]["threads"].as<int>(0);
+  auto encoderThreadType = config["encoder"]["threadType"].as<std::string>("lowlatency");
+  auto encoderPoolSize = config["encoder"]["poolSize"].as<size_t>(1);
+  auto encoderAdaptiveBitrate = config["encoder"]["adaptiveBitrate"].as<bool>(false);
 
   application::AppStreamRecorderOptions streamRecorderOptions;
-  streamRecorderOptions.format = recorderFormat;
+  streamRecorderOptions.format = recorderMode == "copy" ? recorderCopyFormat : recorderFormat;
   streamRecorderOptions.maxRecordingTimeInSeconds = maxRecordingTimeInSeconds;
   streamRecorderOptions.saveRecord = false;
+  streamRecorderOptions.preRollSeconds = config["recorder"]["preRollSeconds"].as<std::uint32_t>(0);
+  streamRecorderOptions.preRollBytes = config["recorder"]["preRollBytes"].as<size_t>(16 * 1024 * 1024);
+
+  application::AppRecordingRetentionOptions retentionOptions;
+  retentionOptions.quotaBytes = config["recorder"]["quotaBytes"].as<std::uint64_t>(0);
+  retentionOptions.maxAgeSeconds = config["recorder"]["maxAgeHours"].as<std::uint32_t>(0) * 3600;
 
   video::CapturerOptions capturerOptions;
   capturerOptions.width = capturerWidth;
   capturerOptions.height = capturerHeight;
   capturerOptions.framerate = capturerFramerate;
 
-  codec::DecoderOptions decoderOptions;
-  decoderOptions.codec = capturerCodec;
+  std::optional<codec::OverlayOptions> overlayOptions;
+  if (auto overlay = config["overlay"]) {
+    overlayOptions.emplace();
+    overlayOptions->fontfile = overlay["fontfile"].as<std::string>();
+    overlayOptions->fontSize = overlay["fontSize"].as<int>(overlayOptions->fontSize);
+    overlayOptions->format = overlay["format"].as<std::string>(overlayOptions->format);
+    overlayOptions->x = overlay["x"].as<int>(overlayOptions->x);
+    overlayOptions->y = overlay["y"].as<int>(overlayOptions->y);
+    overlayOptions->color = std::stoul(overlay["color"].as<std::string>("ffff00"), nullptr, 16);
+  }
+
+  codec::DecoderOptions recorderDecoderOptions;
+  recorderDecoderOptions.codec = capturerCodec;
+  recorderDecoderOptions.threadCount = recorderThreads;
+  recorderDecoderOptions.threadType = recorderThreadType;
+
+  auto analyticsCodec = config["analytics"]["codec"].as<std::string>("mjpeg");
+  auto analyticsLowres = config["analytics"]["lowres"].as<int>(0);
+  auto analyticsFramerate = std::clamp(config["analytics"]["framerate"].as<int>(5), 1, capturerFramerate);
+
+  codec::DecoderOptions analyticsDecoderOptions;
+  analyticsDecoderOptions.codec = analyticsCodec;
+  analyticsDecoderOptions.threadCount = 1;
+  analyticsDecoderOptions.lowres = analyticsLowres;
+
+  std::optional<codec::MotionOptions> motionOptions;
+  if (auto motion = config["motion"]) {
+    motionOptions.emplace();
+    motionOptions->scale = motion["scale"].as<int>(motionOptions->scale);
+    motionOptions->sensitivity = motion["sensitivity"].as<int>(motionOptions->sensitivity);
+    motionOptions->backgroundShift = motion["backgroundShift"].as<int>(motionOptions->backgroundShift);
+    motionOptions->threshold = motion["threshold"].as<double>(motionOptions->threshold);
+    motionOptions->triggerFrames = motion["triggerFrames"].as<int>(motionOptions->triggerFrames);
+    motionOptions->releaseFrames = motion["holdSeconds"].as<int>(10) * analyticsFramerate;
+    motionOptions->zones = ReadMotionRegions(motion["zones"], motionOptions->threshold);
+    motionOptions->masks = ReadMotionRegions(motion["masks"], motionOptions->threshold);
+  }
+
+  codec::DecoderOptions encodedStreamDecoderOptions;
+  encodedStreamDecoderOptions.codec = capturerCodec;
+  encodedStreamDecoderOptions.threadCount = encoderThreads;
+  encodedStreamDecoderOptions.threadType = encoderThreadType;
 
   codec::FilterOptions recorderFilterOptions;
   recorderFilterOptions.width = recorderWidth;
@@ -54,9 +152,9 @@ int main() {
   recorderFilterOptions.framerate = capturerOptions.framerate;
   recorderFilterOptions.inFormat = capturerPixfmt;
   recorderFilterOptions.outFormat = recorderPixfmt;
-  recorderFilterOptions.description =
-      "drawtext=fontfile=/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
-      ":text='%{localtime}':fontcolor=yellow:x=10:y=10";
+  recorderFilterOptions.description = "null";
+  recorderFilterOptions.overlay = overlayOptions;
+  recorderFilterOptions.threadCount = recorderThreads;
 
   codec::EncoderOptions recorderEncoderOptions;
   recorderEncoderOptions.codec = recorderCodec;
@@ -65,6 +163,9 @@ int main() {
   recorderEncoderOptions.height = recorderFilterOptions.height;
   recorderEncoderOptions.framerate = recorderFilterOptions.framerate;
   recorderEncoderOptions.bitrate = recorderBitrate;
+  recorderEncoderOptions.threadCount = recorderThreads;
+  recorderEncoderOptions.threadType = recorderThreadType;
+  ReadEncoderTuning(config["recorder"], recorderEncoderOptions);
 
   codec::WriterOptions recorderWriterOptions;
   recorderWriterOptions.format = recorderFormat;
@@ -73,6 +174,48 @@ int main() {
   recorderWriterOptions.height = recorderEncoderOptions.height;
   recorderWriterOptions.framerate = recorderEncoderOptions.framerate;
   recorderWriterOptions.bitrate = recorderEncoderOptions.bitrate;
+  recorderWriterOptions.file.preallocateBytes = static_cast<size_t>(recorderBitrate) / 8 * maxRecordingTimeInSeconds;
+  ReadFileOptions(config["recorder"], recorderWriterOptions.file);
+  if (recorderFragmented) {
+    // fragments are cut at keyframes and the mfra trailer is left out so closing a file writes nothing more
+    recorderWriterOptions.fragment = codec::WriterFragment::Gop;
+    recorderWriterOptions.formatOptions = "movflags=empty_moov+delay_moov+default_base_moof+frag_custom+skip_trailer";
+  }
+
+  codec::WriterOptions recorderCopyWriterOptions;
+  recorderCopyWriterOptions.format = recorderCopyFormat;
+  recorderCopyWriterOptions.codec = "mjpeg";
+  recorderCopyWriterOptions.width = capturerOptions.width;
+  recorderCopyWriterOptions.height = capturerOptions.height;
+  recorderCopyWriterOptions.framerate = capturerOptions.framerate;
+  recorderCopyWriterOptions.bitrate = 0;
+  ReadFileOptions(config["recorder"], recorderCopyWriterOptions.file);
+
+  std::optional<application::AppTimelapseOptions> timelapseOptions;
+  codec::DecoderOptions timelapseDecoderOptions = recorderDecoderOptions;
+  codec::FilterOptions timelapseFilterOptions = recorderFilterOptions;
+  codec::EncoderOptions timelapseEncoderOptions = recorderEncoderOptions;
+  codec::WriterOptions timelapseWriterOptions = recorderWriterOptions;
+  if (auto timelapse = config["timelapse"]) {
+    timelapseOptions.emplace();
+    timelapseOptions->format = recorderFormat;
+    timelapseOptions->intervalSeconds = timelapse["intervalSeconds"].as<std::uint32_t>(30);
+    timelapseOptions->periodSeconds = timelapse["periodHours"].as<std::uint32_t>(24) * 3600;
+    timelapseOptions->maxPendingSamples =
+        timelapse["maxPendingSamples"].as<int>(timelapseOptions->maxPendingSamples);
+    const auto timelapseFramerate = timelapse["framerate"].as<int>(30);
+    timelapseDecoderOptions.threadCount = 1;
+    timelapseFilterOptions.framerate = timelapseFramerate;
+    timelapseFilterOptions.threadCount = 1;
+    timelapseEncoderOptions.framerate = timelapseFramerate;
+    timelapseEncoderOptions.threadCount = 1;
+    timelapseWriterOptions.framerate = timelapseFramerate;
+    // a period stays open for hours, the muxer fragments at every keyframe so a crash loses only the last gop
+    timelapseWriterOptions.fragment = codec::WriterFragment::None;
+    timelapseWriterOptions.formatOptions =
+        recorderFormat == "mp4" ? "movflags=empty_moov+default_base_moof+frag_keyframe" : "";
+    timelapseWriterOptions.file.preallocateBytes = 0;
+  }
 
   codec::FilterOptions encodedStreamFilterOptions;
   encodedStreamFilterOptions.width = encoderWidth;
@@ -80,9 +223,9 @@ int main() {
   encodedStreamFilterOptions.framerate = capturerOptions.framerate;
   encodedStreamFilterOptions.inFormat = capturerPixfmt;
   encodedStreamFilterOptions.outFormat = encoderPixfmt;
-  encodedStreamFilterOptions.description =
-      "drawtext=fontfile=/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
-      ":text='%{localtime}':fontcolor=yellow:x=10:y=10";
+  encodedStreamFilterOptions.description = "null";
+  encodedStreamFilterOptions.overlay = overlayOptions;
+  encodedStreamFilterOptions.threadCount = encoderThreads;
 
   codec::EncoderOptions encodedStreamEncoderOptions;
   encodedStreamEncoderOptions.codec = encoderCodec;
@@ -91,6 +234,19 @@ int main() {
   encodedStreamEncoderOptions.height = encodedStreamFilterOptions.height;
   encodedStreamEncoderOptions.framerate = encodedStreamFilterOptions.framerate;
   encodedStreamEncoderOptions.bitrate = encoderBitrate;
+  encodedStreamEncoderOptions.threadCount = encoderThreads;
+  encodedStreamEncoderOptions.threadType = encoderThreadType;
+  ReadEncoderTuning(config["encoder"], encodedStreamEncoderOptions);
+
+  std::optional<codec::RateControlOptions> encodedStreamRateControlOptions;
+  if (encoderAdaptiveBitrate) {
+    codec::RateControlOptions options;
+    options.maxBitrate = encoderBitrate;
+    options.minBitrate = std::min(encoderBitrate, config["encoder"]["minBitrate"].as<int>(encoderBitrate / 4));
+    options.highWatermark = config["encoder"]["highWatermark"].as<size_t>(options.highWatermark);
+    options.lowWatermark = config["encoder"]["lowWatermark"].as<size_t>(options.lowWatermark);
+    encodedStreamRateControlOptions = options;
+  }
 
   codec::WriterOptions encodedStreamWriterOptions;
   encodedStreamWriterOptions.format = encoderFormat;
@@ -99,30 +255,90 @@ int main() {
   encodedStreamWriterOptions.height = encodedStreamEncoderOptions.height;
   encodedStreamWriterOptions.framerate = encodedStreamEncoderOptions.framerate;
   encodedStreamWriterOptions.bitrate = encodedStreamEncoderOptions.bitrate;
+  if (encoderFragment == "frame") {
+    encodedStreamWriterOptions.fragment = codec::WriterFragment::Frame;
+  } else if (encoderFragment == "gop") {
+    encodedStreamWriterOptions.fragment = codec::WriterFragment::Gop;
+  }
+  // fragments are cut as cmaf moof boxes, any other muxer would ignore them
+  if (encodedStreamWriterOptions.fragment != codec::WriterFragment::None and encoderFormat != "mp4") {
+    spdlog::warn("encoder.fragment {} needs the mp4 format, using mp4 instead of {}", encoderFragment, encoderFormat);
+    encodedStreamWriterOptions.format = "mp4";
+  }
+
+  codec::WriterOptions websocketStreamWriterOptions = encodedStreamWriterOptions;
+  websocketStreamWriterOptions.format = "mp4";
+  websocketStreamWriterOptions.fragment = codec::WriterFragment::Frame;
+
+  codec::WriterOptions hlsWriterOptions = websocketStreamWriterOptions;
 
   application::AppStreamDistributer mjpegDistributer;
   application::AppStreamCapturerRunner capturerRunner{capturerOptions, mjpegDistributer};
   capturerRunner.Run();
 
+  os::RecordingIndex recordingIndex{"recordings.idx"};
+  application::AppRecordingRetention recordingRetention{recordingIndex, retentionOptions};
+
   common::ConcreteEventQueue<application::AppRecorderEvent> recorderEventQueue;
-  application::AppStreamTranscoderFactory recorderTranscoderFactory{
-      decoderOptions, recorderFilterOptions, recorderEncoderOptions, recorderWriterOptions};
+  auto recorderTranscoderFactory = recorderMode == "copy"
+                                       ? application::AppStreamTranscoderFactory{recorderCopyWriterOptions}
+                                       : application::AppStreamTranscoderFactory{recorderDecoderOptions,
+                                             recorderFilterOptions, recorderEncoderOptions, recorderWriterOptions};
   application::AppStreamRecorderRunner recorderRunner{
-      recorderEventQueue, streamRecorderOptions, recorderTranscoderFactory};
+      recorderEventQueue, streamRecorderOptions, recorderTranscoderFactory, recordingIndex};
   recorderRunner.Run();
 
+  application::AppMjpegVariantOptions mjpegVariantOptions;
+  mjpegVariantOptions.width = capturerOptions.width;
+  mjpegVariantOptions.height = capturerOptions.height;
+  mjpegVariantOptions.framerate = capturerOptions.framerate;
+  mjpegVariantOptions.pixfmt = config["mjpegVariants"]["pixfmt"].as<std::string>(mjpegVariantOptions.pixfmt);
+  mjpegVariantOptions.maxVariants = config["mjpegVariants"]["maxVariants"].as<size_t>(mjpegVariantOptions.maxVariants);
+  application::AppMjpegVariants mjpegVariants{mjpegDistributer, mjpegVariantOptions};
+
   application::AppStreamSnapshotSaver snapshotSaver{mjpegDistributer};
-  application::AppStreamRecorderController recorderController{mjpegDistributer, recorderEventQueue};
-  application::AppStreamTranscoderFactory encodedStreamTranscoderFactory{
-      decoderOptions, encodedStreamFilterOptions, encodedStreamEncoderOptions, encodedStreamWriterOptions};
+  application::AppStreamRecorderController recorderController{
+      mjpegDistributer, recorderEventQueue, streamRecorderOptions};
+  application::AppFrameDistributer analyticsDistributer{
+      mjpegDistributer, analyticsDecoderOptions, capturerFramerate / analyticsFramerate};
+  std::unique_ptr<application::AppMotionDetector> motionDetector;
+  if (motionOptions) {
+    motionDetector =
+        std::make_unique<application::AppMotionDetector>(analyticsDistributer, recorderController, *motionOptions);
+  }
+  application::AppStreamTranscoderFactory timelapseTranscoderFactory{
+      timelapseDecoderOptions, timelapseFilterOptions, timelapseEncoderOptions, timelapseWriterOptions};
+  std::unique_ptr<application::AppTimelapse> timelapse;
+  if (timelapseOptions) {
+    timelapse =
+        std::make_unique<application::AppTimelapse>(mjpegDistributer, timelapseTranscoderFactory, *timelapseOptions);
+  }
+  application::AppStreamTranscoderFactory encodedStreamTranscoderFactory{encodedStreamDecoderOptions,
+      encodedStreamFilterOptions, encodedStreamEncoderOptions, encodedStreamWriterOptions,
+      encodedStreamRateControlOptions};
+  application::AppStreamTranscoderFactory websocketStreamTranscoderFactory{
+      encodedStreamDecoderOptions, encodedStreamFilterOptions, encodedStreamEncoderOptions,
+      websocketStreamWriterOptions};
+  application::AppStreamTranscoderFactory hlsTranscoderFactory{
+      encodedStreamDecoderOptions, encodedStreamFilterOptions, encodedStreamEncoderOptions, hlsWriterOptions};
+  // /stream and /ws/stream only differ in the muxer, so their pipelines come from one pool
+  application::AppStreamTranscoderPool encodedStreamTranscoderPool{encodedStreamTranscoderFactory, encoderPoolSize};
+  application::AppHlsSegmenter hlsSegmenter{
+      mjpegDistributer, hlsTranscoderFactory, encodedStreamEncoderOptions.framerate};
+
+  network::StaticAssetCache assetCache;
+  assetCache.Add("index.html", "text/html; charset=UTF-8");
+  assetCache.Watch();
 
-  application::AppHttpLayer appHttpLayer{snapshotSaver, recorderController};
+  application::AppHttpLayer appHttpLayer{assetCache, snapshotSaver, recorderController, recordingIndex};
 
   std::vector<std::thread> workers;
   const size_t nWorkers = std::thread::hardware_concurrency() + 1;
   for (size_t i = 0; i < nWorkers; i++) {
     workers.emplace_back(
-        [&serverAddr, serverPort, &appHttpLayer, &mjpegDistributer, &encodedStreamTranscoderFactory]() {
+        [&serverAddr, serverPort, &appHttpLayer, &mjpegDistributer, &mjpegVariants,
+            &encodedStreamTranscoderFactory, &websocketStreamTranscoderFactory, &encodedStreamTranscoderPool,
+            &hlsSegmenter]() {
           network::Server server;
           server.Add(
               network::HttpMethod::GET, "/", [&appHttpLayer](network::HttpRequest&& req, network::HttpSender& sender) {
@@ -140,12 +356,31 @@ int main() {
               [&appHttpLayer](network::HttpRequest&& req, network::HttpSender& sender) {
                 appHttpLayer.SetRecording(std::move(req), sender);
               });
+          server.Add(network::HttpMethod::GET, "/recordings",
+              [&appHttpLayer](network::HttpRequest&& req, network::HttpSender& sender) {
+                appHttpLayer.GetRecordings(std::move(req), sender);
+              });
+          server.Add(network::HttpMethod::GET, "/recordings/[^/]+",
+              [&appHttpLayer](network::HttpRequest&& req, network::HttpSender& sender) {
+                appHttpLayer.GetRecordingFile(std::move(req), sender);
+              });
+          server.Add(network::HttpMethod::GET, "/playback",
+              [&appHttpLayer](network::HttpRequest&& req, network::HttpSender& sender) {
+                appHttpLayer.GetPlayback(std::move(req), sender);
+              });
 
-          auto mjpegSenderFactory = std::make_unique<application::AppMjpegSenderFactory>(mjpegDistributer);
+          auto mjpegSenderFactory =
+              std::make_unique<application::AppMjpegSenderFactory>(mjpegDistributer, mjpegVariants);
           server.Add(network::HttpMethod::GET, "/mjpeg", std::move(mjpegSenderFactory));
           auto encodedStreamSenderFactory = std::make_unique<application::AppEncodedStreamSenderFactory>(
-              mjpegDistributer, encodedStreamTranscoderFactory);
+              mjpegDistributer, encodedStreamTranscoderFactory, encodedStreamTranscoderPool);
           server.Add(network::HttpMethod::GET, "/stream", std::move(encodedStreamSenderFactory));
+          auto websocketStreamSenderFactory = std::make_unique<application::AppWebsocketStreamSenderFactory>(
+              mjpegDistributer, websocketStreamTranscoderFactory, encodedStreamTranscoderPool);
+          server.Add("/ws/stream", std::move(websocketStreamSenderFactory));
+          auto hlsSenderFactory = std::make_unique<application::AppHlsSenderFactory>(hlsSegmenter);
+          server.Add(network::HttpMethod::GET, "/hls/(stream\\.m3u8|init\\.mp4|segment\\.m4s|part\\.m4s)",
+              std::move(hlsSenderFactory));
 
           server.Start(serverAddr, serverPort);
         });
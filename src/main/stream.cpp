@@ -1,5 +1,70 @@
 #include "stream.hpp"
 #include <spdlog/spdlog.h>
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <regex>
+#include <set>
+#include <utility>
+#include "file.hpp"
+
+namespace {
+
+bool IsSegmentFilename(const std::string& name) {
+  static const std::regex pattern{R"(\d{4}(\.\d{2}){5}\.[a-z0-9]+)"};
+  return std::regex_match(name, pattern);
+}
+
+// mjpeg decodes at 1/2, 1/4 or 1/8 size for almost nothing, the scaler only covers what is left
+int VariantLowres(int sourceWidth, int width) {
+  int lowres = 0;
+  while (lowres < 3 and (sourceWidth >> (lowres + 1)) >= width) {
+    lowres++;
+  }
+  return lowres;
+}
+
+int VariantHeight(const application::AppMjpegVariantOptions& options, int width) {
+  return (options.height * width / options.width + 1) & ~1;
+}
+
+codec::DecoderOptions VariantDecoderOptions(const application::AppMjpegVariantOptions& options, int width) {
+  codec::DecoderOptions decoderOptions;
+  decoderOptions.codec = "mjpeg";
+  decoderOptions.threadCount = 1;
+  decoderOptions.lowres = VariantLowres(options.width, width);
+  return decoderOptions;
+}
+
+// the graph is sized for the reduced decode, the scaler follows the decoder if the camera sends something else
+codec::FilterOptions VariantFilterOptions(const application::AppMjpegVariantOptions& options, int width) {
+  const int lowres = VariantLowres(options.width, width);
+  codec::FilterOptions filterOptions;
+  filterOptions.width = (options.width + (1 << lowres) - 1) >> lowres;
+  filterOptions.height = (options.height + (1 << lowres) - 1) >> lowres;
+  filterOptions.framerate = options.framerate;
+  filterOptions.inFormat = options.pixfmt;
+  filterOptions.outFormat = "YUV420";
+  filterOptions.description =
+      "scale=" + std::to_string(width) + ":" + std::to_string(VariantHeight(options, width)) + ":out_range=full";
+  filterOptions.threadCount = 1;
+  return filterOptions;
+}
+
+codec::EncoderOptions VariantEncoderOptions(const application::AppMjpegVariantOptions& options, int width, int qscale) {
+  codec::EncoderOptions encoderOptions;
+  encoderOptions.codec = "mjpeg";
+  encoderOptions.pixfmt = "YUV420";
+  encoderOptions.width = width;
+  encoderOptions.height = VariantHeight(options, width);
+  encoderOptions.framerate = options.framerate;
+  encoderOptions.bitrate = 0;
+  encoderOptions.qscale = qscale;
+  encoderOptions.threadCount = 1;
+  return encoderOptions;
+}
+
+}  // namespace
 
 namespace application {
 
@@ -11,59 +76,265 @@ AppStreamTranscoder::AppStreamTranscoder(std::unique_ptr<codec::Decoder> decoder
       encoder{std::move(encoder)},
       transcoder{std::move(transcoder)},
       writer{std::move(writer_)} {
-  writer->Begin();
+  if (writer) {
+    writer->Begin();
+  }
+}
+
+AppStreamTranscoder::AppStreamTranscoder(
+    std::unique_ptr<codec::StreamCopier> copier, std::unique_ptr<codec::Writer> writer_)
+    : copier{std::move(copier)}, writer{std::move(writer_)} {
+  if (writer) {
+    writer->Begin();
+  }
 }
 
 AppStreamTranscoder::~AppStreamTranscoder() {
-  transcoder->Flush(*this);
-  writer->End();
+  if (transcoder and writer) {
+    transcoder->Flush(*this);
+  }
+  if (writer) {
+    writer->End();
+  }
   transcoder.reset();
+  copier.reset();
   writer.reset();
+  nextWriter.reset();
+  retiredWriter.reset();
   decoder.reset();
   filter.reset();
   encoder.reset();
 }
 
-void AppStreamTranscoder::Process(std::string_view buffer) {
+void AppStreamTranscoder::Process(const codec::PacketBuffer& buffer) {
+  if (copier) {
+    return copier->Process(buffer, *this);
+  }
   transcoder->Process(buffer, *this);
 }
 
+void AppStreamTranscoder::Process(std::string_view buffer) {
+  if (transcoder) {
+    transcoder->Process(buffer, *this);
+  }
+}
+
+void AppStreamTranscoder::Skip() {
+  if (encoder) {
+    encoder->Skip();
+  }
+}
+
+void AppStreamTranscoder::ForceKeyframe() {
+  if (encoder) {
+    encoder->ForceKeyframe();
+  }
+}
+
+// the new writer is swapped in at the next keyframe so every file starts decodable, the encoder keeps running
+void AppStreamTranscoder::Rotate(std::unique_ptr<codec::Writer> writer_) {
+  nextWriter = std::move(writer_);
+  ForceKeyframe();
+}
+
+void AppStreamTranscoder::Attach(std::unique_ptr<codec::Writer> writer_) {
+  writer = std::move(writer_);
+  writer->Begin();
+  ForceKeyframe();
+}
+
+// ends the output while the processor behind the writer is still alive, the pipeline itself is left as it is
+void AppStreamTranscoder::Detach() {
+  if (writer) {
+    writer->End();
+  }
+  writer.reset();
+  nextWriter.reset();
+  retiredWriter.reset();
+}
+
+// false when the pipeline cannot be rewound and has to be rebuilt instead
+bool AppStreamTranscoder::Reset() {
+  if (not transcoder or not encoder->Reset()) {
+    return false;
+  }
+  decoder->Reset();
+  if (rateController) {
+    rateController->Reset();
+    encoder->SetBitrate(rateController->Bitrate());
+    frameCount = 0;
+  }
+  return true;
+}
+
+void AppStreamTranscoder::EnableRateControl(const codec::RateControlOptions& options) {
+  if (encoder) {
+    rateController.emplace(options);
+  }
+}
+
+// called once per source frame with what the connection still has queued, returns false when the frame should be
+// skipped because the frame rate is thinned out on top of the lowest bitrate
+bool AppStreamTranscoder::Adapt(size_t buffered) {
+  if (not rateController) {
+    return true;
+  }
+  if (rateController->Update(buffered)) {
+    spdlog::debug("stream bitrate {} with {} bytes queued", rateController->Bitrate(), buffered);
+    encoder->SetBitrate(rateController->Bitrate());
+  }
+  return frameCount++ % rateController->FrameInterval() == 0;
+}
+
 void AppStreamTranscoder::ProcessEncodedData(AVPacket* encoded) {
+  if (not writer) {
+    return;
+  }
+  if (nextWriter and (encoded->flags & AV_PKT_FLAG_KEY)) {
+    writer->End();
+    // the old file finishes flushing in the background and is released at the next rotation
+    retiredWriter = std::exchange(writer, std::move(nextWriter));
+    writer->Begin();
+    writer->SetTimestampOffset(encoded->pts);
+  }
   writer->Process(encoded);
 }
 
 AppStreamTranscoderFactory::AppStreamTranscoderFactory(const codec::DecoderOptions& decoderOptions,
     const codec::FilterOptions& filterOptions, const codec::EncoderOptions& encoderOptions,
-    const codec::WriterOptions& writerOptions)
+    const codec::WriterOptions& writerOptions, std::optional<codec::RateControlOptions> rateControlOptions)
     : decoderOptions{decoderOptions},
       filterOptions{filterOptions},
       encoderOptions{encoderOptions},
-      writerOptions{writerOptions} {
+      writerOptions{writerOptions},
+      rateControlOptions{rateControlOptions} {
+}
+
+AppStreamTranscoderFactory::AppStreamTranscoderFactory(const codec::WriterOptions& writerOptions)
+    : decoderOptions{}, filterOptions{}, encoderOptions{}, writerOptions{writerOptions}, streamCopy{true} {
 }
 
 std::unique_ptr<AppStreamTranscoder> AppStreamTranscoderFactory::Create(codec::WriterProcessor& processor) const {
-  auto decoder = std::make_unique<codec::Decoder>(decoderOptions);
-  auto filter = std::make_unique<codec::Filter>(filterOptions);
-  auto encoder = std::make_unique<codec::Encoder>(encoderOptions);
-  auto transcoder = std::make_unique<codec::Transcoder>(*decoder, *filter, *encoder);
-  auto writer = std::make_unique<codec::BufferWriter>(writerOptions, processor);
-  return std::make_unique<AppStreamTranscoder>(
-      std::move(decoder), std::move(filter), std::move(encoder), std::move(transcoder), std::move(writer));
+  auto transcoder = CreatePipeline();
+  transcoder->Attach(CreateWriter(processor));
+  return transcoder;
 }
 
-std::unique_ptr<AppStreamTranscoder> AppStreamTranscoderFactory::Create(std::string_view filename) const {
+std::unique_ptr<AppStreamTranscoder> AppStreamTranscoderFactory::Create(
+    std::string_view filename, codec::FileClosedCallback closed) const {
+  auto transcoder = CreatePipeline();
+  transcoder->Attach(CreateWriter(filename, std::move(closed)));
+  return transcoder;
+}
+
+// opens the codecs and the filter graph, which is the slow part, and leaves the writer to be attached later
+std::unique_ptr<AppStreamTranscoder> AppStreamTranscoderFactory::CreatePipeline() const {
+  if (streamCopy) {
+    return std::make_unique<AppStreamTranscoder>(
+        std::make_unique<codec::StreamCopier>(writerOptions.framerate), std::unique_ptr<codec::Writer>{});
+  }
   auto decoder = std::make_unique<codec::Decoder>(decoderOptions);
   auto filter = std::make_unique<codec::Filter>(filterOptions);
   auto encoder = std::make_unique<codec::Encoder>(encoderOptions);
   auto transcoder = std::make_unique<codec::Transcoder>(*decoder, *filter, *encoder);
-  auto writer = std::make_unique<codec::FileWriter>(writerOptions, filename);
-  return std::make_unique<AppStreamTranscoder>(
-      std::move(decoder), std::move(filter), std::move(encoder), std::move(transcoder), std::move(writer));
+  auto pipeline = std::make_unique<AppStreamTranscoder>(std::move(decoder), std::move(filter), std::move(encoder),
+      std::move(transcoder), std::unique_ptr<codec::Writer>{});
+  if (rateControlOptions) {
+    pipeline->EnableRateControl(*rateControlOptions);
+  }
+  return pipeline;
+}
+
+std::unique_ptr<codec::Writer> AppStreamTranscoderFactory::CreateWriter(codec::WriterProcessor& processor) const {
+  return std::make_unique<codec::BufferWriter>(writerOptions, processor);
+}
+
+std::unique_ptr<codec::Writer> AppStreamTranscoderFactory::CreateWriter(
+    std::string_view filename, codec::FileClosedCallback closed) const {
+  return std::make_unique<codec::FileWriter>(writerOptions, filename, std::move(closed));
+}
+
+AppStreamTranscoderPool::AppStreamTranscoderPool(const AppStreamTranscoderFactory& transcoderFactory, size_t size)
+    : transcoderFactory{transcoderFactory}, size{size} {
+  refillThread = std::thread([this] { RunRefill(); });
+}
+
+AppStreamTranscoderPool::~AppStreamTranscoderPool() {
+  {
+    std::lock_guard lock{poolMut};
+    stopped = true;
+  }
+  poolCv.notify_one();
+  refillThread.join();
+}
+
+// an empty pool falls back to building the pipeline on the spot
+std::unique_ptr<AppStreamTranscoder> AppStreamTranscoderPool::Acquire(std::unique_ptr<codec::Writer> writer) {
+  std::unique_ptr<AppStreamTranscoder> transcoder;
+  {
+    std::lock_guard lock{poolMut};
+    if (not idle.empty()) {
+      transcoder = std::move(idle.front());
+      idle.pop_front();
+    }
+  }
+  poolCv.notify_one();
+  if (not transcoder) {
+    transcoder = transcoderFactory.CreatePipeline();
+  }
+  transcoder->Attach(std::move(writer));
+  return transcoder;
+}
+
+void AppStreamTranscoderPool::Release(std::unique_ptr<AppStreamTranscoder> transcoder) {
+  if (not transcoder) {
+    return;
+  }
+  transcoder->Detach();
+  {
+    std::lock_guard lock{poolMut};
+    released.emplace_back(std::move(transcoder));
+  }
+  poolCv.notify_one();
+}
+
+// resets returned pipelines and tops the pool up, codecs are opened and closed here rather than on a request
+void AppStreamTranscoderPool::RunRefill() {
+  std::unique_lock lock{poolMut};
+  while (true) {
+    poolCv.wait(lock, [this] { return stopped or not released.empty() or idle.size() < size; });
+    if (stopped) {
+      return;
+    }
+    std::unique_ptr<AppStreamTranscoder> transcoder;
+    if (not released.empty()) {
+      transcoder = std::move(released.front());
+      released.pop_front();
+      lock.unlock();
+      if (not transcoder->Reset()) {
+        transcoder.reset();
+      }
+    } else {
+      lock.unlock();
+      transcoder = transcoderFactory.CreatePipeline();
+    }
+    lock.lock();
+    if (transcoder and idle.size() < size) {
+      idle.emplace_back(std::move(transcoder));
+    }
+    lock.unlock();
+    transcoder.reset();
+    lock.lock();
+  }
 }
 
 AppStreamRecorderRunner::AppStreamRecorderRunner(common::EventQueue<AppRecorderEvent>& eventQueue,
-    const AppStreamRecorderOptions& recorderOptions, AppStreamTranscoderFactory& transcoderFactory)
-    : eventQueue{eventQueue}, recorderOptions{recorderOptions}, transcoderFactory{transcoderFactory} {
+    const AppStreamRecorderOptions& recorderOptions, AppStreamTranscoderFactory& transcoderFactory,
+    os::RecordingIndex& recordingIndex)
+    : eventQueue{eventQueue},
+      recorderOptions{recorderOptions},
+      transcoderFactory{transcoderFactory},
+      recordingIndex{recordingIndex} {
   Reset();
 }
 
@@ -76,15 +347,16 @@ void AppStreamRecorderRunner::Run() {
   });
 }
 
-void AppStreamRecorderRunner::Process(std::string_view buffer) {
+void AppStreamRecorderRunner::Process(const codec::PacketBuffer& buffer) {
   if (not recorderOptions.saveRecord) {
     return;
   }
   if (recorderOptions.maxRecordingTimeInSeconds > 0) {
-    const auto now = std::time(nullptr);
-    const auto diff = std::difftime(now, recorderStartTime);
-    if (diff >= recorderOptions.maxRecordingTimeInSeconds) {
-      Reset();
+    const auto now = std::chrono::steady_clock::now();
+    if (now - segmentStartTime >= std::chrono::seconds{recorderOptions.maxRecordingTimeInSeconds}) {
+      transcoder->Rotate(transcoderFactory.CreateWriter(
+          NextFilename(), [this](const os::RecordingSegment& segment) { recordingIndex.Add(segment); }));
+      segmentStartTime = now;
     }
   }
   transcoder->Process(buffer);
@@ -93,15 +365,21 @@ void AppStreamRecorderRunner::Process(std::string_view buffer) {
 void AppStreamRecorderRunner::Reset() {
   transcoder.reset();
   if (recorderOptions.saveRecord) {
-    recorderStartTime = std::time(nullptr);
-    char buf[50];
-    std::strftime(buf, sizeof buf, "%Y.%m.%d.%H.%M.%S.", std::localtime(&recorderStartTime));
-    std::string f{buf};
-    f += recorderOptions.format;
-    transcoder = transcoderFactory.Create(f);
+    segmentStartTime = std::chrono::steady_clock::now();
+    transcoder = transcoderFactory.Create(
+        NextFilename(), [this](const os::RecordingSegment& segment) { recordingIndex.Add(segment); });
   }
 }
 
+std::string AppStreamRecorderRunner::NextFilename() const {
+  const auto now = std::time(nullptr);
+  char buf[50];
+  std::strftime(buf, sizeof buf, "%Y.%m.%d.%H.%M.%S.", std::localtime(&now));
+  std::string f{buf};
+  f += recorderOptions.format;
+  return f;
+}
+
 void AppStreamRecorderRunner::operator()(const StartRecording&) {
   if (not recorderOptions.saveRecord) {
     recorderOptions.saveRecord = true;
@@ -118,7 +396,91 @@ void AppStreamRecorderRunner::operator()(const RecordData& data) {
   Process(data.buffer);
 }
 
-void AppStreamDistributer::Process(std::string_view buffer) {
+AppRecordingRetention::AppRecordingRetention(
+    os::RecordingIndex& recordingIndex, const AppRecordingRetentionOptions& options)
+    : recordingIndex{recordingIndex}, options{options} {
+  Reconcile();
+  retentionThread = std::thread([this] { RunRetention(); });
+}
+
+AppRecordingRetention::~AppRecordingRetention() {
+  {
+    std::lock_guard lock{retentionMut};
+    stopped = true;
+  }
+  retentionCv.notify_one();
+  retentionThread.join();
+}
+
+// drops the oldest segments over the quota or the age limit, the index is updated before the files go
+void AppRecordingRetention::Enforce() {
+  std::int64_t minStart = std::numeric_limits<std::int64_t>::min();
+  if (options.maxAgeSeconds > 0) {
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    minStart = now.count() - static_cast<std::int64_t>(options.maxAgeSeconds) * 1000;
+  }
+  for (const auto& segment : recordingIndex.Expire(options.quotaBytes, minStart)) {
+    std::error_code ec;
+    std::filesystem::remove(segment.name, ec);
+    if (ec) {
+      spdlog::error("retention remove({}): {}", segment.name, ec.message());
+    }
+    std::filesystem::remove(segment.name + ".idx", ec);
+  }
+}
+
+// segments only reach the index when their writer closes them, so anything cut short by a crash is picked up here
+// from the working directory, and entries whose file has gone are dropped. Runs before the recorder starts
+void AppRecordingRetention::Reconcile() {
+  std::set<std::string> indexed;
+  for (const auto& segment : recordingIndex.List()) {
+    std::error_code ec;
+    if (not std::filesystem::exists(segment.name, ec)) {
+      spdlog::info("retention dropping missing recording {}", segment.name);
+      recordingIndex.Remove(segment.name);
+      continue;
+    }
+    indexed.emplace(segment.name);
+  }
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator{".", ec}) {
+    auto name = entry.path().filename().string();
+    if (not entry.is_regular_file() or not IsSegmentFilename(name) or indexed.contains(name)) {
+      continue;
+    }
+    os::File file{name};
+    if (not file.Ok()) {
+      continue;
+    }
+    // the file was last written when the segment ended, the sidecar or the container tells how long it runs. A plain
+    // mp4 cut short by a crash has neither and is left out rather than served as playable
+    const auto fragments = os::ReadFragmentIndex(name + ".idx");
+    const auto duration = fragments.empty() ? codec::ProbeDuration(name) : fragments.back().time;
+    if (not duration) {
+      spdlog::warn("retention skipping unreadable recording {}", name);
+      continue;
+    }
+    const std::int64_t end = static_cast<std::int64_t>(file.ModifiedTime()) * 1000;
+    spdlog::info("retention adding unindexed recording {}", name);
+    recordingIndex.Add(os::RecordingSegment{std::move(name), end - *duration, end, file.Size()});
+  }
+  if (ec) {
+    spdlog::error("retention directory_iterator(): {}", ec.message());
+  }
+}
+
+void AppRecordingRetention::RunRetention() {
+  std::unique_lock lock{retentionMut};
+  while (not stopped) {
+    lock.unlock();
+    Enforce();
+    lock.lock();
+    retentionCv.wait_for(lock, std::chrono::seconds{options.intervalSeconds}, [this] { return stopped; });
+  }
+}
+
+void AppStreamDistributer::Process(const codec::PacketBuffer& buffer) {
   std::lock_guard lock{receiversMut};
   for (auto* s : receivers) {
     s->Notify(buffer);
@@ -135,6 +497,148 @@ void AppStreamDistributer::RemoveSubscriber(AppStreamReceiver* subscriber) {
   receivers.erase(subscriber);
 }
 
+AppFrameDistributer::AppFrameDistributer(
+    AppStreamDistributer& streamDistributer, const codec::DecoderOptions& decoderOptions, int frameInterval)
+    : streamDistributer{streamDistributer}, decoder{decoderOptions}, frameInterval{std::max(frameInterval, 1)} {
+  decoderThread = std::thread([this] { RunDecoder(); });
+  streamDistributer.AddSubscriber(this);
+}
+
+AppFrameDistributer::~AppFrameDistributer() {
+  streamDistributer.RemoveSubscriber(this);
+  decoderQueue.Push(std::nullopt);
+  decoderThread.join();
+}
+
+void AppFrameDistributer::Notify(const codec::PacketBuffer& buffer) {
+  if (++frameCount < frameInterval or decoderQueue.Size() > 0) {
+    return;
+  }
+  std::unique_lock lock{receiversMut};
+  if (receivers.empty()) {
+    return;
+  }
+  lock.unlock();
+  frameCount = 0;
+  decoderQueue.Push(std::make_optional<codec::PacketBuffer>(buffer));
+}
+
+void AppFrameDistributer::ProcessDecodedData(AVFrame* frame) {
+  std::lock_guard lock{receiversMut};
+  for (auto* s : receivers) {
+    s->Notify(frame);
+  }
+}
+
+void AppFrameDistributer::AddSubscriber(AppFrameReceiver* subscriber) {
+  std::lock_guard lock{receiversMut};
+  receivers.emplace(subscriber);
+}
+
+void AppFrameDistributer::RemoveSubscriber(AppFrameReceiver* subscriber) {
+  std::lock_guard lock{receiversMut};
+  receivers.erase(subscriber);
+}
+
+void AppFrameDistributer::RunDecoder() {
+  std::optional<codec::PacketBuffer> bufferOpt;
+  while ((bufferOpt = decoderQueue.Pop()) != std::nullopt) {
+    decoder.Decode(*bufferOpt, *this);
+  }
+}
+
+AppMjpegVariant::AppMjpegVariant(
+    AppStreamDistributer& streamDistributer, const AppMjpegVariantOptions& options, int width, int qscale)
+    : streamDistributer{streamDistributer},
+      decoder{VariantDecoderOptions(options, width)},
+      filter{VariantFilterOptions(options, width)},
+      encoder{VariantEncoderOptions(options, width, qscale)},
+      transcoder{decoder, filter, encoder} {
+  transcoderThread = std::thread([this] { RunTranscoder(); });
+}
+
+AppMjpegVariant::~AppMjpegVariant() {
+  streamDistributer.RemoveSubscriber(this);
+  transcoderQueue.Push(std::nullopt);
+  transcoderThread.join();
+}
+
+// a frame arriving while the previous one is still being transcoded is dropped rather than queued
+void AppMjpegVariant::Notify(const codec::PacketBuffer& buffer) {
+  if (transcoderQueue.Size() > 0) {
+    return;
+  }
+  transcoderQueue.Push(std::make_optional<codec::PacketBuffer>(buffer));
+}
+
+void AppMjpegVariant::ProcessEncodedData(AVPacket* encoded) {
+  variantDistributer.Process(
+      framePool.Copy({reinterpret_cast<const char*>(encoded->data), static_cast<size_t>(encoded->size)}));
+}
+
+// the variant only listens to the camera while someone is watching it
+void AppMjpegVariant::AddSubscriber(AppStreamReceiver* subscriber) {
+  variantDistributer.AddSubscriber(subscriber);
+  std::lock_guard lock{subscribersMut};
+  if (subscribers++ == 0) {
+    streamDistributer.AddSubscriber(this);
+  }
+}
+
+bool AppMjpegVariant::RemoveSubscriber(AppStreamReceiver* subscriber) {
+  variantDistributer.RemoveSubscriber(subscriber);
+  std::lock_guard lock{subscribersMut};
+  if (subscribers > 0 and --subscribers == 0) {
+    streamDistributer.RemoveSubscriber(this);
+    return true;
+  }
+  return false;
+}
+
+void AppMjpegVariant::RunTranscoder() {
+  std::optional<codec::PacketBuffer> bufferOpt;
+  while ((bufferOpt = transcoderQueue.Pop()) != std::nullopt) {
+    transcoder.Process(*bufferOpt, *this);
+  }
+}
+
+AppMjpegVariants::AppMjpegVariants(AppStreamDistributer& streamDistributer, const AppMjpegVariantOptions& options)
+    : streamDistributer{streamDistributer}, options{options} {
+}
+
+// requests are snapped to 16 pixel widths and mjpeg quantizers so near identical ones share a variant, at the limit
+// they join the widest running variant that is not wider than asked for, or the narrowest one if all are wider
+AppMjpegVariant* AppMjpegVariants::Subscribe(int width, int quality, AppStreamReceiver* subscriber) {
+  width = std::clamp(width / 16 * 16, 16, options.width);
+  const int qscale = std::clamp(31 - (quality - 1) * 29 / 99, 2, 31);
+  const auto key = std::make_pair(width, qscale);
+  std::lock_guard lock{variantsMut};
+  auto it = variants.find(key);
+  if (it == variants.end() and variants.size() >= options.maxVariants) {
+    it = variants.upper_bound(std::make_pair(width, std::numeric_limits<int>::max()));
+    if (it != variants.begin()) {
+      --it;
+    }
+  }
+  if (it == variants.end() and options.maxVariants == 0) {
+    return nullptr;
+  }
+  if (it == variants.end()) {
+    it = variants.emplace(key, std::make_unique<AppMjpegVariant>(streamDistributer, options, width, qscale)).first;
+  }
+  it->second->AddSubscriber(subscriber);
+  return it->second.get();
+}
+
+// a variant nobody watches is dropped so its slot is free for the next size asked for
+void AppMjpegVariants::Unsubscribe(AppMjpegVariant* variant, AppStreamReceiver* subscriber) {
+  std::lock_guard lock{variantsMut};
+  if (not variant->RemoveSubscriber(subscriber)) {
+    return;
+  }
+  std::erase_if(variants, [variant](const auto& entry) { return entry.second.get() == variant; });
+}
+
 AppStreamCapturerRunner::AppStreamCapturerRunner(
     const video::CapturerOptions& capturerOptions, AppStreamDistributer& streamDistributer)
     : capturerOptions{capturerOptions}, streamDistributer{streamDistributer} {
@@ -151,7 +655,7 @@ void AppStreamCapturerRunner::Run() {
 }
 
 void AppStreamCapturerRunner::ProcessFrame(std::string_view frame) {
-  streamDistributer.Process({frame.data(), frame.size()});
+  streamDistributer.Process(framePool.Copy(frame));
 }
 
 }  // namespace application
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <deque>
+#include <map>
 #include <set>
 #include <thread>
 #include "codec.hpp"
 #include "event_queue.hpp"
 #include "network.hpp"
+#include "recording.hpp"
 #include "video.hpp"
 
 namespace application {
@@ -14,8 +18,18 @@ class AppStreamTranscoder : public codec::EncodedDataProcessor {
 public:
   AppStreamTranscoder(std::unique_ptr<codec::Decoder>, std::unique_ptr<codec::Filter>, std::unique_ptr<codec::Encoder>,
       std::unique_ptr<codec::Transcoder>, std::unique_ptr<codec::Writer>);
+  AppStreamTranscoder(std::unique_ptr<codec::StreamCopier>, std::unique_ptr<codec::Writer>);
   ~AppStreamTranscoder() override;
+  void Process(const codec::PacketBuffer&);
   void Process(std::string_view);
+  void Skip();
+  void ForceKeyframe();
+  void Rotate(std::unique_ptr<codec::Writer>);
+  void Attach(std::unique_ptr<codec::Writer>);
+  void Detach();
+  bool Reset();
+  void EnableRateControl(const codec::RateControlOptions&);
+  bool Adapt(size_t);
   void ProcessEncodedData(AVPacket*) override;
 
 private:
@@ -23,67 +37,126 @@ private:
   std::unique_ptr<codec::Filter> filter;
   std::unique_ptr<codec::Encoder> encoder;
   std::unique_ptr<codec::Transcoder> transcoder;
+  std::unique_ptr<codec::StreamCopier> copier;
   std::unique_ptr<codec::Writer> writer;
+  std::unique_ptr<codec::Writer> nextWriter;
+  std::unique_ptr<codec::Writer> retiredWriter;
+  std::optional<codec::RateController> rateController;
+  int frameCount{0};
 };
 
 class AppStreamTranscoderFactory {
 public:
   AppStreamTranscoderFactory(const codec::DecoderOptions&, const codec::FilterOptions&, const codec::EncoderOptions&,
-      const codec::WriterOptions&);
+      const codec::WriterOptions&, std::optional<codec::RateControlOptions> = std::nullopt);
+  explicit AppStreamTranscoderFactory(const codec::WriterOptions&);
   std::unique_ptr<AppStreamTranscoder> Create(codec::WriterProcessor&) const;
-  std::unique_ptr<AppStreamTranscoder> Create(std::string_view) const;
+  std::unique_ptr<AppStreamTranscoder> Create(std::string_view, codec::FileClosedCallback = nullptr) const;
+  std::unique_ptr<AppStreamTranscoder> CreatePipeline() const;
+  std::unique_ptr<codec::Writer> CreateWriter(codec::WriterProcessor&) const;
+  std::unique_ptr<codec::Writer> CreateWriter(std::string_view, codec::FileClosedCallback = nullptr) const;
 
 private:
   const codec::DecoderOptions decoderOptions;
   const codec::FilterOptions filterOptions;
   const codec::EncoderOptions encoderOptions;
   const codec::WriterOptions writerOptions;
+  const std::optional<codec::RateControlOptions> rateControlOptions;
+  const bool streamCopy{false};
+};
+
+class AppStreamTranscoderPool {
+public:
+  AppStreamTranscoderPool(const AppStreamTranscoderFactory&, size_t);
+  ~AppStreamTranscoderPool();
+  std::unique_ptr<AppStreamTranscoder> Acquire(std::unique_ptr<codec::Writer>);
+  void Release(std::unique_ptr<AppStreamTranscoder>);
+
+private:
+  void RunRefill();
+
+  const AppStreamTranscoderFactory& transcoderFactory;
+  const size_t size;
+  std::deque<std::unique_ptr<AppStreamTranscoder>> idle;
+  std::deque<std::unique_ptr<AppStreamTranscoder>> released;
+  bool stopped{false};
+  std::mutex poolMut;
+  std::condition_variable poolCv;
+  std::thread refillThread;
 };
 
 struct AppStreamRecorderOptions {
   std::string format;
   bool saveRecord;
   std::uint32_t maxRecordingTimeInSeconds;
+  std::uint32_t preRollSeconds{0};
+  size_t preRollBytes{0};
 };
 
 struct StartRecording {};
 struct StopRecording {};
 struct RecordData {
-  std::string buffer;
+  codec::PacketBuffer buffer;
 };
 using AppRecorderEvent = std::variant<StartRecording, StopRecording, RecordData>;
 
 class AppStreamRecorderRunner {
 public:
-  AppStreamRecorderRunner(
-      common::EventQueue<AppRecorderEvent>&, const AppStreamRecorderOptions&, AppStreamTranscoderFactory&);
+  AppStreamRecorderRunner(common::EventQueue<AppRecorderEvent>&, const AppStreamRecorderOptions&,
+      AppStreamTranscoderFactory&, os::RecordingIndex&);
   void Run();
-  void Process(std::string_view);
+  void Process(const codec::PacketBuffer&);
   void operator()(const StartRecording&);
   void operator()(const StopRecording&);
   void operator()(const RecordData&);
 
 private:
   void Reset();
+  std::string NextFilename() const;
 
   std::thread processorThread;
   common::EventQueue<AppRecorderEvent>& eventQueue;
   AppStreamRecorderOptions recorderOptions;
   AppStreamTranscoderFactory& transcoderFactory;
+  os::RecordingIndex& recordingIndex;
 
   std::unique_ptr<AppStreamTranscoder> transcoder;
-  std::time_t recorderStartTime;
+  std::chrono::steady_clock::time_point segmentStartTime;
+};
+
+struct AppRecordingRetentionOptions {
+  std::uint64_t quotaBytes{0};
+  std::uint32_t maxAgeSeconds{0};
+  std::uint32_t intervalSeconds{60};
+};
+
+class AppRecordingRetention {
+public:
+  AppRecordingRetention(os::RecordingIndex&, const AppRecordingRetentionOptions&);
+  ~AppRecordingRetention();
+  void Enforce();
+
+private:
+  void Reconcile();
+  void RunRetention();
+
+  os::RecordingIndex& recordingIndex;
+  const AppRecordingRetentionOptions options;
+  bool stopped{false};
+  std::mutex retentionMut;
+  std::condition_variable retentionCv;
+  std::thread retentionThread;
 };
 
 class AppStreamReceiver {
 public:
   virtual ~AppStreamReceiver() = default;
-  virtual void Notify(std::string_view) = 0;
+  virtual void Notify(const codec::PacketBuffer&) = 0;
 };
 
 class AppStreamDistributer {
 public:
-  void Process(std::string_view);
+  void Process(const codec::PacketBuffer&);
   void AddSubscriber(AppStreamReceiver*);
   void RemoveSubscriber(AppStreamReceiver*);
 
@@ -92,6 +165,80 @@ private:
   mutable std::mutex receiversMut;
 };
 
+class AppFrameReceiver {
+public:
+  virtual ~AppFrameReceiver() = default;
+  virtual void Notify(const AVFrame*) = 0;
+};
+
+class AppFrameDistributer : public AppStreamReceiver, public codec::DecodedDataProcessor {
+public:
+  AppFrameDistributer(AppStreamDistributer&, const codec::DecoderOptions&, int);
+  ~AppFrameDistributer() override;
+  void Notify(const codec::PacketBuffer&) override;
+  void ProcessDecodedData(AVFrame*) override;
+  void AddSubscriber(AppFrameReceiver*);
+  void RemoveSubscriber(AppFrameReceiver*);
+
+private:
+  void RunDecoder();
+
+  AppStreamDistributer& streamDistributer;
+  codec::Decoder decoder;
+  int frameInterval;
+  int frameCount{0};
+  std::set<AppFrameReceiver*> receivers;
+  mutable std::mutex receiversMut;
+  common::ConcreteEventQueue<std::optional<codec::PacketBuffer>> decoderQueue;
+  std::thread decoderThread;
+};
+
+struct AppMjpegVariantOptions {
+  int width;
+  int height;
+  int framerate;
+  std::string pixfmt{"YUVJ422"};
+  size_t maxVariants{4};
+};
+
+class AppMjpegVariant : public AppStreamReceiver, public codec::EncodedDataProcessor {
+public:
+  AppMjpegVariant(AppStreamDistributer&, const AppMjpegVariantOptions&, int, int);
+  ~AppMjpegVariant() override;
+  void Notify(const codec::PacketBuffer&) override;
+  void ProcessEncodedData(AVPacket*) override;
+  void AddSubscriber(AppStreamReceiver*);
+  bool RemoveSubscriber(AppStreamReceiver*);
+
+private:
+  void RunTranscoder();
+
+  AppStreamDistributer& streamDistributer;
+  AppStreamDistributer variantDistributer;
+  codec::Decoder decoder;
+  codec::Filter filter;
+  codec::Encoder encoder;
+  codec::Transcoder transcoder;
+  codec::PacketBufferPool framePool;
+  size_t subscribers{0};
+  std::mutex subscribersMut;
+  common::ConcreteEventQueue<std::optional<codec::PacketBuffer>> transcoderQueue;
+  std::thread transcoderThread;
+};
+
+class AppMjpegVariants {
+public:
+  AppMjpegVariants(AppStreamDistributer&, const AppMjpegVariantOptions&);
+  AppMjpegVariant* Subscribe(int, int, AppStreamReceiver*);
+  void Unsubscribe(AppMjpegVariant*, AppStreamReceiver*);
+
+private:
+  AppStreamDistributer& streamDistributer;
+  const AppMjpegVariantOptions options;
+  std::map<std::pair<int, int>, std::unique_ptr<AppMjpegVariant>> variants;
+  std::mutex variantsMut;
+};
+
 class AppStreamCapturerRunner : public video::StreamProcessor {
 public:
   AppStreamCapturerRunner(const video::CapturerOptions&, AppStreamDistributer&);
@@ -102,6 +249,7 @@ private:
   const video::CapturerOptions capturerOptions;
   std::thread capturerThread;
   AppStreamDistributer& streamDistributer;
+  codec::PacketBufferPool framePool;
 };
 
 }  // namespace application
@@ -0,0 +1,219 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <vector>
+#include "codec.hpp"
+#include "convert.hpp"
+#include "motion.hpp"
+#include "overlay.hpp"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+using namespace testing;
+
+namespace codec {
+
+namespace {
+
+struct Image {
+  Image(AVPixelFormat format, int width, int height) {
+    const int chromaWidth = (width + 1) / 2;
+    const int chromaHeight = format == AV_PIX_FMT_YUV422P ? height : (height + 1) / 2;
+    const int planes = format == AV_PIX_FMT_NV12 ? 2 : 3;
+    for (int i = 0; i < planes; i++) {
+      const int planeWidth = i == 0 ? width : format == AV_PIX_FMT_NV12 ? 2 * chromaWidth : chromaWidth;
+      stride[i] = planeWidth + 7;
+      planeBytes[i].assign(stride[i] * (i == 0 ? height : chromaHeight), 0);
+      for (int y = 0; y < (i == 0 ? height : chromaHeight); y++) {
+        rows[i].emplace_back(planeBytes[i].data() + y * stride[i], planeWidth);
+      }
+      data[i] = planeBytes[i].data();
+    }
+  }
+
+  void Randomize() {
+    for (auto& plane : planeBytes) {
+      for (auto& byte : plane) {
+        byte = static_cast<std::uint8_t>(std::rand());
+      }
+    }
+  }
+
+  std::vector<std::vector<std::uint8_t>> Rows() const {
+    std::vector<std::vector<std::uint8_t>> result;
+    for (const auto& plane : rows) {
+      for (const auto& [row, len] : plane) {
+        result.emplace_back(row, row + len);
+      }
+    }
+    return result;
+  }
+
+  std::vector<std::uint8_t> planeBytes[3];
+  std::vector<std::pair<std::uint8_t*, int>> rows[3];
+  std::uint8_t* data[3]{};
+  int stride[3]{};
+};
+
+void ExpectSameAsSwscale(AVPixelFormat in, AVPixelFormat out, ConvertFunction convert) {
+  const int width = 98;
+  const int height = 34;
+  Image source{in, width, height};
+  source.Randomize();
+  Image converted{out, width, height};
+  Image expected{out, width, height};
+  convert(source.data, source.stride, converted.data, converted.stride, width, height);
+  // area averaging is what the 2:1 chroma kernels do
+  SwsContext* context = sws_getContext(width, height, in, width, height, out, SWS_AREA, nullptr, nullptr, nullptr);
+  ASSERT_NE(context, nullptr);
+  sws_scale(context, source.data, source.stride, 0, height, expected.data, expected.stride);
+  sws_freeContext(context);
+  ASSERT_EQ(converted.Rows(), expected.Rows());
+}
+
+}  // namespace
+
+TEST(ConvertTest, whenConvertingYuv422pToYuv420p_itShouldMatchSwscale) {
+  ExpectSameAsSwscale(AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV420P, ConvertYuv422pToYuv420p);
+}
+
+TEST(ConvertTest, whenConvertingYuv422pToNv12_itShouldMatchSwscale) {
+  ExpectSameAsSwscale(AV_PIX_FMT_YUV422P, AV_PIX_FMT_NV12, ConvertYuv422pToNv12);
+}
+
+TEST(ConvertTest, whenConvertingYuv420pToNv12_itShouldMatchSwscale) {
+  ExpectSameAsSwscale(AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, ConvertYuv420pToNv12);
+}
+
+TEST(ConvertTest, whenLookingUpConversions_itShouldTreatJpegFormatsByLayout) {
+  ASSERT_EQ(FindConversion(AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUV420P), ConvertYuv422pToYuv420p);
+  ASSERT_EQ(FindConversion(AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_NV12), ConvertYuv422pToNv12);
+  ASSERT_EQ(FindConversion(AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P), nullptr);
+  ASSERT_TRUE(SameLayout(AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUV420P));
+}
+
+TEST(BlendRowTest, whenBlending_itShouldMatchRoundedDivisionBy255) {
+  std::vector<std::uint8_t> dst, alpha, color, expected;
+  for (int d = 0; d < 256; d += 5) {
+    for (int a = 0; a < 256; a++) {
+      const int c = 255 - d;
+      dst.push_back(d);
+      alpha.push_back(a);
+      color.push_back(c);
+      expected.push_back((d * (255 - a) + c * a + 127) / 255);
+    }
+  }
+  BlendRow(dst.data(), alpha.data(), color.data(), dst.size());
+  ASSERT_EQ(dst, expected);
+}
+
+TEST(BlendRowTest, whenAlphaIsOpaqueOrTransparent_itShouldKeepColorOrDestination) {
+  std::vector<std::uint8_t> dst(37, 16);
+  std::vector<std::uint8_t> alpha(37, 0);
+  const std::vector<std::uint8_t> color(37, 235);
+  for (size_t i = 0; i < alpha.size(); i += 2) {
+    alpha[i] = 255;
+  }
+  BlendRow(dst.data(), alpha.data(), color.data(), dst.size());
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ(dst[i], i % 2 == 0 ? 235 : 16);
+  }
+}
+
+std::vector<std::uint8_t> MotionFrame(int width, int height, int blockX, int blockY) {
+  std::vector<std::uint8_t> frame(width * height, 100);
+  for (int y = blockY; y >= 0 and y < blockY + 32; y++) {
+    std::fill_n(frame.begin() + y * width + blockX, 32, 220);
+  }
+  return frame;
+}
+
+TEST(MotionDetectorTest, whenBlockMoves_itShouldTriggerAndReleaseWithHysteresis) {
+  MotionOptions options;
+  options.triggerFrames = 2;
+  options.releaseFrames = 3;
+  MotionDetector detector{options};
+  const auto still = MotionFrame(168, 96, 0, -1);
+  ASSERT_FALSE(detector.Process(still.data(), 168, 168, 96));
+  ASSERT_FALSE(detector.Process(still.data(), 168, 168, 96));
+  ASSERT_FALSE(detector.Process(MotionFrame(168, 96, 16, 16).data(), 168, 168, 96));
+  ASSERT_TRUE(detector.Process(MotionFrame(168, 96, 64, 40).data(), 168, 168, 96));
+  ASSERT_TRUE(detector.Process(still.data(), 168, 168, 96));
+  ASSERT_TRUE(detector.Process(still.data(), 168, 168, 96));
+  ASSERT_FALSE(detector.Process(still.data(), 168, 168, 96));
+  ASSERT_FALSE(detector.Active());
+}
+
+TEST(MotionDetectorTest, whenMotionIsMasked_itShouldNotTrigger) {
+  MotionOptions options;
+  options.triggerFrames = 1;
+  options.masks.emplace_back(MotionRegion{0, 0, 0.5, 1});
+  MotionDetector detector{options};
+  ASSERT_FALSE(detector.Process(MotionFrame(168, 96, 0, -1).data(), 168, 168, 96));
+  ASSERT_FALSE(detector.Process(MotionFrame(168, 96, 8, 8).data(), 168, 168, 96));
+  ASSERT_FALSE(detector.Process(MotionFrame(168, 96, 40, 56).data(), 168, 168, 96));
+  ASSERT_TRUE(detector.Process(MotionFrame(168, 96, 120, 24).data(), 168, 168, 96));
+}
+
+PacketBuffer TimedBuffer(size_t size, std::int64_t timestamp) {
+  return PacketBuffer{av_buffer_alloc(size), size, timestamp};
+}
+
+TEST(PacketBufferRingTest, whenDurationIsExceeded_itShouldDropOldestBuffers) {
+  PacketBufferRing ring{100, 1024};
+  for (std::int64_t t = 0; t <= 250; t += 50) {
+    ring.Push(TimedBuffer(10, t));
+  }
+  const auto buffers = ring.Drain();
+  ASSERT_EQ(buffers.size(), 3);
+  ASSERT_EQ(buffers.front().Timestamp(), 150);
+  ASSERT_EQ(buffers.back().Timestamp(), 250);
+  ASSERT_EQ(ring.Bytes(), 0);
+}
+
+TEST(PacketBufferRingTest, whenBytesAreExceeded_itShouldDropOldestBuffers) {
+  PacketBufferRing ring{1000, 25};
+  ring.Push(TimedBuffer(10, 0));
+  ring.Push(TimedBuffer(10, 1));
+  ASSERT_EQ(ring.Bytes(), 20);
+  ring.Push(TimedBuffer(10, 2));
+  ASSERT_EQ(ring.Bytes(), 20);
+  ring.Push(TimedBuffer(30, 3));
+  ASSERT_EQ(ring.Bytes(), 0);
+  ASSERT_TRUE(ring.Drain().empty());
+}
+
+TEST(RateControllerTest, whenQueueKeepsGrowing_itShouldBackOffThenRecover) {
+  RateController controller{{1000, 4000, 100, 10, 2, 3, 4}};
+  ASSERT_FALSE(controller.Update(200));
+  ASSERT_TRUE(controller.Update(300));
+  ASSERT_EQ(controller.Bitrate(), 3000);
+  for (size_t buffered = 400; buffered < 2000; buffered += 100) {
+    controller.Update(buffered);
+  }
+  ASSERT_EQ(controller.Bitrate(), 1000);
+  ASSERT_EQ(controller.FrameInterval(), 4);
+  for (int i = 0; i < 6; i++) {
+    ASSERT_FALSE(controller.Update(0));
+  }
+  ASSERT_EQ(controller.FrameInterval(), 1);
+  controller.Update(0);
+  controller.Update(0);
+  ASSERT_TRUE(controller.Update(0));
+  ASSERT_EQ(controller.Bitrate(), 1100);
+}
+
+TEST(RateControllerTest, whenQueueIsDrainingOrBetweenWatermarks_itShouldHold) {
+  RateController controller{{1000, 4000, 100, 10, 2, 3, 4}};
+  for (size_t buffered = 1000; buffered > 100; buffered -= 50) {
+    ASSERT_FALSE(controller.Update(buffered));
+  }
+  for (int i = 0; i < 10; i++) {
+    ASSERT_FALSE(controller.Update(50));
+  }
+  ASSERT_EQ(controller.Bitrate(), 4000);
+  ASSERT_EQ(controller.FrameInterval(), 1);
+}
+
+}  // namespace codec
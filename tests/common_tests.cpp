@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 #include "common.hpp"
+#include "file.hpp"
+#include "recording.hpp"
 
 using namespace testing;
 
@@ -16,3 +21,138 @@ TEST(CommonFunctionTest, whenEncodingSHA1_itShouldProduceCorrectResult) {
 }
 
 }  // namespace common
+
+namespace os {
+
+TEST(AsyncFileTest, whenWritingAcrossBuffersAndSeekingBack_itShouldProduceTheSameFile) {
+  const auto path = std::filesystem::temp_directory_path() / "async_file_test.bin";
+  AsyncFileOptions options;
+  options.bufferSize = 8;
+  options.maxBuffers = 2;
+  options.preallocateBytes = 4096;
+  options.syncBytes = 16;
+  std::uintmax_t sizeOnFlush = 0;
+  std::uintmax_t sizeOnClose = 0;
+  {
+    AsyncFile file{path.string(), options};
+    ASSERT_TRUE(file.Ok());
+    file.Write("0000");
+    for (int i = 0; i < 10; i++) {
+      file.Write("abcdefg");
+    }
+    file.Seek(0);
+    file.Write("size");
+    file.Seek(file.Size());
+    file.Write("end");
+    file.Flush([&path, &sizeOnFlush] { sizeOnFlush = std::filesystem::file_size(path); });
+    file.Close([&path, &sizeOnClose] { sizeOnClose = std::filesystem::file_size(path); });
+  }
+  ASSERT_GE(sizeOnFlush, 77);
+  ASSERT_EQ(sizeOnClose, 77);
+  std::ifstream in{path, std::ios::binary};
+  std::stringstream content;
+  content << in.rdbuf();
+  std::string expected = "size";
+  for (int i = 0; i < 10; i++) {
+    expected += "abcdefg";
+  }
+  ASSERT_EQ(content.str(), expected + "end");
+  std::filesystem::remove(path);
+}
+
+TEST(RecordingIndexTest, whenFindingAndExpiring_itShouldSelectSegmentsByTimeAndQuota) {
+  const auto path = std::filesystem::temp_directory_path() / "recording_index_find_test.idx";
+  std::filesystem::remove(path);
+  RecordingIndex index{path.string()};
+  index.Add({"c.mp4", 2000, 3000, 30});
+  index.Add({"a.mp4", 0, 1000, 10});
+  index.Add({"b.mp4", 1000, 2000, 20});
+  ASSERT_EQ(index.TotalSize(), 60);
+  const auto found = index.Find(1500, 2500);
+  ASSERT_EQ(found.size(), 2);
+  ASSERT_EQ(found[0].name, "b.mp4");
+  ASSERT_EQ(found[1].name, "c.mp4");
+  ASSERT_TRUE(index.Find(3000, 4000).empty());
+  const auto expired = index.Expire(50, 0);
+  ASSERT_EQ(expired.size(), 1);
+  ASSERT_EQ(expired[0].name, "a.mp4");
+  ASSERT_EQ(index.Expire(0, 1500).size(), 1);
+  ASSERT_EQ(index.List().size(), 1);
+  ASSERT_EQ(index.TotalSize(), 30);
+  std::filesystem::remove(path);
+}
+
+TEST(RecordingIndexTest, whenReloadingAfterATornWrite_itShouldKeepTheCompleteRecords) {
+  const auto path = std::filesystem::temp_directory_path() / "recording_index_reload_test.idx";
+  std::filesystem::remove(path);
+  {
+    RecordingIndex index{path.string()};
+    index.Add({"a.mp4", 0, 1000, 10});
+    index.Add({"b.mp4", 1000, 2000, 20});
+    index.Expire(0, 500);
+  }
+  {
+    std::ofstream out{path, std::ios::binary | std::ios::app};
+    out << "torn";
+  }
+  {
+    RecordingIndex index{path.string()};
+    const auto segments = index.List();
+    ASSERT_EQ(segments.size(), 1);
+    ASSERT_EQ(segments[0].name, "b.mp4");
+    ASSERT_EQ(segments[0].size, 20);
+    index.Add({"c.mp4", 2000, 3000, 30});
+    index.Add({"d.mp4", 3000, 4000, 40});
+    index.Add({"d.mp4", 3000, 4500, 45});
+    index.Remove("b.mp4");
+  }
+  RecordingIndex index{path.string()};
+  const auto segments = index.List();
+  ASSERT_EQ(segments.size(), 2);
+  ASSERT_EQ(segments[0].name, "c.mp4");
+  ASSERT_EQ(segments[1].end, 4500);
+  ASSERT_EQ(index.TotalSize(), 75);
+  std::filesystem::remove(path);
+}
+
+TEST(RecordingIndexTest, whenCompactionFailsAtStartup_itShouldKeepAppendingToTheLog) {
+  const auto path = std::filesystem::temp_directory_path() / "recording_index_compact_test.idx";
+  const auto tmp = std::filesystem::path{path.string() + ".tmp"};
+  std::filesystem::remove(path);
+  {
+    RecordingIndex index{path.string()};
+    index.Add({"a.mp4", 0, 1000, 10});
+    index.Add({"b.mp4", 1000, 2000, 20});
+    index.Add({"c.mp4", 2000, 3000, 30});
+    index.Remove("a.mp4");
+    index.Remove("b.mp4");
+  }
+  std::filesystem::create_directory(tmp);
+  {
+    RecordingIndex index{path.string()};
+    index.Add({"d.mp4", 3000, 4000, 40});
+  }
+  std::filesystem::remove(tmp);
+  RecordingIndex index{path.string()};
+  const auto segments = index.List();
+  ASSERT_EQ(segments.size(), 2);
+  ASSERT_EQ(segments[1].name, "d.mp4");
+  std::filesystem::remove(path);
+}
+
+TEST(RecordingIndexTest, whenFindingAFragmentSpan_itShouldStartAtTheKeyframeBeforeTheRequestedTime) {
+  const std::vector<RecordingFragment> fragments{{0, 100, 50}, {2000, 150, 60}, {4000, 210, 70}, {6000, 280, 80}};
+  const auto middle = FindFragmentSpan(fragments, 2500, 4500);
+  ASSERT_TRUE(middle);
+  ASSERT_EQ(middle->time, 2000);
+  ASSERT_EQ(middle->offset, 150);
+  ASSERT_EQ(middle->length, 130);
+  const auto tail = FindFragmentSpan(fragments, 7000, 9000);
+  ASSERT_TRUE(tail);
+  ASSERT_EQ(tail->offset, 280);
+  ASSERT_EQ(tail->length, 80);
+  ASSERT_FALSE(FindFragmentSpan(fragments, -2000, 0));
+  ASSERT_FALSE(FindFragmentSpan({}, 0, 1000));
+}
+
+}  // namespace os
@@ -1,6 +1,13 @@
 #include <gtest/gtest.h>
 #include <spdlog/spdlog.h>
+#include <fstream>
+#include "asset.hpp"
+#include "hls.hpp"
+#include "hpack.hpp"
 #include "http.hpp"
+#include "http2.hpp"
+#include "protocol.hpp"
+#include "router.hpp"
 #include "websocket.hpp"
 
 using namespace testing;
@@ -75,4 +82,412 @@ TEST(WebsocketHandshakeBuilderTest, whenReceivedValidUpgradeRequest_itShouldProd
   ASSERT_EQ(resp->headers.at("Sec-WebSocket-Accept"), "HSmrc0sMlYUkAGmm5OPpG2HaGWk=");
 }
 
+std::string BuildMaskedWebsocketFrame(bool fin, std::uint8_t opcode, const std::string& data) {
+  const std::uint8_t maskKey[4] = {0x12, 0x34, 0x56, 0x78};
+  std::string frame;
+  frame += static_cast<char>((fin << 7) | opcode);
+  frame += static_cast<char>(0x80 | 126);
+  frame += static_cast<char>(data.size() >> 8);
+  frame += static_cast<char>(data.size());
+  frame.append(reinterpret_cast<const char*>(maskKey), 4);
+  for (size_t i = 0; i < data.size(); i++) {
+    frame += static_cast<char>(data[i] ^ maskKey[i % 4]);
+  }
+  return frame;
+}
+
+TEST(WebsocketParserTest, whenReceivedFragmentedMessage_itShouldUnmaskAndReassembleIt) {
+  ConcreteWebsocketParser sut;
+  const std::string part1(1000, 'a');
+  const std::string part2(333, 'b');
+  std::string payload = BuildMaskedWebsocketFrame(false, 0x1, part1) + BuildMaskedWebsocketFrame(true, 0x9, "ping") +
+                        BuildMaskedWebsocketFrame(true, 0x0, part2);
+  auto ping = sut.Parse(payload);
+  ASSERT_TRUE(ping);
+  ASSERT_EQ(ping->opcode, 0x9);
+  ASSERT_EQ(ping->payload, "ping");
+  auto message = sut.Parse(payload);
+  ASSERT_TRUE(message);
+  ASSERT_TRUE(message->fin);
+  ASSERT_EQ(message->opcode, 0x1);
+  ASSERT_EQ(message->payload, part1 + part2);
+  ASSERT_TRUE(payload.empty());
+}
+
+TEST(WebsocketParserTest, whenReceivedUnexpectedContinuation_itShouldFailWithProtocolError) {
+  ConcreteWebsocketParser sut;
+  std::string payload = BuildMaskedWebsocketFrame(true, 0x0, "data");
+  auto frame = sut.Parse(payload);
+  ASSERT_TRUE(frame);
+  ASSERT_EQ(frame->opcode, 0x8);
+  ASSERT_EQ(frame->payload, std::string("\x03\xea"));
+  ASSERT_FALSE(sut.Parse(payload));
+}
+
+TEST(HttpByteRangeTest, whenReceivedValidRanges_itShouldResolveThemAgainstTheFileSize) {
+  auto ranges = ParseByteRanges("bytes=0-499, 9500-, -200, 10000-10100", 10000);
+  ASSERT_TRUE(ranges);
+  ASSERT_EQ(ranges->size(), 3);
+  ASSERT_EQ((*ranges)[0].offset, 0);
+  ASSERT_EQ((*ranges)[0].length, 500);
+  ASSERT_EQ((*ranges)[1].offset, 9500);
+  ASSERT_EQ((*ranges)[1].length, 500);
+  ASSERT_EQ((*ranges)[2].offset, 9800);
+  ASSERT_EQ((*ranges)[2].length, 200);
+}
+
+TEST(HttpByteRangeTest, whenReceivedUnsatisfiableOrInvalidRanges_itShouldRejectThem) {
+  auto unsatisfiable = ParseByteRanges("bytes=10000-", 10000);
+  ASSERT_TRUE(unsatisfiable);
+  ASSERT_TRUE(unsatisfiable->empty());
+  ASSERT_FALSE(ParseByteRanges("bytes=500-100", 10000));
+  ASSERT_FALSE(ParseByteRanges("items=0-1", 10000));
+  ASSERT_FALSE(ParseByteRanges("bytes=a-b", 10000));
+}
+
+TEST(HpackTest, whenReceivedHuffmanEncodedRequests_itShouldDecodeThemWithDynamicTable) {
+  HpackDecoder sut{4096};
+  auto headers1 = sut.Decode("\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4\xff");
+  ASSERT_TRUE(headers1);
+  ASSERT_EQ(headers1->size(), 4);
+  ASSERT_EQ((*headers1)[0].field, ":method");
+  ASSERT_EQ((*headers1)[0].value, "GET");
+  ASSERT_EQ((*headers1)[3].field, ":authority");
+  ASSERT_EQ((*headers1)[3].value, "www.example.com");
+  auto headers2 = sut.Decode("\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xbf");
+  ASSERT_TRUE(headers2);
+  ASSERT_EQ(headers2->size(), 5);
+  ASSERT_EQ((*headers2)[3].value, "www.example.com");
+  ASSERT_EQ((*headers2)[4].field, "cache-control");
+  ASSERT_EQ((*headers2)[4].value, "no-cache");
+  ASSERT_FALSE(sut.Decode("\xff\xff\xff\x0f"));
+}
+
+TEST(HpackTest, whenEncodedResponseHeaders_itShouldDecodeThemBack) {
+  HpackEncoder encoder;
+  HpackDecoder decoder{4096};
+  HpackHeaderList headers{{":status", "200"}, {"content-type", "text/html"}, {"x-custom", "value"}};
+  auto decoded = decoder.Decode(encoder.Encode(headers));
+  ASSERT_TRUE(decoded);
+  ASSERT_EQ(decoded->size(), 3);
+  for (size_t i = 0; i < headers.size(); i++) {
+    ASSERT_EQ((*decoded)[i].field, headers[i].field);
+    ASSERT_EQ((*decoded)[i].value, headers[i].value);
+  }
+}
+
+class FakeTcpSender : public TcpSender {
+public:
+  void Send(std::string_view buf) override {
+    written += buf;
+  }
+  void Send(std::shared_ptr<const std::string> buf) override {
+    written += *buf;
+  }
+  void Send(os::File) override {
+  }
+  void Send(std::shared_ptr<const os::File> file, size_t offset, size_t size) override {
+    files.push_back(FileSpan{std::move(file), offset, size});
+  }
+  void SendBuffered() override {
+  }
+  size_t Buffered() const override {
+    return 0;
+  }
+  void Close() override {
+    closing = true;
+  }
+  bool Closing() const override {
+    return closing;
+  }
+
+  struct FileSpan {
+    std::shared_ptr<const os::File> file;
+    size_t offset;
+    size_t size;
+  };
+
+  std::string written;
+  std::vector<FileSpan> files;
+  bool closing{false};
+};
+
+class FixedResponder : public HttpProcessor, public HttpProcessorFactory {
+public:
+  explicit FixedResponder(HttpSender* sender = nullptr) : sender{sender} {
+  }
+  void Process(HttpRequest&&) override {
+    HttpResponse resp;
+    resp.status = HttpStatus::OK;
+    resp.body = "hello world";
+    sender->Send(std::move(resp));
+  }
+  std::unique_ptr<HttpProcessor> Create(HttpSender& sender) const override {
+    return std::make_unique<FixedResponder>(&sender);
+  }
+
+private:
+  HttpSender* sender;
+};
+
+class Http2ConnectionTest : public Test {
+protected:
+  void SetUp() override {
+    httpMapping.Add(HttpMethod::GET, "/hello", std::make_unique<FixedResponder>());
+    sut.Process("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+    sut.Process(Frame(0x4, 0, 0, ""));
+  }
+
+  static std::string Frame(std::uint8_t type, std::uint8_t flags, std::uint32_t streamId, std::string_view payload) {
+    std::string frame;
+    for (int shift : {16, 8, 0}) {
+      frame += static_cast<char>((payload.size() >> shift) & 0xff);
+    }
+    frame += static_cast<char>(type);
+    frame += static_cast<char>(flags);
+    for (int shift : {24, 16, 8, 0}) {
+      frame += static_cast<char>((streamId >> shift) & 0xff);
+    }
+    frame += payload;
+    return frame;
+  }
+
+  static std::string Uint32(std::uint32_t value) {
+    return Frame(0, 0, value, "").substr(5);
+  }
+
+  std::string RequestBlock(std::string_view path) const {
+    return HpackEncoder{}.Encode({{":method", "GET"}, {":scheme", "http"}, {":path", std::string{path}}});
+  }
+
+  std::vector<Http2Frame> Received() {
+    std::vector<Http2Frame> frames;
+    while (auto frame = parser.Parse(sender.written)) {
+      frames.emplace_back(std::move(*frame));
+    }
+    return frames;
+  }
+
+  FakeTcpSender sender;
+  HttpRouteMapping httpMapping;
+  WebsocketRouteMapping websocketMapping;
+  ConcreteRouterFactory routerFactory{httpMapping, websocketMapping};
+  ProtocolLayer sut{sender, routerFactory};
+  Http2FrameParser parser;
+};
+
+TEST_F(Http2ConnectionTest, whenReceivedPrefaceAndRequest_itShouldSwitchToHttp2AndRespond) {
+  sut.Process(Frame(0x1, 0x5, 1, RequestBlock("/hello")));
+  const auto frames = Received();
+  ASSERT_EQ(frames.size(), 4);
+  ASSERT_EQ(frames[0].type, 0x4);
+  ASSERT_EQ(frames[0].flags, 0);
+  ASSERT_EQ(frames[1].type, 0x4);
+  ASSERT_EQ(frames[1].flags, 0x1);
+  ASSERT_EQ(frames[2].type, 0x1);
+  ASSERT_EQ(frames[2].streamId, 1);
+  auto headers = HpackDecoder{4096}.Decode(frames[2].payload);
+  ASSERT_TRUE(headers);
+  ASSERT_EQ(headers->front().field, ":status");
+  ASSERT_EQ(headers->front().value, "200");
+  ASSERT_EQ(frames[3].type, 0x0);
+  ASSERT_EQ(frames[3].flags, 0x1);
+  ASSERT_EQ(frames[3].payload, "hello world");
+}
+
+TEST_F(Http2ConnectionTest, whenHeadersArePaddedAndContinued_itShouldReassembleThem) {
+  const auto block = RequestBlock("/hello");
+  sut.Process(Frame(0x1, 0x9, 1, "\x02" + block.substr(0, 3) + "pp"));
+  ASSERT_EQ(Received().size(), 2);
+  sut.Process(Frame(0x9, 0x4, 1, block.substr(3)));
+  const auto frames = Received();
+  ASSERT_EQ(frames.size(), 2);
+  ASSERT_EQ(frames[1].payload, "hello world");
+}
+
+TEST_F(Http2ConnectionTest, whenStreamWindowIsExhausted_itShouldHoldDataUntilWindowUpdate) {
+  sut.Process(Frame(0x4, 0, 0, std::string{"\x00\x04", 2} + Uint32(5)));
+  sut.Process(Frame(0x1, 0x5, 1, RequestBlock("/hello")));
+  auto frames = Received();
+  ASSERT_EQ(frames.back().type, 0x0);
+  ASSERT_EQ(frames.back().flags, 0);
+  ASSERT_EQ(frames.back().payload, "hello");
+  sut.Process(Frame(0x8, 0, 1, Uint32(100)));
+  frames = Received();
+  ASSERT_EQ(frames.size(), 1);
+  ASSERT_EQ(frames[0].flags, 0x1);
+  ASSERT_EQ(frames[0].payload, " world");
+}
+
+TEST_F(Http2ConnectionTest, whenStreamIsReset_itShouldStopSendingOnIt) {
+  sut.Process(Frame(0x4, 0, 0, std::string{"\x00\x04", 2} + Uint32(5)));
+  sut.Process(Frame(0x1, 0x5, 1, RequestBlock("/hello")));
+  Received();
+  sut.Process(Frame(0x3, 0, 1, Uint32(0x8)));
+  sut.Process(Frame(0x8, 0, 1, Uint32(100)));
+  ASSERT_TRUE(Received().empty());
+  ASSERT_FALSE(sender.closing);
+}
+
+TEST_F(Http2ConnectionTest, whenReceivedProtocolError_itShouldSendGoAwayAndClose) {
+  Received();
+  sut.Process(Frame(0x0, 0, 0, "data"));
+  const auto frames = Received();
+  ASSERT_EQ(frames.size(), 1);
+  ASSERT_EQ(frames[0].type, 0x7);
+  ASSERT_EQ(frames[0].payload, Uint32(0) + Uint32(0x1));
+  ASSERT_TRUE(sender.closing);
+}
+
+TEST_F(Http2ConnectionTest, whenReceivedGoAway_itShouldClose) {
+  sut.Process(Frame(0x7, 0, 0, Uint32(0) + Uint32(0)));
+  ASSERT_TRUE(sender.closing);
+}
+
+class WebsocketGreeter : public WebsocketProcessor, public WebsocketProcessorFactory {
+public:
+  explicit WebsocketGreeter(WebsocketSender* sender = nullptr) {
+    if (sender) {
+      sender->Send(WebsocketFrame{true, 0x1, "hello"});
+    }
+  }
+  void Process(WebsocketFrame&&) override {
+  }
+  std::unique_ptr<WebsocketProcessor> Create(WebsocketSender& sender) const override {
+    return std::make_unique<WebsocketGreeter>(&sender);
+  }
+};
+
+TEST(RouterTest, whenWebsocketProcessorSendsOnCreation_itShouldFollowTheHandshake) {
+  FakeTcpSender sender;
+  HttpRouteMapping httpMapping;
+  WebsocketRouteMapping websocketMapping;
+  websocketMapping.Add("/ws", std::make_unique<WebsocketGreeter>());
+  ConcreteRouterFactory routerFactory{httpMapping, websocketMapping};
+  ProtocolLayer sut{sender, routerFactory};
+  sut.Process(
+      "GET /ws HTTP/1.1\r\nConnection: Upgrade\r\nUpgrade: websocket\r\n"
+      "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n\r\n");
+  ASSERT_EQ(sender.written.rfind("HTTP/1.1 101", 0), 0);
+  ASSERT_EQ(sender.written.substr(sender.written.find("\r\n\r\n") + 4), "\x81\x05hello");
+}
+
+TEST(HttpFileSenderTest, whenSendingMultipleRanges_itShouldSendEveryPartFromOneDescriptor) {
+  const std::string path{"http_file_sender_test.bin"};
+  std::ofstream{path} << std::string(100, 'a');
+  FakeTcpSender tcpSender;
+  ConcreteHttpSender sut{tcpSender};
+  FileHttpResponse resp;
+  resp.path = path;
+  resp.range = "bytes=0-9,50-59";
+  sut.Send(std::move(resp));
+  std::remove(path.c_str());
+  ASSERT_EQ(tcpSender.files.size(), 2);
+  ASSERT_EQ(tcpSender.files[0].file, tcpSender.files[1].file);
+  ASSERT_EQ(tcpSender.files[0].offset, 0);
+  ASSERT_EQ(tcpSender.files[1].offset, 50);
+  const auto header = tcpSender.written.find("\r\n\r\n") + 4;
+  const auto contentLength = tcpSender.written.find("Content-Length: ") + 16;
+  ASSERT_EQ(std::stoul(tcpSender.written.substr(contentLength)),
+      tcpSender.written.size() - header + tcpSender.files[0].size + tcpSender.files[1].size);
+}
+
+TEST(HttpFileSenderTest, whenSendingFileParts_itShouldSendEveryPartFromOneDescriptor) {
+  const std::string path{"http_file_sender_test.bin"};
+  std::ofstream{path} << std::string(100, 'a');
+  FakeTcpSender tcpSender;
+  ConcreteHttpSender sut{tcpSender};
+  FileHttpResponse resp;
+  resp.path = path;
+  resp.parts = {{0, 10}, {60, 40}};
+  sut.Send(std::move(resp));
+  std::remove(path.c_str());
+  ASSERT_EQ(tcpSender.files.size(), 2);
+  ASSERT_EQ(tcpSender.files[0].file, tcpSender.files[1].file);
+  ASSERT_NE(tcpSender.written.find("Content-Length: 50\r\n"), std::string::npos);
+}
+
+TEST(HlsSegmentRingTest, whenPartsAreAdded_itShouldCutSegmentsAtIndependentParts) {
+  HlsSegmentRing sut{2, 0.2};
+  sut.AddPart("a", 0.2, true);
+  sut.AddPart("b", 0.2, false);
+  sut.AddPart("c", 0.2, true);
+  sut.AddPart("d", 0.2, true);
+  const auto playlist = sut.Playlist();
+  ASSERT_NE(playlist.find("#EXT-X-MEDIA-SEQUENCE:1\n"), std::string::npos);
+  ASSERT_NE(playlist.find("#EXTINF:0.200,\nsegment.m4s?msn=1\n"), std::string::npos);
+  ASSERT_NE(playlist.find("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part.m4s?msn=2&part=1\""), std::string::npos);
+  ASSERT_TRUE(sut.Segment(0).empty());
+  ASSERT_EQ(sut.Segment(1).size(), 1);
+  ASSERT_TRUE(sut.Segment(2).empty());
+  ASSERT_EQ(*sut.Part(2, 0), "d");
+  ASSERT_TRUE(sut.Reachable(4));
+  ASSERT_FALSE(sut.Reachable(5));
+}
+
+TEST(HlsSegmentRingTest, whenRequestedPartIsNotYetAvailable_itShouldNotifyOnceItIs) {
+  HlsSegmentRing sut{4, 0.2};
+  sut.AddPart("a", 0.2, true);
+  ASSERT_FALSE(sut.Wait(0, 0, [](bool) {}));
+  int notified = 0;
+  const auto id = sut.Wait(0, 1, [&notified](bool ready) { notified += ready ? 1 : 100; });
+  ASSERT_TRUE(id);
+  const auto cancelled = sut.Wait(1, std::nullopt, [&notified](bool) { notified += 10; });
+  ASSERT_TRUE(cancelled);
+  sut.Cancel(*cancelled);
+  sut.AddPart("b", 0.2, false);
+  sut.AddPart("c", 0.2, true);
+  sut.AddPart("d", 0.2, true);
+  ASSERT_EQ(notified, 1);
+}
+
+TEST(HlsSegmentRingTest, whenWaiterOutlivesThreeTargetDurations_itShouldGiveUp) {
+  HlsSegmentRing sut{4, 0.2};
+  sut.AddPart("a", 0.2, true);
+  std::optional<bool> result;
+  ASSERT_TRUE(sut.Wait(0, 1, [&result](bool ready) { result = ready; }));
+  sut.ExpireWaiters(std::chrono::steady_clock::now() + std::chrono::seconds(1));
+  ASSERT_FALSE(result);
+  sut.ExpireWaiters(std::chrono::steady_clock::now() + std::chrono::seconds(4));
+  ASSERT_EQ(result, false);
+  sut.AddPart("b", 0.2, false);
+  ASSERT_EQ(result, false);
+}
+
+class StaticAssetCacheTest : public Test {
+protected:
+  void SetUp() override {
+    std::ofstream{path} << std::string(4096, 'a');
+    sut.Add(path, "text/html");
+  }
+
+  void TearDown() override {
+    std::remove(path.c_str());
+  }
+
+  std::string path{"static_asset_cache_test.html"};
+  StaticAssetCache sut;
+};
+
+TEST_F(StaticAssetCacheTest, whenClientAcceptsCompression_itShouldServePrecompressedVariant) {
+  HttpRequest req;
+  req.headers.emplace("accept-encoding", "gzip, deflate, br;q=0");
+  auto resp = sut.BuildResponse(path, req);
+  ASSERT_EQ(resp.status, HttpStatus::OK);
+  ASSERT_EQ(resp.headers.at("Content-Encoding"), "gzip");
+  ASSERT_LT(resp.body.size(), 4096);
+  ASSERT_EQ(resp.headers.at("Vary"), "Accept-Encoding");
+}
+
+TEST_F(StaticAssetCacheTest, whenEntityTagMatches_itShouldRespondNotModified) {
+  HttpRequest req;
+  auto resp1 = sut.BuildResponse(path, req);
+  ASSERT_EQ(resp1.status, HttpStatus::OK);
+  ASSERT_EQ(resp1.body, std::string(4096, 'a'));
+  req.headers.emplace("if-none-match", "W/" + resp1.headers.at("ETag"));
+  auto resp2 = sut.BuildResponse(path, req);
+  ASSERT_EQ(resp2.status, HttpStatus::NotModified);
+  ASSERT_TRUE(resp2.body.empty());
+}
+
 }  // namespace network